@@ -0,0 +1,143 @@
+#include <cstdio>
+#include <cstring>
+#include "librvemu.h"
+#include "machine.h"
+#include "commit.h"
+#include "csr.h"
+#include "loader.h"
+
+struct rvemu {
+    Machine  *m  ;
+    CommitLog log;
+    bool      irq; // rvemu_set_irq() changed mip since the last step
+};
+
+rvemu_t *rvemu_open(const char *image, int syscall_proxy) {
+    // Machine() exits on an image it cannot load
+    if (!image_ok(image, MEMSIZE)) {
+        return NULL;
+    }
+    rvemu_t *h = new rvemu_t;
+    h->m = new Machine(image);
+    h->m->syscall_proxy = syscall_proxy;
+    h->irq = false;
+    h->log.begin(*h->m);
+    return h;
+}
+
+void rvemu_close(rvemu_t *h) {
+    delete h->m;
+    delete h;
+}
+
+int rvemu_step(rvemu_t *h, rvemu_commit_t *c) {
+    Machine &m = *h->m;
+    Commit   k;
+    // an interrupt it made pending is taken before the instruction, so that
+    // this step executes the first instruction of its handler
+    if (h->irq) {
+        h->irq = false;
+        if (m.cycle>=m.next_event.load(std::memory_order_relaxed)) {
+            m.halt = 0;
+            m.event();
+            if (m.halt) {
+                memset(c, 0, sizeof(*c));
+                c->cycle   = m.cycle;
+                c->pc      = m.r.pc;
+                c->next_pc = m.r.pc;
+                m.smp->halt_all(&m);
+                return 1;
+            }
+        }
+    }
+    int halt = h->log.step(m, k);
+    c->cycle      = k.cycle;
+    c->pc         = k.pc;
+    c->insn       = (k.compressed) ? k.cir : k.ir;
+    c->compressed = k.compressed;
+    c->trap       = k.trap;
+    c->priv       = k.priv;
+    // rd of an instruction that writes one, even with the value it had (the
+    // commit log only has registers that changed); otherwise the first one
+    // changed, as by an ecall served on the host
+    uint8_t opcode = (k.ir >> 2) & 0x1f;
+    uint8_t funct3 = (k.ir >> 12) & 0x7;
+    int     rd     = (k.ir >> 7) & 0x1f;
+    bool    csr    = (opcode==0b11100) && (funct3!=0) && (funct3!=0b100);
+    if (!k.trap && (((WRITES_RD >> opcode) & 0x1) || csr) && (rd!=0)) {
+        c->rd    = rd;
+        c->value = m.reg[rd];
+    } else {
+        c->rd    = (k.nreg!=0) ? k.rd   [0] : 0;
+        c->value = (k.nreg!=0) ? k.value[0] : 0;
+    }
+    c->mem_len    = (k.trap) ? 0 : k.store_len;
+    c->mem_addr   = k.store_addr;
+    c->mem_data   = k.store_data;
+    c->next_pc    = m.r.pc;
+    if (halt) {
+        m.smp->halt_all(&m);
+    }
+    return halt;
+}
+
+int rvemu_exit_code(rvemu_t *h) {
+    return h->m->exit_code;
+}
+
+uint64_t rvemu_pc(rvemu_t *h) {
+    return h->m->r.pc;
+}
+
+uint64_t rvemu_reg(rvemu_t *h, int i) {
+    return ((i>0) && (i<32)) ? h->m->reg[i] : 0;
+}
+
+void rvemu_set_reg(rvemu_t *h, int i, uint64_t value) {
+    if ((i>0) && (i<32)) {
+        h->m->reg[i] = value;
+        h->log.shadow[i] = value;
+    }
+}
+
+void rvemu_set_irq(rvemu_t *h, uint64_t mip, int level) {
+    Machine &m = *h->m;
+    // MSIP and MTIP come from the CLINT of the model
+    mip &= MIP_SSIP | MIP_STIP | MIP_SEIP | MIP_MEIP;
+    if (level) {
+        m.mip |=  (uintx_t)mip;
+    } else {
+        m.mip &= ~(uintx_t)mip;
+    }
+    // taken by the next rvemu_step(), which reports its pc and halt
+    m.schedule();
+    h->irq = true;
+}
+
+static bool valid_len(int len) {
+    return (len==1) || (len==2) || (len==4) || (len==8);
+}
+
+int rvemu_read_mem(rvemu_t *h, uint64_t addr, int len, uint64_t *data) {
+    if (!valid_len(len)) {
+        return -1;
+    }
+    try {
+        *data = h->m->phys_read(addr, len, ACCESS_LOAD);
+    } catch (const Exception &e) {
+        return -1;
+    }
+    return 0;
+}
+
+int rvemu_write_mem(rvemu_t *h, uint64_t addr, int len, uint64_t data) {
+    if (!valid_len(len)) {
+        return -1;
+    }
+    try {
+        h->m->phys_write(addr, data, len);
+    } catch (const Exception &e) {
+        return -1;
+    }
+    return 0;
+}
@@ -0,0 +1,75 @@
+#if !defined(LIBRVEMU_H_)
+#define LIBRVEMU_H_
+
+//------------------------------------------------------------------------------
+// librvemu: rvemu as a golden model inside an RTL testbench
+//------------------------------------------------------------------------------
+// A C interface (usable from DPI-C) that steps a hart one instruction at a
+// time and returns what it committed, so that a testbench can check every
+// commit of the core in-process instead of diffing traces offline.
+//
+//   rvemu_t *h = rvemu_open("prog.bin", 0);
+//   rvemu_commit_t c;
+//   while (!rvemu_step(h, &c)) {
+//       // compare c with the commit of the core
+//   }
+//   rvemu_close(h);
+//
+// librvemu32.so/librvemu64.so are built by make lib (make XLEN=32 lib);
+// addresses and register values are 64-bit in both.
+#include <stdint.h>
+
+#if defined(__cplusplus)
+extern "C" {
+#endif
+
+typedef struct rvemu rvemu_t;
+
+typedef struct {
+    uint64_t cycle     ; // instructions executed, this one included
+    uint64_t pc        ;
+    uint32_t insn      ; // as fetched: 16 bits if compressed
+    uint8_t  compressed;
+    uint8_t  trap      ; // raised an exception and did not retire
+    uint8_t  priv      ; // privilege level it executed in (0: U, 1: S, 3: M)
+    uint8_t  rd        ; // register written, 0 if none
+    uint64_t value     ; // its new value
+    uint8_t  mem_len   ; // bytes stored, 0 if none
+    uint64_t mem_addr  ; // virtual address
+    uint64_t mem_data  ;
+    uint64_t next_pc   ; // of the next instruction (a trap handler after a trap or interrupt)
+} rvemu_commit_t;
+
+// Loads an image (ELF or memfile) and resets the hart to its entry point.
+// syscall_proxy: serve newlib system calls on the host (--syscall).
+// Returns NULL if the image cannot be read.
+rvemu_t *rvemu_open (const char *image, int syscall_proxy);
+void     rvemu_close(rvemu_t *h);
+
+// Executes one instruction and describes it in *c. Returns 1 when the
+// program has ended (tohost, exit), 0 otherwise.
+int      rvemu_step (rvemu_t *h, rvemu_commit_t *c);
+int      rvemu_exit_code(rvemu_t *h);
+
+uint64_t rvemu_pc (rvemu_t *h); // of the next instruction
+uint64_t rvemu_reg(rvemu_t *h, int i);
+void     rvemu_set_reg(rvemu_t *h, int i, uint64_t value);
+
+// Raises (level 1) or lowers (level 0) interrupt lines: a mask of mip bits,
+// e.g. 0x800 (MEIP) for the external interrupt of the core. An interrupt
+// that is pending and enabled is taken at the start of the next step, so
+// that step executes the first instruction of its handler, as the core would
+// report it.
+void     rvemu_set_irq(rvemu_t *h, uint64_t mip, int level);
+
+// Physical memory, for values the model cannot know, such as those a core
+// read from a device: write the value before stepping the load. len is 1, 2,
+// 4 or 8. Return 0 on success, -1 if nothing is at addr.
+int      rvemu_read_mem (rvemu_t *h, uint64_t addr, int len, uint64_t *data);
+int      rvemu_write_mem(rvemu_t *h, uint64_t addr, int len, uint64_t  data);
+
+#if defined(__cplusplus)
+}
+#endif
+
+#endif // LIBRVEMU_H_
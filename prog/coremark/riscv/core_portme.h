@@ -27,7 +27,7 @@ Original Author: Shay Gal-on
 //#define XLEN 64
 #endif
 
-static volatile unsigned int *MTIME_ADDR  = (unsigned int*)0x20000000;
+static volatile unsigned int *MTIME_ADDR  = (unsigned int*)0x0200bff8; // CLINT mtime
 
 /************************/
 /* Data types and settings */
@@ -0,0 +1,178 @@
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <algorithm>
+#include <chrono>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <dirent.h>
+#include <sys/stat.h>
+#include "machine.h"
+#include "loader.h"
+#include "batch.h"
+
+std::vector<std::string> batch_files(int argc, char **argv) {
+    std::vector<std::string> files;
+    for (int i=0; i<argc; i++) {
+        struct stat st;
+        if (stat(argv[i], &st)!=0) {
+            fprintf(stderr, "Error: memfile (%s) cannot be found.\n", argv[i]);
+            exit(0);
+        }
+        if (!S_ISDIR(st.st_mode)) {
+            files.push_back(argv[i]);
+            continue;
+        }
+        std::vector<std::string> names;
+        DIR *dir = opendir(argv[i]);
+        struct dirent *e;
+        while ((dir!=NULL) && ((e = readdir(dir))!=NULL)) {
+            size_t len = strlen(e->d_name);
+            if ((len>4) && (strcmp(e->d_name+len-4, ".bin")==0)) {
+                names.push_back(e->d_name);
+            }
+        }
+        if (dir!=NULL) {
+            closedir(dir);
+        }
+        std::sort(names.begin(), names.end());
+        for (auto &name : names) {
+            files.push_back(std::string(argv[i]) + "/" + name);
+        }
+    }
+    return files;
+}
+
+static void run_one(BatchResult &res, bool syscall_proxy) {
+    // the loaders exit on a bad image, which would end the whole batch
+    if (!image_ok(res.path.c_str(), MEMSIZE)) {
+        fprintf(stderr, "Error: memfile (%s) cannot be loaded.\n", res.path.c_str());
+        res.bad_image = true;
+        return;
+    }
+    auto     start   = std::chrono::steady_clock::now();
+    Machine *machine = new Machine(res.path.c_str());
+    machine->syscall_proxy = syscall_proxy;
+    machine->console       = &res.console;
+    machine->run();
+    res.exit_code = machine->exit_code;
+    res.timeout   = (machine->cycle>=TIMEOUT);
+    res.instret   = machine->cycle + machine->minstret_offset;
+    delete machine;
+    res.seconds   = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+// Per-thread deque of indices into the results. The owner takes from the
+// front, thieves from the back. Programs are long compared with a lock, so a
+// mutex per deque is enough.
+struct WorkQueue {
+    std::mutex      lock;
+    std::deque<int> jobs;
+
+    bool pop_front(int &job) {
+        std::lock_guard<std::mutex> guard(lock);
+        if (jobs.empty()) return false;
+        job = jobs.front();
+        jobs.pop_front();
+        return true;
+    }
+    bool pop_back(int &job) {
+        std::lock_guard<std::mutex> guard(lock);
+        if (jobs.empty()) return false;
+        job = jobs.back();
+        jobs.pop_back();
+        return true;
+    }
+};
+
+static const char *basename_of(const std::string &path) {
+    size_t slash = path.rfind('/');
+    return path.c_str() + ((slash==std::string::npos) ? 0 : slash+1);
+}
+
+// One line per program in the order given, followed by the output of the
+// program if it failed. Returns the number of programs that passed.
+int batch_report(const std::vector<BatchResult> &results, bool host_time) {
+    int width = 0;
+    for (auto &res : results) {
+        width = std::max(width, (int)strlen(basename_of(res.path)));
+    }
+    int passed = 0;
+    for (auto &res : results) {
+        char status[32];
+        bool pass = !res.bad_image && !res.timeout && (res.exit_code==0);
+        if (pass) {
+            snprintf(status, sizeof(status), "pass");
+            passed++;
+        } else if (res.bad_image) {
+            snprintf(status, sizeof(status), "bad image");
+        } else if (res.timeout) {
+            snprintf(status, sizeof(status), "timeout");
+        } else if (res.exit_code==EXIT_TRAP) {
+            snprintf(status, sizeof(status), "trap");
+        } else {
+            snprintf(status, sizeof(status), "fail (test %d)", res.exit_code);
+        }
+        printf("%-*s  %-14s  instret: %12lu", width, basename_of(res.path), status, res.instret);
+        if (host_time) {
+            printf("  host: %9.3f ms", res.seconds * 1000);
+        }
+        printf("\n");
+        if (!pass && !res.console.empty()) {
+            fputs(res.console.c_str(), stdout);
+            if (res.console.back()!='\n') {
+                printf("\n");
+            }
+        }
+    }
+    return passed;
+}
+
+int run_batch(const std::vector<std::string> &files, bool syscall_proxy, int jobs) {
+    int n = files.size();
+    std::vector<BatchResult> results(n);
+    for (int i=0; i<n; i++) {
+        results[i].path = files[i];
+    }
+    if (jobs<=0) {
+        jobs = std::max(1u, std::thread::hardware_concurrency());
+    }
+    jobs = std::max(1, std::min(jobs, n));
+
+    std::vector<WorkQueue> queues(jobs);
+    for (int i=0; i<n; i++) {
+        queues[i % jobs].jobs.push_back(i);
+    }
+    auto worker = [&](int self) {
+        int job;
+        for (;;) {
+            bool found = queues[self].pop_front(job);
+            for (int k=1; !found && (k<jobs); k++) {
+                found = queues[(self+k) % jobs].pop_back(job);
+            }
+            if (!found) {
+                return; // nothing is ever added, so everything is taken
+            }
+            run_one(results[job], syscall_proxy);
+        }
+    };
+    auto start = std::chrono::steady_clock::now();
+    std::vector<std::thread> threads;
+    for (int i=0; i<jobs; i++) {
+        threads.emplace_back(worker, i);
+    }
+    for (auto &t : threads) {
+        t.join();
+    }
+    double wall = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    int passed = batch_report(results, true);
+    double host = 0;
+    for (auto &res : results) {
+        host += res.seconds;
+    }
+    printf("\n%d/%d passed, %d failed (host %.3f s, wall %.3f s, %d threads)\n",
+           passed, n, n-passed, host, wall, jobs);
+    return (passed==n) ? 0 : 1;
+}
@@ -0,0 +1,32 @@
+#if !defined(BATCH_H_)
+#define BATCH_H_
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// --batch: run many independent programs (riscv-tests, benchmarks) in one
+// process. Each program gets its own Machine; the Machines run on a pool of
+// host threads, one deque of pending programs per thread, and an idle thread
+// steals from the back of another thread's deque.
+struct BatchResult {
+    std::string path     ;
+    bool        bad_image; // not a loadable image; the program did not run
+    int         exit_code; // tohost/exit code, EXIT_TRAP after an unhandled trap
+    bool        timeout  ;
+    uint64_t    instret  ;
+    double      seconds  ; // host time
+    std::string console  ; // the program's output
+};
+
+// Directories are expanded to the *.bin files in them, in name order.
+std::vector<std::string> batch_files(int argc, char **argv);
+
+// Prints one line per program, with its output if it failed. Returns the
+// number of programs that passed.
+int batch_report(const std::vector<BatchResult> &results, bool host_time);
+
+// Returns the exit status of rvemu: 0 if every program passed.
+int run_batch(const std::vector<std::string> &files, bool syscall_proxy, int jobs);
+
+#endif // BATCH_H_
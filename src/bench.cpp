@@ -0,0 +1,142 @@
+#include <cstdio>
+#include <cstring>
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include "machine.h"
+#include "bench.h"
+
+struct Stats {
+    double median  ;
+    double mean    ;
+    double variance; // sample variance
+    double min     ;
+    double max     ;
+};
+
+static Stats stats(std::vector<double> v) {
+    Stats s;
+    size_t n = v.size();
+    std::sort(v.begin(), v.end());
+    s.median = (n % 2) ? v[n/2] : (v[n/2-1] + v[n/2]) / 2;
+    s.mean   = 0;
+    for (double x : v) {
+        s.mean += x;
+    }
+    s.mean    /= n;
+    s.variance = 0;
+    for (double x : v) {
+        s.variance += (x - s.mean) * (x - s.mean);
+    }
+    s.variance = (n>1) ? s.variance / (n-1) : 0;
+    s.min      = v.front();
+    s.max      = v.back();
+    return s;
+}
+
+static std::string bench_name(const std::string &path) {
+    size_t slash = path.rfind('/');
+    std::string name = path.substr((slash==std::string::npos) ? 0 : slash+1);
+    size_t dot = name.rfind('.');
+    if ((dot!=std::string::npos) && ((name.substr(dot)==".bin") || (name.substr(dot)==".elf"))) {
+        name.resize(dot);
+    }
+    return name;
+}
+
+// One run; returns the host seconds of Machine::run().
+static double run_timed(BenchResult &res, bool syscall_proxy) {
+    std::string console; // keeps the guest's output off the report
+    Machine *machine = new Machine(res.path.c_str());
+    machine->syscall_proxy = syscall_proxy;
+    machine->console       = &console;
+    auto start = std::chrono::steady_clock::now();
+    machine->run();
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    res.exit_code = machine->exit_code;
+    res.timeout   = (machine->cycle>=TIMEOUT);
+    res.instret   = machine->cycle + machine->minstret_offset;
+    delete machine;
+    return seconds;
+}
+
+static void json_stats(FILE *fp, const char *key, const Stats &s, const char *end) {
+    fprintf(fp, "      \"%s\": {\"median\": %.9g, \"mean\": %.9g, \"variance\": %.9g, \"min\": %.9g, \"max\": %.9g}%s\n",
+            key, s.median, s.mean, s.variance, s.min, s.max, end);
+}
+
+static bool write_json(const char *filename, const std::vector<BenchResult> &results, int repeat) {
+    FILE *fp = fopen(filename, "w");
+    if (fp==NULL) {
+        return false;
+    }
+    double   seconds = 0;
+    uint64_t instret = 0;
+    fprintf(fp, "{\n");
+    fprintf(fp, "  \"xlen\": %d,\n", XLEN);
+    fprintf(fp, "  \"repeat\": %d,\n", repeat);
+    fprintf(fp, "  \"benchmarks\": [\n");
+    for (size_t i=0; i<results.size(); i++) {
+        const BenchResult &res = results[i];
+        Stats t = stats(res.seconds);
+        fprintf(fp, "    {\n");
+        fprintf(fp, "      \"name\": \"%s\",\n", res.name.c_str());
+        fprintf(fp, "      \"path\": \"%s\",\n", res.path.c_str());
+        fprintf(fp, "      \"exit_code\": %d,\n", res.exit_code);
+        fprintf(fp, "      \"timeout\": %s,\n", (res.timeout) ? "true" : "false");
+        fprintf(fp, "      \"instret\": %lu,\n", res.instret);
+        json_stats(fp, "seconds", t, ",");
+        json_stats(fp, "mips", stats(res.mips), ",");
+        fprintf(fp, "      \"runs\": [");
+        for (size_t k=0; k<res.seconds.size(); k++) {
+            fprintf(fp, "%s%.9g", (k!=0) ? ", " : "", res.seconds[k]);
+        }
+        fprintf(fp, "]\n");
+        fprintf(fp, "    }%s\n", (i<results.size()-1) ? "," : "");
+        seconds += t.median;
+        instret += res.instret;
+    }
+    fprintf(fp, "  ],\n");
+    fprintf(fp, "  \"total\": {\"instret\": %lu, \"seconds\": %.9g, \"mips\": %.9g}\n",
+            instret, seconds, (seconds>0) ? instret / seconds / 1e6 : 0.0);
+    fprintf(fp, "}\n");
+    return fclose(fp)==0;
+}
+
+int run_bench(const std::vector<std::string> &files, bool syscall_proxy, int repeat, const char *json) {
+    std::vector<BenchResult> results(files.size());
+    int width = strlen("benchmark");
+    for (size_t i=0; i<files.size(); i++) {
+        results[i].path = files[i];
+        results[i].name = bench_name(files[i]);
+        width = std::max(width, (int)results[i].name.size());
+    }
+
+    printf("%-*s  %12s  %10s  %9s  %9s  %s\n", width, "benchmark", "instret", "median ms", "stdev ms", "MIPS", "status");
+    int      passed  = 0;
+    double   seconds = 0;
+    uint64_t instret = 0;
+    for (auto &res : results) {
+        run_timed(res, syscall_proxy); // warm-up
+        for (int k=0; k<repeat; k++) {
+            double s = run_timed(res, syscall_proxy);
+            res.seconds.push_back(s);
+            res.mips   .push_back((s>0) ? res.instret / s / 1e6 : 0.0);
+        }
+        Stats t    = stats(res.seconds);
+        bool  pass = !res.timeout && (res.exit_code==0);
+        passed += pass;
+        printf("%-*s  %12lu  %10.3f  %9.3f  %9.1f  %s\n", width, res.name.c_str(), res.instret,
+               t.median * 1000, sqrt(t.variance) * 1000, stats(res.mips).median, (pass) ? "pass" : (res.timeout) ? "timeout" : "fail");
+        fflush(stdout);
+        seconds += t.median;
+        instret += res.instret;
+    }
+    printf("\n%-*s  %12lu  %10.3f  %9s  %9.1f  %d/%zu passed (median of %d runs)\n", width, "total", instret,
+           seconds * 1000, "", (seconds>0) ? instret / seconds / 1e6 : 0.0, passed, results.size(), repeat);
+
+    if ((json!=NULL) && !write_json(json, results, repeat)) {
+        fprintf(stderr, "Error: bench file (%s) cannot be written.\n", json);
+    }
+    return (passed==(int)results.size()) ? 0 : 1;
+}
@@ -0,0 +1,27 @@
+#if !defined(BENCH_H_)
+#define BENCH_H_
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// --bench: host throughput of the emulator. Each program is run once to warm
+// up the host (page cache, branch predictors, CPU frequency) and then repeat
+// times, one after the other on this thread; a run is timed from the start of
+// the hart to its halt, without loading. The median, mean and variance of the
+// host time and of MIPS (guest instructions per host microsecond) are printed
+// and, with --bench-json, written as JSON for tools/bench-compare.py.
+struct BenchResult {
+    std::string path     ;
+    std::string name     ; // file name without .bin/.elf
+    int         exit_code;
+    bool        timeout  ;
+    uint64_t    instret  ;
+    std::vector<double> seconds; // per run
+    std::vector<double> mips   ;
+};
+
+// Returns the exit status of rvemu: 0 if every program passed.
+int run_bench(const std::vector<std::string> &files, bool syscall_proxy, int repeat, const char *json);
+
+#endif // BENCH_H_
@@ -0,0 +1,386 @@
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <algorithm>
+#include "bpred.h"
+#include "hook.h"
+
+//------------------------------------------------------------------------------
+// Predictors
+//------------------------------------------------------------------------------
+static void counter_update(uint8_t &c, bool taken) {
+    if (taken) {
+        if (c<3) c++;
+    } else {
+        if (c>0) c--;
+    }
+}
+
+// folds the low len bits of h into bits bits
+static uint32_t fold(uint64_t h, int len, int bits) {
+    if (len<64) {
+        h &= (1ULL << len) - 1;
+    }
+    uint32_t f = 0;
+    for (; len>0; len-=bits, h>>=bits) {
+        f ^= h & ((1U << bits) - 1);
+    }
+    return f;
+}
+
+struct Bimodal : Predictor {
+    std::vector<uint8_t> ctr;
+    uint32_t mask;
+
+    Bimodal(int bits) : ctr(1U << bits, 1), mask((1U << bits) - 1) {}
+    const char *kind() const { return "conditional"; }
+    bool predict(const Branch &b) {
+        if (!b.cond) {
+            return false;
+        }
+        lookups++;
+        uint8_t &c   = ctr[(b.pc >> 1) & mask];
+        bool    miss = ((c>=2)!=b.taken);
+        counter_update(c, b.taken);
+        mispredicts += miss;
+        return miss;
+    }
+};
+
+struct Gshare : Predictor {
+    std::vector<uint8_t> ctr;
+    uint32_t mask;
+    uint64_t hist;
+
+    Gshare(int bits) : ctr(1U << bits, 1), mask((1U << bits) - 1), hist(0) {}
+    const char *kind() const { return "conditional"; }
+    bool predict(const Branch &b) {
+        if (!b.cond) {
+            return false;
+        }
+        lookups++;
+        uint8_t &c   = ctr[((b.pc >> 1) ^ hist) & mask];
+        bool    miss = ((c>=2)!=b.taken);
+        counter_update(c, b.taken);
+        hist = (hist << 1) | b.taken;
+        mispredicts += miss;
+        return miss;
+    }
+};
+
+// TAGE without the alternate-prediction and loop refinements: the longest
+// history that matches predicts; a misprediction allocates an entry on a
+// longer history.
+#define TAGE_TABLES   4
+#define TAGE_TAG_BITS 9
+#define TAGE_RESET    (256 * 1024) // branches between halvings of the useful bits
+
+static const int tage_hist[TAGE_TABLES] = {5, 11, 24, 54};
+
+struct Tage : Predictor {
+    struct Entry {
+        uint16_t tag;
+        int8_t   ctr; // -4..3, taken if >=0
+        uint8_t  u  ; // 0..3
+    };
+
+    std::vector<uint8_t> base;
+    std::vector<Entry>   table[TAGE_TABLES];
+    int      bits; // of a tagged table
+    uint64_t hist;
+    uint64_t tick;
+
+    Tage(int n) : base(1U << n, 1), bits(n-2), hist(0), tick(0) {
+        for (int i=0; i<TAGE_TABLES; i++) {
+            table[i].assign(1U << bits, Entry{0, 0, 0});
+        }
+    }
+    const char *kind() const { return "conditional"; }
+    bool predict(const Branch &b) {
+        if (!b.cond) {
+            return false;
+        }
+        lookups++;
+        uint32_t pc = b.pc >> 1;
+        uint32_t idx[TAGE_TABLES], tag[TAGE_TABLES];
+        int      provider = -1, alt = -1;
+        for (int i=TAGE_TABLES-1; i>=0; i--) {
+            idx[i] = (pc ^ (pc >> bits) ^ fold(hist, tage_hist[i], bits)) & ((1U << bits) - 1);
+            tag[i] = (pc ^ fold(hist, tage_hist[i], TAGE_TAG_BITS) ^ (fold(hist, tage_hist[i], TAGE_TAG_BITS-1) << 1)) &
+                     ((1U << TAGE_TAG_BITS) - 1);
+            if (table[i][idx[i]].tag==tag[i]) {
+                if (provider<0) {
+                    provider = i;
+                } else if (alt<0) {
+                    alt = i;
+                }
+            }
+        }
+        uint8_t &bc        = base[pc & (base.size()-1)];
+        bool     base_pred = (bc>=2);
+        bool     alt_pred  = (alt>=0) ? (table[alt][idx[alt]].ctr>=0) : base_pred;
+        bool     pred      = (provider>=0) ? (table[provider][idx[provider]].ctr>=0) : base_pred;
+        bool     miss      = (pred!=b.taken);
+
+        if (provider>=0) {
+            Entry &e = table[provider][idx[provider]];
+            if (pred!=alt_pred) {
+                if (!miss && (e.u<3)) e.u++;
+                if ( miss && (e.u>0)) e.u--;
+            }
+            if (b.taken) {
+                if (e.ctr<3) e.ctr++;
+            } else {
+                if (e.ctr>-4) e.ctr--;
+            }
+        } else {
+            counter_update(bc, b.taken);
+        }
+        if (miss && (provider<TAGE_TABLES-1)) {
+            int i = provider + 1;
+            while ((i<TAGE_TABLES) && (table[i][idx[i]].u!=0)) {
+                i++;
+            }
+            if (i<TAGE_TABLES) {
+                table[i][idx[i]] = Entry{(uint16_t)tag[i], (int8_t)((b.taken) ? 0 : -1), 0};
+            } else {
+                for (i=provider+1; i<TAGE_TABLES; i++) {
+                    table[i][idx[i]].u--;
+                }
+            }
+        }
+        if (++tick % TAGE_RESET==0) {
+            for (auto &t : table) {
+                for (Entry &e : t) e.u >>= 1;
+            }
+        }
+        hist = (hist << 1) | b.taken;
+        mispredicts += miss;
+        return miss;
+    }
+};
+
+struct Btb : Predictor {
+    struct Entry {
+        uintx_t pc    ; // tag
+        uintx_t target;
+        bool    valid ;
+    };
+
+    std::vector<Entry> entry;
+    uint32_t mask;
+
+    Btb(int bits) : entry(1U << bits, Entry{0, 0, false}), mask((1U << bits) - 1) {}
+    const char *kind() const { return "taken targets"; }
+    bool predict(const Branch &b) {
+        if (!b.taken) {
+            return false;
+        }
+        lookups++;
+        Entry &e    = entry[(b.pc >> 1) & mask];
+        bool   miss = !e.valid || (e.pc!=b.pc) || (e.target!=b.target);
+        e = Entry{b.pc, b.target, true};
+        mispredicts += miss;
+        return miss;
+    }
+};
+
+// on overflow the oldest address is overwritten
+struct Ras : Predictor {
+    std::vector<uintx_t> stack;
+    int top  ;
+    int depth; // valid entries
+
+    Ras(int n) : stack(n, 0), top(0), depth(0) {}
+    const char *kind() const { return "returns"; }
+    bool predict(const Branch &b) {
+        bool miss = false;
+        if (b.ret) {
+            lookups++;
+            miss = (depth==0) || (stack[top]!=b.target);
+            if (depth>0) {
+                top = (top + stack.size() - 1) % stack.size();
+                depth--;
+            }
+        }
+        if (b.call) {
+            top        = (top + 1) % stack.size();
+            stack[top] = b.next;
+            depth      = std::min(depth + 1, (int)stack.size());
+        }
+        mispredicts += miss;
+        return miss;
+    }
+};
+
+Predictor *new_predictor(const char *spec) {
+    std::string s     = spec;
+    size_t      colon = s.find(':');
+    std::string name  = s.substr(0, colon);
+    int         n     = -1;
+    if (colon!=std::string::npos) {
+        char *end;
+        n = strtol(s.c_str()+colon+1, &end, 0);
+        if ((*end!='\0') || (n<1)) {
+            return NULL;
+        }
+    }
+    Predictor *p = NULL;
+    if (name=="bimodal") {
+        if (n<0) n = 12;
+        if (n<=28) p = new Bimodal(n);
+    } else if (name=="gshare") {
+        if (n<0) n = 14;
+        if (n<=28) p = new Gshare(n);
+    } else if (name=="tage") {
+        if (n<0) n = 12;
+        if ((n>=3) && (n<=28)) p = new Tage(n);
+    } else if (name=="btb") {
+        if (n<0) n = 9;
+        if (n<=24) p = new Btb(n);
+    } else if (name=="ras") {
+        if (n<0) n = 16;
+        if (n<=4096) p = new Ras(n);
+    }
+    if (p!=NULL) {
+        p->name = name + ":" + std::to_string(n);
+    }
+    return p;
+}
+
+//------------------------------------------------------------------------------
+// BranchSim
+//------------------------------------------------------------------------------
+BranchSim::BranchSim() {
+    icount  = 0;
+    nbranch = 0;
+    ncond   = 0;
+    ntaken  = 0;
+    fp      = NULL;
+}
+
+BranchSim::~BranchSim() {
+    for (Predictor *p : pred) {
+        delete p;
+    }
+    if ((fp!=NULL) && (fp!=stdout) && (fp!=stderr)) {
+        fclose(fp);
+    }
+}
+
+bool BranchSim::configure(const char *models) {
+    char *s  = strdup(models);
+    bool  ok = true;
+    for (char *f=strtok(s, ","); ok && (f!=NULL); f=strtok(NULL, ",")) {
+        Predictor *p = new_predictor(f);
+        ok = (p!=NULL);
+        if (ok) {
+            pred.push_back(p);
+        }
+    }
+    free(s);
+    return ok && !pred.empty();
+}
+
+// "-" is stderr, which keeps the report apart from the guest's stdout
+bool BranchSim::open(const char *filename) {
+    fp = (std::string(filename)=="-") ? stderr : fopen(filename, "w");
+    return fp!=NULL;
+}
+
+void BranchSim::load_symbols(const char *elf, uintx_t bias) {
+    ::load_symbols(elf, syms, bias);
+}
+
+void BranchSim::record(const Commit &c) {
+    if (c.trap) {
+        return;
+    }
+    icount++;
+    uint32_t ir     = c.ir; // RVC expanded
+    uint8_t  opcode = (ir >> 2) & 0x1f;
+    if ((opcode!=0b11000) && (opcode!=0b11011) && (opcode!=0b11001)) { // branch, jal, jalr
+        return;
+    }
+    int    link = link_kind(ir);
+    Branch b;
+    b.pc     = c.pc;
+    b.next   = c.pc + ((c.compressed) ? 2 : 4);
+    b.target = c.next_pc; // not an interrupt handler entered after it
+    b.cond   = (opcode==0b11000);
+    b.taken  = !b.cond || (c.next_pc!=b.next);
+    b.call   = (link & LINK_CALL)!=0;
+    b.ret    = (link & LINK_RET )!=0;
+    nbranch++;
+    ncond  += b.cond;
+    ntaken += b.taken;
+
+    Site &s = by_pc[c.pc];
+    if (s.mispredicts.empty()) {
+        s.mispredicts.assign(pred.size(), 0);
+    }
+    s.count++;
+    s.taken += b.taken;
+    for (size_t i=0; i<pred.size(); i++) {
+        s.mispredicts[i] += pred[i]->predict(b);
+    }
+}
+
+void BranchSim::report() {
+    if (fp==NULL) {
+        return;
+    }
+    double kilo = (icount!=0) ? icount / 1000.0 : 1.0;
+    fprintf(fp, "\nbpred: %lu instructions, %lu control transfers (%lu conditional, %lu taken)\n",
+            icount, nbranch, ncond, ntaken);
+    int w = 10;
+    for (Predictor *p : pred) {
+        w = std::max(w, (int)p->name.size());
+    }
+    fprintf(fp, "\n  %-*s  %-13s  %14s  %12s  %9s  %8s\n", w, "predictor", "predicts", "lookups", "mispredicts", "miss rate", "MPKI");
+    for (Predictor *p : pred) {
+        fprintf(fp, "  %-*s  %-13s  %14lu  %12lu  %8.3f%%  %8.3f\n", w, p->name.c_str(), p->kind(),
+                p->lookups, p->mispredicts, (p->lookups!=0) ? 100.0 * p->mispredicts / p->lookups : 0.0,
+                p->mispredicts / kilo);
+    }
+
+    // branches by mispredictions (of all predictors)
+    auto total = [](const Site &s) {
+        uint64_t n = 0;
+        for (uint64_t m : s.mispredicts) n += m;
+        return n;
+    };
+    std::vector<std::pair<uintx_t, const Site *>> v;
+    for (auto &e : by_pc) {
+        if (total(e.second)!=0) {
+            v.push_back(std::make_pair(e.first, &e.second));
+        }
+    }
+    std::sort(v.begin(), v.end(), [&](const std::pair<uintx_t, const Site *> &a, const std::pair<uintx_t, const Site *> &b) {
+        return (total(*a.second)!=total(*b.second)) ? total(*a.second)>total(*b.second) : a.first<b.first;
+    });
+    if (v.size()>BPRED_TOP) {
+        v.resize(BPRED_TOP);
+    }
+    fprintf(fp, "\n  mispredictions (and MPKI) by branch\n");
+    fprintf(fp, "  %*s  %12s  %7s", XLEN/4+2, "pc", "count", "taken");
+    for (Predictor *p : pred) {
+        fprintf(fp, "  %*s  %8s", w, p->name.c_str(), "MPKI");
+    }
+    fprintf(fp, "  function\n");
+    for (auto &e : v) {
+        const Site &s = *e.second;
+        fprintf(fp, "  0x%0*lx  %12lu  %6.1f%%", XLEN/4, (uint64_t)e.first, s.count, 100.0 * s.taken / s.count);
+        for (uint64_t m : s.mispredicts) {
+            fprintf(fp, "  %*lu  %8.3f", w, m, m / kilo);
+        }
+        int i = find_symbol(syms, e.first);
+        std::string fn;
+        if (i<(int)syms.size()) {
+            char off[24];
+            snprintf(off, sizeof(off), "+0x%lx", (uint64_t)(e.first - syms[i].addr));
+            fn = syms[i].name + off;
+        }
+        fprintf(fp, "  %s\n", fn.c_str());
+    }
+}
@@ -0,0 +1,98 @@
+#if !defined(BPRED_H_)
+#define BPRED_H_
+
+#include <cstdio>
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "rvemu.h"
+#include "loader.h"
+#include "trace.h"
+
+//------------------------------------------------------------------------------
+// Branch predictor models (--bpred)
+//------------------------------------------------------------------------------
+// Runs several branch predictors side by side over the control transfers of
+// the commit loop (commit.h): branches, jal and jalr, compressed or not (the
+// Commit has them expanded). Every predictor sees every transfer, predicts
+// the ones it is for and learns the outcome; the report gives the
+// mispredictions of each per thousand instructions (MPKI) and the branches
+// that are mispredicted most, with what each adds to the MPKI. The models
+// have no timing and do not change what the hart does.
+//
+// The predictors are given as a list of NAME[:N], e.g. gshare:16,btb:10,ras:32:
+//
+//   bimodal:N  2^N two-bit counters indexed by pc        (conditional branches)
+//   gshare:N   2^N two-bit counters indexed by pc ^ N bits of global history
+//   tage:N     a bimodal base of 2^N counters and 4 tagged tables of 2^(N-2)
+//              entries on 5, 11, 24 and 54 bits of history
+//   btb:N      2^N entries (direct-mapped, full tag) of the target of the last
+//              taken transfer at a pc                        (taken transfers)
+//   ras:N      N return addresses                          (returns)
+//
+// Calls and returns are told apart by the link registers (x1, x5) of rd and
+// rs1 as the ISA manual suggests for return-address stacks (link_kind(),
+// hook.h, as for --profile).
+#define BPRED_MODELS "bimodal,gshare,tage,btb,ras"
+#define BPRED_TOP    20 // branches listed by mispredictions
+
+// a control transfer
+struct Branch {
+    uintx_t pc    ;
+    uintx_t target; // taken: where it went
+    uintx_t next  ; // pc of the following instruction (the return address)
+    bool    cond  ; // beq...bgeu
+    bool    taken ;
+    bool    call  ; // pushes next
+    bool    ret   ; // pops
+};
+
+// A predictor predicts the branches it is for and counts its lookups and
+// mispredictions.
+struct Predictor {
+    std::string name    ; // as given, e.g. gshare:14
+    uint64_t    lookups ;
+    uint64_t    mispredicts;
+
+    Predictor() : lookups(0), mispredicts(0) {}
+    virtual ~Predictor() {}
+    virtual const char *kind() const = 0; // what it predicts
+    // Predicts b if it is one of its kind, then learns it. Returns true if
+    // it was mispredicted.
+    virtual bool predict(const Branch &b) = 0;
+};
+
+// NULL if spec is not NAME[:N] of a predictor
+Predictor *new_predictor(const char *spec);
+
+struct BranchSim {
+    // branches by pc
+    struct Site {
+        uint64_t count;
+        uint64_t taken;
+        std::vector<uint64_t> mispredicts; // by predictor
+    };
+
+    std::vector<Predictor *> pred;
+    uint64_t icount  ; // instructions retired
+    uint64_t nbranch ; // control transfers
+    uint64_t ncond   ;
+    uint64_t ntaken  ;
+    std::unordered_map<uintx_t, Site> by_pc;
+    std::vector<Symbol> syms;
+    FILE    *fp      ;
+
+    BranchSim();
+    ~BranchSim();
+
+    bool configure(const char *models); // false if a model is malformed
+    bool open(const char *filename);    // - for stderr
+    void load_symbols(const char *elf, uintx_t bias);
+
+    // takes the target of a taken transfer from c.next_pc
+    void record(const Commit &c);
+    void report(); // to fp
+};
+
+#endif // BPRED_H_
@@ -0,0 +1,279 @@
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <algorithm>
+#include "machine.h"
+#include "cache.h"
+
+static const char *policy_name[] = {"lru", "fifo", "random"};
+
+//------------------------------------------------------------------------------
+// CacheConfig
+//------------------------------------------------------------------------------
+static bool power_of_2(uint64_t x) {
+    return (x!=0) && ((x & (x-1))==0);
+}
+
+bool CacheConfig::parse(const char *spec) {
+    char *s = strdup(spec);
+    char *f[5] = {NULL, NULL, NULL, NULL, NULL};
+    int   n    = 0;
+    for (char *t=strtok(s, ":"); (t!=NULL) && (n<5); t=strtok(NULL, ":")) {
+        f[n++] = t;
+    }
+    bool ok = (n>=3);
+    if (ok) {
+        char *end;
+        size       = strtoull(f[0], &end, 0);
+        size      <<= (*end=='k' || *end=='K') ? 10 : (*end=='m' || *end=='M') ? 20 : 0;
+        ways       = atoi(f[1]);
+        line       = atoi(f[2]);
+        policy     = CACHE_LRU;
+        write_back = true;
+        if (f[3]!=NULL) {
+            policy = -1;
+            for (int i=0; i<3; i++) {
+                if (strcmp(f[3], policy_name[i])==0) policy = i;
+            }
+        }
+        if (f[4]!=NULL) {
+            write_back = (strcmp(f[4], "wb")==0);
+            ok        &= write_back || (strcmp(f[4], "wt")==0);
+        }
+        // at least one set, and lines no smaller than an access
+        ok &= (policy>=0) && (ways>0) && (line>=8) && power_of_2(line) &&
+              (size>=(uint64_t)ways*line) && power_of_2(size/((uint64_t)ways*line)) &&
+              (size % ((uint64_t)ways*line)==0);
+    }
+    free(s);
+    return ok;
+}
+
+std::string CacheConfig::str() const {
+    char buf[64];
+    if (size % 1024==0) {
+        snprintf(buf, sizeof(buf), "%lu KiB", size/1024);
+    } else {
+        snprintf(buf, sizeof(buf), "%lu B", size);
+    }
+    std::string s = buf;
+    snprintf(buf, sizeof(buf), ", %d-way, %d B lines, %s, %s", ways, line, policy_name[policy],
+             (write_back) ? "write-back" : "write-through");
+    return s + buf;
+}
+
+//------------------------------------------------------------------------------
+// Cache
+//------------------------------------------------------------------------------
+void Cache::init(const char *name, const CacheConfig &cfg, Cache *next) {
+    this->name = name;
+    this->cfg  = cfg;
+    this->next = next;
+    shift = __builtin_ctz(cfg.line);
+    nsets = cfg.size / ((uint64_t)cfg.ways * cfg.line);
+    way.assign(nsets * cfg.ways, Way{0, 0, false, false});
+    mru   = &way[0];
+    clock = 0;
+    rng   = 0x2545f4914f6cdd1dULL;
+    reads = writes = read_misses = write_misses = writebacks = 0;
+}
+
+bool Cache::access(uint64_t addr, int len, bool write) {
+    bool hit = true;
+    for (uint64_t l=addr >> shift; l<=(addr+len-1) >> shift; l++) {
+        hit &= access_line(l, write);
+    }
+    return hit;
+}
+
+bool Cache::access_line(uint64_t line, bool write) {
+    clock++;
+    (write) ? writes++ : reads++;
+    Way *w = NULL;
+    if (mru->valid && (mru->tag==line)) {
+        w = mru;
+    } else {
+        Way *set = &way[(line & (nsets-1)) * cfg.ways];
+        for (int i=0; (i<cfg.ways) && (w==NULL); i++) {
+            if (set[i].valid && (set[i].tag==line)) w = &set[i];
+        }
+    }
+    if (w!=NULL) {
+        mru = w;
+        if (cfg.policy==CACHE_LRU) {
+            w->stamp = clock;
+        }
+        if (write) {
+            if (cfg.write_back) {
+                w->dirty = true;
+            } else if (next!=NULL) {
+                next->access_line(line << shift >> next->shift, true);
+            }
+        }
+        return true;
+    }
+
+    Way *set = &way[(line & (nsets-1)) * cfg.ways];
+
+    (write) ? write_misses++ : read_misses++;
+    if (write && !cfg.write_back) { // no write-allocate
+        if (next!=NULL) {
+            next->access_line(line << shift >> next->shift, true);
+        }
+        return false;
+    }
+    // victim: an invalid way, or by policy
+    Way *v = NULL;
+    for (int i=0; (i<cfg.ways) && (v==NULL); i++) {
+        if (!set[i].valid) v = &set[i];
+    }
+    if (v==NULL) {
+        if (cfg.policy==CACHE_RANDOM) {
+            rng ^= rng << 13;
+            rng ^= rng >> 7;
+            rng ^= rng << 17;
+            v = &set[rng % cfg.ways];
+        } else {
+            v = set;
+            for (int i=1; i<cfg.ways; i++) {
+                if (set[i].stamp<v->stamp) v = &set[i];
+            }
+        }
+        if (v->dirty) {
+            writebacks++;
+            if (next!=NULL) {
+                next->access(v->tag << shift, cfg.line, true);
+            }
+        }
+    }
+    if (next!=NULL) {
+        next->access(line << shift, cfg.line, false);
+    }
+    v->tag   = line;
+    v->stamp = clock;
+    v->valid = true;
+    v->dirty = write;
+    mru      = v;
+    return false;
+}
+
+//------------------------------------------------------------------------------
+// CacheSim
+//------------------------------------------------------------------------------
+CacheSim::CacheSim() {
+    has_l2 = false;
+    m      = NULL;
+    icount = 0;
+    fp     = NULL;
+}
+
+CacheSim::~CacheSim() {
+    if ((fp!=NULL) && (fp!=stdout) && (fp!=stderr)) {
+        fclose(fp);
+    }
+}
+
+// "-" is stderr, which keeps the report apart from the guest's stdout
+bool CacheSim::open(const char *filename) {
+    fp = (std::string(filename)=="-") ? stderr : fopen(filename, "w");
+    return fp!=NULL;
+}
+
+void CacheSim::init(Machine &m, const CacheConfig &l1i, const CacheConfig &l1d, const CacheConfig *l2) {
+    this->m = &m;
+    has_l2  = (l2!=NULL);
+    if (has_l2) {
+        this->l2.init("L2", *l2, NULL);
+    }
+    this->l1i.init("L1I", l1i, (has_l2) ? &this->l2 : NULL);
+    this->l1d.init("L1D", l1d, (has_l2) ? &this->l2 : NULL);
+    batch.reserve(CACHE_BATCH);
+    m.cache = this;
+}
+
+void CacheSim::load_symbols(const char *elf, uintx_t bias) {
+    ::load_symbols(elf, syms, bias);
+}
+
+void CacheSim::record(const Commit &c) {
+    add(c.pc, c.pc, (c.compressed) ? 2 : 4, FETCH);
+    if (c.trap) {
+        return;
+    }
+    icount++;
+    if (c.load) {
+        add(c.load_addr, c.pc, 1 << ((c.ir >> 12) & 0x3), READ);
+    }
+    if (c.store_len!=0) {
+        add(c.store_addr, c.pc, c.store_len, WRITE);
+    }
+}
+
+void CacheSim::flush() {
+    for (const Access &a : batch) {
+        uint64_t l2_misses = (has_l2) ? l2.misses() : 0;
+        bool     hit       = (a.kind==FETCH) ? l1i.access(a.addr, a.len, false)
+                                             : l1d.access(a.addr, a.len, a.kind==WRITE);
+        if (!hit) {
+            Misses &p = by_pc[a.pc];
+            ((a.kind==FETCH) ? p.l1i : p.l1d)++;
+            if (has_l2) {
+                p.l2 += l2.misses() - l2_misses;
+            }
+        }
+    }
+    batch.clear();
+    // for mhpmevent
+    m->hpm_count[HPM_L1I_MISS] = l1i.misses();
+    m->hpm_count[HPM_L1D_MISS] = l1d.misses();
+    m->hpm_count[HPM_L2_MISS ] = (has_l2) ? l2.misses() : 0;
+}
+
+void CacheSim::report() {
+    flush();
+    if (fp==NULL) {
+        return;
+    }
+    double kilo = (icount!=0) ? icount / 1000.0 : 1.0;
+    fprintf(fp, "\ncache: %lu instructions\n", icount);
+    Cache *levels[3] = {&l1i, &l1d, (has_l2) ? &l2 : NULL};
+    for (Cache *c : levels) {
+        if (c!=NULL) {
+            fprintf(fp, "  %-3s  %s\n", c->name, c->cfg.str().c_str());
+        }
+    }
+    fprintf(fp, "\n  %-3s  %14s  %12s  %14s  %12s  %9s  %12s  %8s\n",
+            "", "reads", "read misses", "writes", "write misses", "miss rate", "writebacks", "MPKI");
+    for (Cache *c : levels) {
+        if (c==NULL) {
+            continue;
+        }
+        uint64_t accesses = c->reads + c->writes;
+        fprintf(fp, "  %-3s  %14lu  %12lu  %14lu  %12lu  %8.3f%%  %12lu  %8.3f\n", c->name,
+                c->reads, c->read_misses, c->writes, c->write_misses,
+                (accesses!=0) ? 100.0 * c->misses() / accesses : 0.0, c->writebacks, c->misses() / kilo);
+    }
+
+    // instructions by misses
+    std::vector<std::pair<uintx_t, Misses>> v(by_pc.begin(), by_pc.end());
+    auto total = [](const Misses &p) { return p.l1i + p.l1d + p.l2; };
+    std::sort(v.begin(), v.end(), [&](const std::pair<uintx_t, Misses> &a, const std::pair<uintx_t, Misses> &b) {
+        return (total(a.second)!=total(b.second)) ? total(a.second)>total(b.second) : a.first<b.first;
+    });
+    if (v.size()>CACHE_TOP) {
+        v.resize(CACHE_TOP);
+    }
+    fprintf(fp, "\n  misses by instruction\n");
+    fprintf(fp, "  %*s  %12s  %12s  %12s  %s\n", XLEN/4+2, "pc", "L1I", "L1D", "L2", "function");
+    for (auto &e : v) {
+        int i = find_symbol(syms, e.first);
+        std::string fn;
+        if (i<(int)syms.size()) {
+            char off[24];
+            snprintf(off, sizeof(off), "+0x%lx", (uint64_t)(e.first - syms[i].addr));
+            fn = syms[i].name + off;
+        }
+        fprintf(fp, "  0x%0*lx  %12lu  %12lu  %12lu  %s\n", XLEN/4, (uint64_t)e.first,
+                e.second.l1i, e.second.l1d, e.second.l2, fn.c_str());
+    }
+}
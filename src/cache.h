@@ -0,0 +1,125 @@
+#if !defined(CACHE_H_)
+#define CACHE_H_
+
+#include <cstdio>
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "rvemu.h"
+#include "loader.h"
+#include "trace.h"
+
+struct Machine;
+
+//------------------------------------------------------------------------------
+// Cache model (--cache)
+//------------------------------------------------------------------------------
+// Set-associative L1 instruction and data caches and an optional unified L2,
+// fed with the fetches, loads and stores of the commit loop (commit.h): every
+// instruction is a fetch of its 2 or 4 bytes at pc, a load or AMO reads
+// load_addr and a store or AMO writes store_addr. Addresses are those the hart
+// uses (virtual when translated). The model only counts hits, misses and
+// writebacks; it has no timing and does not change what the hart does.
+//
+// A level is given as SIZE:WAYS:LINE[:POLICY[:WRITE]], e.g. 32k:8:64:lru:wb:
+// POLICY is lru, fifo or random (replacement) and WRITE is wb (write-back,
+// write-allocate) or wt (write-through, no write-allocate).
+//
+// Accesses are collected in a batch and run through the caches CACHE_BATCH at
+// a time, which keeps the model's own data hot instead of interleaving it with
+// eval(). Misses are also counted per instruction (pc) for the report.
+#define CACHE_L1I   "16k:4:64:lru"
+#define CACHE_L1D   "16k:4:64:lru:wb"
+#define CACHE_L2    "256k:8:64:lru:wb"
+#define CACHE_BATCH 4096
+#define CACHE_TOP   20 // instructions listed by misses
+
+enum CachePolicy {
+    CACHE_LRU   ,
+    CACHE_FIFO  ,
+    CACHE_RANDOM,
+};
+
+struct CacheConfig {
+    uint64_t size      ;
+    int      ways      ;
+    int      line      ;
+    int      policy    ;
+    bool     write_back;
+
+    bool parse(const char *spec); // false if malformed
+    std::string str() const;
+};
+
+struct Cache {
+    struct Way {
+        uint64_t tag  ; // line address
+        uint64_t stamp; // last use (lru) or fill (fifo)
+        bool     valid;
+        bool     dirty;
+    };
+
+    const char *name ;
+    CacheConfig cfg  ;
+    Cache      *next ; // NULL: memory
+    int         shift; // log2(line)
+    uint64_t    nsets;
+    std::vector<Way> way; // nsets * ways
+    Way        *mru  ; // the way that hit last: consecutive fetches skip the lookup
+    uint64_t    clock;
+    uint64_t    rng  ;
+
+    uint64_t    reads, writes, read_misses, write_misses, writebacks;
+
+    void init(const char *name, const CacheConfig &cfg, Cache *next);
+    // Returns true if every line of [addr, addr+len) hits.
+    bool access     (uint64_t addr, int len, bool write);
+    bool access_line(uint64_t line, bool write);
+    uint64_t misses() const { return read_misses + write_misses; }
+};
+
+struct CacheSim {
+    // an access of the batch
+    enum { FETCH, READ, WRITE };
+    struct Access {
+        uint64_t addr;
+        uintx_t  pc  ;
+        uint8_t  len ;
+        uint8_t  kind;
+    };
+    // misses by instruction
+    struct Misses {
+        uint64_t l1i, l1d, l2;
+    };
+
+    Cache    l1i   ;
+    Cache    l1d   ;
+    Cache    l2    ;
+    bool     has_l2;
+    Machine *m     ;
+    uint64_t icount; // instructions retired
+    std::vector<Access> batch;
+    std::unordered_map<uintx_t, Misses> by_pc;
+    std::vector<Symbol> syms;
+    FILE    *fp    ;
+
+    CacheSim();
+    ~CacheSim();
+
+    bool open(const char *filename); // - for stderr
+    void init(Machine &m, const CacheConfig &l1i, const CacheConfig &l1d, const CacheConfig *l2);
+    void load_symbols(const char *elf, uintx_t bias);
+
+    void record(const Commit &c);
+    void add   (uint64_t addr, uintx_t pc, int len, int kind) {
+        batch.push_back(Access{addr, pc, (uint8_t)len, (uint8_t)kind});
+        if (batch.size()==CACHE_BATCH) {
+            flush();
+        }
+    }
+    void flush(); // runs the batch through the caches
+    void report(); // to fp
+};
+
+#endif // CACHE_H_
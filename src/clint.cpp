@@ -0,0 +1,26 @@
+#include "clint.h"
+
+CLINT::CLINT() {
+    for (int i=0; i<MAX_HARTS; i++) {
+        msip    [i] = 0;
+        mtimecmp[i] = (uint64_t)-1;
+    }
+    mtime_offset = 0;
+}
+
+uint64_t CLINT::mtime(uint64_t cycle) {
+    return (uint64_t)((uint128_t)cycle * MTIME_FREQ / CPU_FREQ) + mtime_offset;
+}
+
+void CLINT::set_mtime(uint64_t cycle, uint64_t data) {
+    mtime_offset = data - (uint64_t)((uint128_t)cycle * MTIME_FREQ / CPU_FREQ);
+}
+
+uint64_t CLINT::deadline(int hart, uint64_t cycle) {
+    uint64_t cmp = __atomic_load_n(&mtimecmp[hart], __ATOMIC_RELAXED);
+    if (mtime(cycle)>=cmp) {
+        return cycle;
+    }
+    uint128_t c = ((uint128_t)(cmp - mtime_offset) * CPU_FREQ + MTIME_FREQ - 1) / MTIME_FREQ;
+    return (c > (uint64_t)-1) ? (uint64_t)-1 : (uint64_t)c;
+}
@@ -0,0 +1,30 @@
+#if !defined(CLINT_H_)
+#define CLINT_H_
+
+#include "rvemu.h"
+
+// Register offsets from CLINT_BASE
+#define CLINT_MSIP     0x0000
+#define CLINT_MTIMECMP 0x4000
+#define CLINT_MTIME    0xbff8
+#define CLINT_SIZE     0x10000
+
+// mtime is not a counter of its own: it is derived from the instruction count
+// (cycle) of the hart, which runs at CPU_FREQ instructions per second.
+// msip/mtimecmp may be written by other harts; they are accessed with
+// __atomic builtins.
+struct CLINT {
+    uint32_t msip    [MAX_HARTS];
+    uint64_t mtimecmp[MAX_HARTS];
+    uint64_t mtime_offset;
+
+    CLINT();
+
+    uint64_t mtime(uint64_t cycle);
+    void     set_mtime(uint64_t cycle, uint64_t data);
+
+    // first cycle of the hart at which mtime>=mtimecmp[hart]
+    uint64_t deadline(int hart, uint64_t cycle);
+};
+
+#endif // CLINT_H_
@@ -0,0 +1,100 @@
+#if !defined(COMMIT_H_)
+#define COMMIT_H_
+
+#include "machine.h"
+#include "trace.h"
+
+// Runs a hart one instruction at a time and describes each one as a Commit.
+// Register writes are found by comparing rd with a copy of the register
+// file; load and store addresses are rs1 (from the copy, as it was before)
+// plus the offset, and store data is rs2, so the store path does nothing for
+// the log; AMOs and sc report what they left in memory in store_*; a trap is
+// one that trap() counted.
+struct CommitLog {
+    uintx_t  shadow[32];
+    uint64_t ntrap     ;
+    uint8_t  priv      ; // of the next instruction
+
+    void begin(Machine &m) {
+        for (int i=0; i<32; i++) {
+            shadow[i] = m.reg[i];
+        }
+        ntrap       = m.ntrap;
+        priv        = m.priv;
+        m.store_len   = 0;
+        m.event_saved = false;
+    }
+
+    // One eval(); returns halt. The hart may have entered a handler since
+    // the last one (librvemu), so priv is taken again.
+    int step(Machine &m, Commit &c) {
+        priv     = m.priv;
+        int halt = m.eval();
+        record(m, c);
+        return halt;
+    }
+
+    // Describes the instruction the last eval() ran; after step() or as a
+    // hook of run_hooked() (hook.h).
+    void record(Machine &m, Commit &c) {
+        c.priv       = priv;
+        priv         = m.priv;
+        c.cycle      = m.cycle;
+        c.pc         = m.pc;
+        c.ir         = m.ir;
+        c.cir        = m.cir;
+        c.compressed = m.is_compressed;
+        c.next_pc    = (m.event_saved) ? m.event_pc : m.r.pc;
+        m.event_saved = false;
+        c.trap       = (m.ntrap!=ntrap);
+        ntrap        = m.ntrap;
+
+        // LOAD, or AMO other than sc
+        uint8_t opcode = (m.ir >> 2) & 0x1f;
+        c.load = !c.trap && ((opcode==0b00000) || ((opcode==0b01011) && ((m.ir >> 27)!=0b00011)));
+        if (c.load) {
+            c.load_addr = shadow[(m.ir >> 15) & 0x1f] + ((opcode==0b00000) ? (intx_t)((int32_t)m.ir >> 20) : 0);
+        }
+
+        // STORE; an AMO or sc recorded its own
+        c.store_len = 0;
+        if (c.trap) {
+            // nothing was stored
+        } else if (opcode==0b01000) {
+            int size     = 1 << ((m.ir >> 12) & 0x3);
+            intx_t imm   = (((int32_t)m.ir >> 20) & ~0x1f) | (int32_t)((m.ir >> 7) & 0x1f);
+            c.store_len  = size;
+            c.store_addr = shadow[(m.ir >> 15) & 0x1f] + imm;
+            c.store_data = (uint64_t)shadow[(m.ir >> 20) & 0x1f] & (~(uint64_t)0 >> (64 - 8*size));
+        } else if (m.store_len!=0) {
+            c.store_len  = m.store_len;
+            c.store_addr = m.store_addr;
+            c.store_data = m.store_data;
+        }
+        m.store_len = 0;
+
+        // Only rd can change, except in a trap or an ecall serviced by the
+        // emulator (--syscall, --linux), where the whole file is compared.
+        c.nreg = 0;
+        if (c.trap || (opcode==0b11100)) {
+            for (int i=1; i<32; i++) {
+                if (m.reg[i]!=shadow[i]) {
+                    c.rd   [c.nreg] = i;
+                    c.value[c.nreg] = m.reg[i];
+                    c.nreg++;
+                    shadow[i] = m.reg[i];
+                }
+            }
+        } else {
+            int i = (m.ir >> 7) & 0x1f;
+            if (m.reg[i]!=shadow[i]) {
+                c.rd   [0] = i;
+                c.value[0] = m.reg[i];
+                c.nreg     = 1;
+                shadow[i]  = m.reg[i];
+            }
+        }
+    }
+};
+
+#endif // COMMIT_H_
@@ -0,0 +1,441 @@
+#include <cstdio>
+#include <cstdlib>
+#include "machine.h"
+#include "csr.h"
+#include "cache.h"
+
+// cycle has already been incremented for the instruction being executed, so the
+// counters read as the number of instructions before it.
+uint64_t Machine::read_mcycle() {
+    return (cycle-1) + mcycle_offset;
+}
+
+uint64_t Machine::read_minstret() {
+    return (cycle-1) + minstret_offset;
+}
+
+uintx_t Machine::read_mip() {
+    uintx_t data = mip;
+    if (__atomic_load_n(&clint->msip[hartid], __ATOMIC_RELAXED) & 0x1) data |= MIP_MSIP;
+    if (cycle>=timer_deadline)   data |= MIP_MTIP;
+    return data;
+}
+
+static uint8_t legalize_priv(uintx_t prv) {
+    return (prv==2) ? PRV_U : prv; // H-mode is not implemented
+}
+
+// Counters below M-mode need the mcounteren bit, and in U-mode also the
+// scounteren bit.
+static bool counter_enabled(uint8_t priv, uint32_t mcounteren, uint32_t scounteren, uint32_t bit) {
+    return (priv==PRV_M) || ((mcounteren & bit) && ((priv==PRV_S) || (scounteren & bit)));
+}
+
+uint64_t Machine::read_hpmcounter(int i) {
+    if (cache!=NULL) {
+        cache->flush(); // the accesses of the instructions before this one
+    }
+    return hpm_count[hpm_event[i]] + hpm_offset[i];
+}
+
+bool Machine::hpm_read(uint16_t csr, uintx_t &data) {
+    int i;
+    if ((csr>=CSR_MHPMEVENT3) && (csr<CSR_MHPMEVENT3+HPM_COUNTERS)) {
+        data = hpm_event[csr-CSR_MHPMEVENT3];
+        return true;
+    }
+    if ((csr>=CSR_HPMCOUNTER3) && (csr<CSR_HPMCOUNTER3+HPM_COUNTERS)) {
+        i = csr-CSR_HPMCOUNTER3;
+    } else if ((csr>=CSR_MHPMCOUNTER3) && (csr<CSR_MHPMCOUNTER3+HPM_COUNTERS)) {
+        i = csr-CSR_MHPMCOUNTER3;
+#if XLEN == 32
+    } else if ((csr>=CSR_HPMCOUNTER3H) && (csr<CSR_HPMCOUNTER3H+HPM_COUNTERS)) {
+        i = csr-CSR_HPMCOUNTER3H;
+    } else if ((csr>=CSR_MHPMCOUNTER3H) && (csr<CSR_MHPMCOUNTER3H+HPM_COUNTERS)) {
+        i = csr-CSR_MHPMCOUNTER3H;
+#endif
+    } else {
+        return false;
+    }
+    if ((csr >> 8)==(CSR_HPMCOUNTER3 >> 8)) {
+        if (!counter_enabled(priv, mcounteren, scounteren, 1U << (i+3))) return false;
+    }
+    data = read_hpmcounter(i) >> ((csr & 0x80) ? 32 : 0);
+    return true;
+}
+
+bool Machine::hpm_write(uint16_t csr, uintx_t data) {
+    if ((csr>=CSR_MHPMEVENT3) && (csr<CSR_MHPMEVENT3+HPM_COUNTERS)) {
+        // the counter keeps its value and counts the new event from here
+        int      i     = csr-CSR_MHPMEVENT3;
+        uint64_t value = read_hpmcounter(i);
+        hpm_event [i]  = (data<HPM_EVENTS) ? data : (uintx_t)HPM_NONE; // WARL
+        hpm_offset[i]  = value - hpm_count[hpm_event[i]];
+        hpm_active = false;
+        for (int k=0; k<HPM_COUNTERS; k++) {
+            hpm_active |= (hpm_event[k]!=HPM_NONE) && (hpm_event[k]<HPM_L1I_MISS);
+        }
+        return true;
+    }
+    if ((csr>=CSR_MHPMCOUNTER3) && (csr<CSR_MHPMCOUNTER3+HPM_COUNTERS)) {
+        // read first: it brings the cache miss counts in hpm_count up to date
+        int      i     = csr-CSR_MHPMCOUNTER3;
+        uint64_t value = read_hpmcounter(i);
+#if XLEN == 32
+        value          = (value & ~0xffffffffULL) | data;
+#else
+        value          = data;
+#endif
+        hpm_offset[i]  = value - hpm_count[hpm_event[i]];
+        return true;
+    }
+#if XLEN == 32
+    if ((csr>=CSR_MHPMCOUNTER3H) && (csr<CSR_MHPMCOUNTER3H+HPM_COUNTERS)) {
+        int      i     = csr-CSR_MHPMCOUNTER3H;
+        uint64_t value = read_hpmcounter(i);
+        value          = (value & 0xffffffffULL) | ((uint64_t)data << 32);
+        hpm_offset[i]  = value - hpm_count[hpm_event[i]];
+        return true;
+    }
+#endif
+    return false;
+}
+
+bool Machine::csr_read(uint16_t csr, uintx_t &data) {
+    if (((csr >> 8) & 0x3) > priv) {
+        return false;
+    }
+    switch (csr) {
+    // Unprivileged counters
+    case CSR_CYCLE:
+        if (!counter_enabled(priv, mcounteren, scounteren, COUNTEREN_CY)) return false;
+        data = read_mcycle();
+        break;
+    case CSR_TIME:
+        if (!counter_enabled(priv, mcounteren, scounteren, COUNTEREN_TM)) return false;
+        data = clint->mtime(cycle);
+        break;
+    case CSR_INSTRET:
+        if (!counter_enabled(priv, mcounteren, scounteren, COUNTEREN_IR)) return false;
+        data = read_minstret();
+        break;
+#if XLEN == 32
+    case CSR_CYCLEH:
+        if (!counter_enabled(priv, mcounteren, scounteren, COUNTEREN_CY)) return false;
+        data = read_mcycle() >> 32;
+        break;
+    case CSR_TIMEH:
+        if (!counter_enabled(priv, mcounteren, scounteren, COUNTEREN_TM)) return false;
+        data = clint->mtime(cycle) >> 32;
+        break;
+    case CSR_INSTRETH:
+        if (!counter_enabled(priv, mcounteren, scounteren, COUNTEREN_IR)) return false;
+        data = read_minstret() >> 32;
+        break;
+#endif
+    // Supervisor
+    case CSR_SSTATUS   : data = mstatus & SSTATUS_MASK; break;
+    case CSR_SIE       : data = mie & mideleg         ; break;
+    case CSR_STVEC     : data = stvec                 ; break;
+    case CSR_SCOUNTEREN: data = scounteren            ; break;
+    case CSR_SSCRATCH  : data = sscratch              ; break;
+    case CSR_SEPC      : data = sepc                  ; break;
+    case CSR_SCAUSE    : data = scause                ; break;
+    case CSR_STVAL     : data = stval                 ; break;
+    case CSR_SIP       : data = read_mip() & mideleg  ; break;
+    case CSR_SATP:
+        if ((priv==PRV_S) && (mstatus & MSTATUS_TVM)) return false;
+        data = satp;
+        break;
+    // Machine information registers
+    case CSR_MVENDORID:
+    case CSR_MARCHID  :
+    case CSR_MIMPID   :
+        data = 0;
+        break;
+    case CSR_MHARTID  :
+        data = mhartid;
+        break;
+    // Machine trap setup
+    case CSR_MSTATUS   : data = mstatus   ; break;
+    case CSR_MISA      : data = misa      ; break;
+    case CSR_MEDELEG   : data = medeleg   ; break;
+    case CSR_MIDELEG   : data = mideleg   ; break;
+    case CSR_MIE       : data = mie       ; break;
+    case CSR_MTVEC     : data = mtvec     ; break;
+    case CSR_MCOUNTEREN: data = mcounteren; break;
+    // Machine trap handling
+    case CSR_MSCRATCH  : data = mscratch  ; break;
+    case CSR_MEPC      : data = mepc      ; break;
+    case CSR_MCAUSE    : data = mcause    ; break;
+    case CSR_MTVAL     : data = mtval     ; break;
+    case CSR_MIP       : data = read_mip(); break;
+    // Machine counters
+    case CSR_MCYCLE    : data = read_mcycle()  ; break;
+    case CSR_MINSTRET  : data = read_minstret(); break;
+#if XLEN == 32
+    case CSR_MCYCLEH   : data = read_mcycle()   >> 32; break;
+    case CSR_MINSTRETH : data = read_minstret() >> 32; break;
+#endif
+    default:
+        return hpm_read(csr, data);
+    }
+    return true;
+}
+
+bool Machine::csr_write(uint16_t csr, uintx_t data) {
+    if ((((csr >> 8) & 0x3) > priv) || (((csr >> 10) & 0x3)==0x3)) {
+        return false;
+    }
+    const uintx_t mstatus_mask = MSTATUS_SIE  | MSTATUS_MIE  | MSTATUS_SPIE | MSTATUS_MPIE
+                               | MSTATUS_SPP  | MSTATUS_MPRV | MSTATUS_SUM  | MSTATUS_MXR
+                               | MSTATUS_TVM  | MSTATUS_TW   | MSTATUS_TSR;
+    switch (csr) {
+    // Supervisor
+    case CSR_SSTATUS:
+        data = (mstatus & ~(SSTATUS_MASK & ~MSTATUS_UXL)) | (data & SSTATUS_MASK & ~MSTATUS_UXL);
+        // fall through
+    case CSR_MSTATUS:
+        if ((mstatus ^ data) & (MSTATUS_SUM | MSTATUS_MXR)) {
+            tlb_flush(); // cached permissions depend on them
+        }
+        mstatus = (mstatus & ~(mstatus_mask | MSTATUS_MPP))
+                | (data    &   mstatus_mask)
+                | ((uintx_t)legalize_priv((data & MSTATUS_MPP) >> MSTATUS_MPP_SHIFT) << MSTATUS_MPP_SHIFT);
+        update_vm();
+        schedule();
+        break;
+    case CSR_SIE:
+        mie = (mie & ~mideleg) | (data & mideleg);
+        schedule();
+        break;
+    case CSR_STVEC:
+        if ((data & 0x3) < 2) stvec = data;
+        break;
+    case CSR_SCOUNTEREN:
+        scounteren = data & (COUNTEREN_CY | COUNTEREN_TM | COUNTEREN_IR | COUNTEREN_HPM);
+        break;
+    case CSR_SSCRATCH: sscratch = data        ; break;
+    case CSR_SEPC    : sepc     = data & ~0x1 ; break;
+    case CSR_SCAUSE  : scause   = data        ; break;
+    case CSR_STVAL   : stval    = data        ; break;
+    case CSR_SIP:
+        mip = (mip & ~(MIP_SSIP & mideleg)) | (data & MIP_SSIP & mideleg);
+        schedule();
+        break;
+    case CSR_SATP:
+        if ((priv==PRV_S) && (mstatus & MSTATUS_TVM)) return false;
+        // unsupported modes leave satp unchanged; ASIDs are not implemented
+        if (((data & SATP_MODE)==0) || ((data & SATP_MODE)==SATP_MODE_SV)) {
+            satp = data & (SATP_MODE | SATP_PPN);
+            tlb_flush();
+            update_vm();
+        }
+        break;
+    // Machine trap setup
+    case CSR_MISA: // WARL, read-only
+        break;
+    case CSR_MEDELEG:
+        medeleg = data & MEDELEG_MASK;
+        break;
+    case CSR_MIDELEG:
+        mideleg = data & MIP_S_MASK;
+        schedule();
+        break;
+    case CSR_MIE:
+        mie = data & (MIP_M_MASK | MIP_S_MASK);
+        schedule();
+        break;
+    case CSR_MTVEC:
+        if ((data & 0x3) < 2) mtvec = data; // direct/vectored
+        break;
+    case CSR_MCOUNTEREN:
+        mcounteren = data & (COUNTEREN_CY | COUNTEREN_TM | COUNTEREN_IR | COUNTEREN_HPM);
+        break;
+    // Machine trap handling
+    case CSR_MSCRATCH: mscratch = data        ; break;
+    case CSR_MEPC    : mepc     = data & ~0x1 ; break;
+    case CSR_MCAUSE  : mcause   = data        ; break;
+    case CSR_MTVAL   : mtval    = data        ; break;
+    case CSR_MIP:
+        // MSIP/MTIP/MEIP come from the CLINT and are read-only
+        mip = (mip & ~MIP_S_MASK) | (data & MIP_S_MASK);
+        schedule();
+        break;
+    // Machine counters: the writing instruction does not count, so the next
+    // instruction reads the written value.
+#if XLEN == 32
+    case CSR_MCYCLE   : mcycle_offset   = ((read_mcycle()   & ~0xffffffffULL) | data) - cycle; break;
+    case CSR_MINSTRET : minstret_offset = ((read_minstret() & ~0xffffffffULL) | data) - cycle; break;
+    case CSR_MCYCLEH  : mcycle_offset   = ((read_mcycle()   &  0xffffffffULL) | ((uint64_t)data << 32)) - cycle; break;
+    case CSR_MINSTRETH: minstret_offset = ((read_minstret() &  0xffffffffULL) | ((uint64_t)data << 32)) - cycle; break;
+#else
+    case CSR_MCYCLE   : mcycle_offset   = data - cycle; break;
+    case CSR_MINSTRET : minstret_offset = data - cycle; break;
+#endif
+    default:
+        return hpm_write(csr, data);
+    }
+    return true;
+}
+
+void Machine::trap(uintx_t cause, uintx_t tval) {
+    // The trapping instruction does not retire.
+    minstret_offset--;
+    hpm_count[HPM_COMPRESSED] -= is_compressed;
+    ntrap++;
+    trap_enter(cause, tval, pc);
+}
+
+void Machine::trap_enter(uintx_t cause, uintx_t tval, uintx_t epc) {
+    uintx_t deleg = (cause & CAUSE_INTERRUPT) ? mideleg : medeleg;
+    if ((priv<=PRV_S) && ((deleg >> (cause & ~CAUSE_INTERRUPT)) & 0x1)) {
+        // delegated to S-mode
+        sepc    = epc;
+        scause  = cause;
+        stval   = tval;
+        mstatus = (mstatus & ~(MSTATUS_SPIE | MSTATUS_SPP | MSTATUS_SIE))
+                | ((mstatus & MSTATUS_SIE) ? MSTATUS_SPIE : 0)
+                | ((uintx_t)priv << MSTATUS_SPP_SHIFT);
+        priv    = PRV_S;
+        r.pc    = stvec & ~(uintx_t)MTVEC_MODE;
+        if ((cause & CAUSE_INTERRUPT) && ((stvec & MTVEC_MODE)==MTVEC_VECTORED)) {
+            r.pc = r.pc + 4*(cause & ~CAUSE_INTERRUPT);
+        }
+        update_vm();
+        schedule();
+        return;
+    }
+
+    mepc    = epc;
+    mcause  = cause;
+    mtval   = tval;
+    mstatus = (mstatus & ~(MSTATUS_MPIE | MSTATUS_MPP))
+            | ((mstatus & MSTATUS_MIE) ? MSTATUS_MPIE : 0)
+            | ((uintx_t)priv << MSTATUS_MPP_SHIFT);
+    mstatus = mstatus & ~MSTATUS_MIE;
+    priv    = PRV_M;
+    r.pc    = mtvec & ~(uintx_t)MTVEC_MODE;
+    if ((cause & CAUSE_INTERRUPT) && ((mtvec & MTVEC_MODE)==MTVEC_VECTORED)) {
+        r.pc = r.pc + 4*(cause & ~CAUSE_INTERRUPT);
+    }
+    update_vm();
+    schedule();
+
+    if (r.pc==RESET_VECTOR) {
+        // No trap handler installed (bare-metal crt0): report like a fault
+        // and stop the hart.
+        char msg[160];
+#if      XLEN == 32
+        snprintf(msg, sizeof(msg), "Error: unhandled trap detected!! (mcause=%ld)\npc=[0x%08x] ir=[0x%08x] tval=[0x%08x]\n",
+                 (uint64_t)cause, pc, ir, tval);
+#else // XLEN == 64
+        snprintf(msg, sizeof(msg), "Error: unhandled trap detected!! (mcause=%ld)\npc=[0x%016lx] ir=[0x%08x] tval=[0x%016lx]\n",
+                 (uint64_t)cause, pc, ir, tval);
+#endif
+        if (console!=NULL) {
+            console->append(msg);
+        } else {
+            fputs(msg, stderr);
+        }
+        exit_code = EXIT_TRAP;
+        halt      = 1;
+    }
+}
+
+void Machine::mret() {
+    uint8_t mpp = (mstatus & MSTATUS_MPP) >> MSTATUS_MPP_SHIFT;
+    mstatus = (mstatus & ~(MSTATUS_MIE | MSTATUS_MPP))
+            | ((mstatus & MSTATUS_MPIE) ? MSTATUS_MIE : 0)
+            | MSTATUS_MPIE
+            | ((uintx_t)PRV_U << MSTATUS_MPP_SHIFT);
+    if (mpp<PRV_M) {
+        mstatus = mstatus & ~MSTATUS_MPRV;
+    }
+    priv    = mpp;
+    r.pc    = mepc;
+    update_vm();
+    schedule();
+}
+
+void Machine::sret() {
+    uint8_t spp = (mstatus & MSTATUS_SPP) >> MSTATUS_SPP_SHIFT;
+    mstatus = (mstatus & ~(MSTATUS_SIE | MSTATUS_SPP | MSTATUS_MPRV))
+            | ((mstatus & MSTATUS_SPIE) ? MSTATUS_SIE : 0)
+            | MSTATUS_SPIE;
+    priv    = spp;
+    r.pc    = sepc;
+    update_vm();
+    schedule();
+}
+
+// Nothing else can happen while the hart sleeps, so virtual time jumps straight
+// to the timer deadline. Under the quantum scheduler other harts can only wake
+// it at the end of the quantum, so it sleeps until then at most. Without a
+// wake-up source wfi is a nop.
+void Machine::wfi() {
+    if ((read_mip() & mie)!=0) {
+        return;
+    }
+    uint64_t limit = (smp->nharts>1) ? quantum_end : (uint64_t)-1;
+    uint64_t wake  = (mie & MIP_MTIP) ? timer_deadline : limit;
+    if (wake==(uint64_t)-1) {
+        return;
+    }
+    if (wake > limit  ) wake = limit;
+    if (wake > TIMEOUT    ) wake = TIMEOUT;
+    if (wake > cycle) {
+        minstret_offset -= wake - cycle;
+        cycle            = wake;
+    }
+}
+
+// Pending interrupts that would be taken now: M-level ones unless masked by
+// mstatus.MIE in M-mode, delegated ones only below M and, in S-mode, when
+// mstatus.SIE is set.
+uintx_t Machine::pending_interrupts() {
+    uintx_t pending = read_mip() & mie;
+    uintx_t m = pending & ~mideleg;
+    uintx_t s = pending &  mideleg;
+    if ((priv==PRV_M) && !(mstatus & MSTATUS_MIE)) m = 0;
+    if ((priv==PRV_M) || ((priv==PRV_S) && !(mstatus & MSTATUS_SIE))) s = 0;
+    return (m!=0) ? m : s;
+}
+
+// Recompute next_event. Called whenever the timer, mie, mip or the global
+// interrupt enable may have changed.
+void Machine::schedule() {
+    uint64_t next = TIMEOUT;
+    if (pending_interrupts()) {
+        next = cycle;
+    } else if ((mie & MIP_MTIP) && ((priv<PRV_M) || (mstatus & MSTATUS_MIE)) && (timer_deadline<next)) {
+        next = timer_deadline;
+    }
+    next_event = next;
+    if (kicked) {
+        next_event = cycle; // another hart asked for attention meanwhile
+    }
+}
+
+void Machine::event() {
+    if (kicked) {
+        // msip/mtimecmp may have been written by another hart
+        kicked         = false;
+        timer_deadline = clint->deadline(hartid, cycle);
+    }
+    if ((cycle>=TIMEOUT) || smp->stop) {
+        halt = 1;
+    }
+    uintx_t pending = pending_interrupts();
+    if (pending) {
+        uintx_t irq = (pending & MIP_MEIP) ? IRQ_M_EXT
+                    : (pending & MIP_MSIP) ? IRQ_M_SOFT
+                    : (pending & MIP_MTIP) ? IRQ_M_TIMER
+                    : (pending & MIP_SEIP) ? IRQ_S_EXT
+                    : (pending & MIP_SSIP) ? IRQ_S_SOFT
+                    :                        IRQ_S_TIMER;
+        trap_enter(CAUSE_INTERRUPT | irq, 0, r.pc);
+    } else {
+        schedule();
+    }
+}
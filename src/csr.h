@@ -0,0 +1,162 @@
+#if !defined(CSR_H_)
+#define CSR_H_
+
+//------------------------------------------------------------------------------
+// Privilege levels
+//------------------------------------------------------------------------------
+#define PRV_U 0
+#define PRV_S 1
+#define PRV_M 3
+
+//------------------------------------------------------------------------------
+// CSR addresses
+//------------------------------------------------------------------------------
+// Unprivileged counters/timers
+#define CSR_CYCLE      0xc00
+#define CSR_TIME       0xc01
+#define CSR_INSTRET    0xc02
+#define CSR_CYCLEH     0xc80
+#define CSR_TIMEH      0xc81
+#define CSR_INSTRETH   0xc82
+#define CSR_HPMCOUNTER3  0xc03 // hpmcounter3-31: 0xc03-0xc1f
+#define CSR_HPMCOUNTER3H 0xc83 // hpmcounter3h-31h: 0xc83-0xc9f
+
+// Supervisor trap setup
+#define CSR_SSTATUS    0x100
+#define CSR_SIE        0x104
+#define CSR_STVEC      0x105
+#define CSR_SCOUNTEREN 0x106
+
+// Supervisor trap handling
+#define CSR_SSCRATCH   0x140
+#define CSR_SEPC       0x141
+#define CSR_SCAUSE     0x142
+#define CSR_STVAL      0x143
+#define CSR_SIP        0x144
+
+// Supervisor protection and translation
+#define CSR_SATP       0x180
+
+// Machine information registers
+#define CSR_MVENDORID  0xf11
+#define CSR_MARCHID    0xf12
+#define CSR_MIMPID     0xf13
+#define CSR_MHARTID    0xf14
+
+// Machine trap setup
+#define CSR_MSTATUS    0x300
+#define CSR_MISA       0x301
+#define CSR_MEDELEG    0x302
+#define CSR_MIDELEG    0x303
+#define CSR_MIE        0x304
+#define CSR_MTVEC      0x305
+#define CSR_MCOUNTEREN 0x306
+
+// Machine counter setup
+#define CSR_MHPMEVENT3 0x323 // mhpmevent3-31: 0x323-0x33f
+
+// Machine trap handling
+#define CSR_MSCRATCH   0x340
+#define CSR_MEPC       0x341
+#define CSR_MCAUSE     0x342
+#define CSR_MTVAL      0x343
+#define CSR_MIP        0x344
+
+// Machine counters/timers
+#define CSR_MCYCLE     0xb00
+#define CSR_MINSTRET   0xb02
+#define CSR_MCYCLEH    0xb80
+#define CSR_MINSTRETH  0xb82
+#define CSR_MHPMCOUNTER3  0xb03 // mhpmcounter3-31: 0xb03-0xb1f
+#define CSR_MHPMCOUNTER3H 0xb83 // mhpmcounter3h-31h: 0xb83-0xb9f
+
+//------------------------------------------------------------------------------
+// mstatus
+//------------------------------------------------------------------------------
+#define MSTATUS_SIE    0x00000002
+#define MSTATUS_MIE    0x00000008
+#define MSTATUS_SPIE   0x00000020
+#define MSTATUS_MPIE   0x00000080
+#define MSTATUS_SPP    0x00000100
+#define MSTATUS_MPP    0x00001800
+#define MSTATUS_MPRV   0x00020000
+#define MSTATUS_SUM    0x00040000
+#define MSTATUS_MXR    0x00080000
+#define MSTATUS_TVM    0x00100000
+#define MSTATUS_TW     0x00200000
+#define MSTATUS_TSR    0x00400000
+#define MSTATUS_UXL    0x0000000300000000
+
+#define MSTATUS_SPP_SHIFT 8
+#define MSTATUS_MPP_SHIFT 11
+
+// sstatus is a restricted view of mstatus
+#if XLEN == 32
+#define SSTATUS_MASK   (MSTATUS_SIE | MSTATUS_SPIE | MSTATUS_SPP | MSTATUS_SUM | MSTATUS_MXR)
+#else
+#define SSTATUS_MASK   (MSTATUS_SIE | MSTATUS_SPIE | MSTATUS_SPP | MSTATUS_SUM | MSTATUS_MXR | MSTATUS_UXL)
+#endif
+
+//------------------------------------------------------------------------------
+// mip/mie
+//------------------------------------------------------------------------------
+#define MIP_SSIP       0x002
+#define MIP_MSIP       0x008
+#define MIP_STIP       0x020
+#define MIP_MTIP       0x080
+#define MIP_SEIP       0x200
+#define MIP_MEIP       0x800
+
+#define MIP_S_MASK     (MIP_SSIP | MIP_STIP | MIP_SEIP)
+#define MIP_M_MASK     (MIP_MSIP | MIP_MTIP | MIP_MEIP)
+
+#define IRQ_S_SOFT     1
+#define IRQ_M_SOFT     3
+#define IRQ_S_TIMER    5
+#define IRQ_M_TIMER    7
+#define IRQ_S_EXT      9
+#define IRQ_M_EXT      11
+
+//------------------------------------------------------------------------------
+// mtvec/stvec
+//------------------------------------------------------------------------------
+#define MTVEC_MODE     0x3
+#define MTVEC_VECTORED 0x1
+
+//------------------------------------------------------------------------------
+// misa
+//------------------------------------------------------------------------------
+#define MISA_EXT(c) (1 << ((c) - 'A'))
+
+//------------------------------------------------------------------------------
+// mcounteren
+//------------------------------------------------------------------------------
+#define COUNTEREN_CY   0x1
+#define COUNTEREN_TM   0x2
+#define COUNTEREN_IR   0x4
+#define COUNTEREN_HPM  0xfffffff8 // hpmcounter3-31
+
+//------------------------------------------------------------------------------
+// mcause
+//------------------------------------------------------------------------------
+#define CAUSE_MISALIGNED_FETCH    0x0
+#define CAUSE_FETCH_ACCESS        0x1
+#define CAUSE_ILLEGAL_INSTRUCTION 0x2
+#define CAUSE_BREAKPOINT          0x3
+#define CAUSE_MISALIGNED_LOAD     0x4
+#define CAUSE_LOAD_ACCESS         0x5
+#define CAUSE_MISALIGNED_STORE    0x6
+#define CAUSE_STORE_ACCESS        0x7
+#define CAUSE_USER_ECALL          0x8
+#define CAUSE_SUPERVISOR_ECALL    0x9
+#define CAUSE_MACHINE_ECALL       0xb
+#define CAUSE_FETCH_PAGE_FAULT    0xc
+#define CAUSE_LOAD_PAGE_FAULT     0xd
+#define CAUSE_STORE_PAGE_FAULT    0xf
+
+// exceptions that medeleg can hand to S-mode (all but ecall from M)
+#define MEDELEG_MASK              0xb3ff
+
+#define CAUSE_INTERRUPT           ((uintx_t)1 << (XLEN-1))
+
+#endif // CSR_H_
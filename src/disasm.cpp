@@ -0,0 +1,251 @@
+#include <cstdio>
+#include "disasm.h"
+#include "csr.h"
+#include "rvc.h"
+
+const char *reg_name[32] = {
+    "zero", "ra", "sp", "gp", "tp" , "t0" , "t1", "t2",
+    "s0"  , "s1", "a0", "a1", "a2" , "a3" , "a4", "a5",
+    "a6"  , "a7", "s2", "s3", "s4" , "s5" , "s6", "s7",
+    "s8"  , "s9", "s10","s11","t3" , "t4" , "t5", "t6",
+};
+
+const char *csr_name(uint32_t csr) {
+    switch (csr) {
+    case CSR_CYCLE     : return "cycle";
+    case CSR_TIME      : return "time";
+    case CSR_INSTRET   : return "instret";
+    case CSR_CYCLEH    : return "cycleh";
+    case CSR_TIMEH     : return "timeh";
+    case CSR_INSTRETH  : return "instreth";
+    case CSR_SSTATUS   : return "sstatus";
+    case CSR_SIE       : return "sie";
+    case CSR_STVEC     : return "stvec";
+    case CSR_SCOUNTEREN: return "scounteren";
+    case CSR_SSCRATCH  : return "sscratch";
+    case CSR_SEPC      : return "sepc";
+    case CSR_SCAUSE    : return "scause";
+    case CSR_STVAL     : return "stval";
+    case CSR_SIP       : return "sip";
+    case CSR_SATP      : return "satp";
+    case CSR_MVENDORID : return "mvendorid";
+    case CSR_MARCHID   : return "marchid";
+    case CSR_MIMPID    : return "mimpid";
+    case CSR_MHARTID   : return "mhartid";
+    case CSR_MSTATUS   : return "mstatus";
+    case CSR_MISA      : return "misa";
+    case CSR_MEDELEG   : return "medeleg";
+    case CSR_MIDELEG   : return "mideleg";
+    case CSR_MIE       : return "mie";
+    case CSR_MTVEC     : return "mtvec";
+    case CSR_MCOUNTEREN: return "mcounteren";
+    case CSR_MSCRATCH  : return "mscratch";
+    case CSR_MEPC      : return "mepc";
+    case CSR_MCAUSE    : return "mcause";
+    case CSR_MTVAL     : return "mtval";
+    case CSR_MIP       : return "mip";
+    case CSR_MCYCLE    : return "mcycle";
+    case CSR_MINSTRET  : return "minstret";
+    case CSR_MCYCLEH   : return "mcycleh";
+    case CSR_MINSTRETH : return "minstreth";
+    }
+    // hpmcounter3-31, hpmcounter3h-31h, mhpmcounter3-31, mhpmcounter3h-31h, mhpmevent3-31
+    static const uint32_t hpm_base[5] = {
+        CSR_HPMCOUNTER3, CSR_HPMCOUNTER3H, CSR_MHPMCOUNTER3, CSR_MHPMCOUNTER3H, CSR_MHPMEVENT3,
+    };
+    static char hpm_name[5][29][16];
+    static bool hpm_init = [] {
+        const char *fmt[5] = {"hpmcounter%d", "hpmcounter%dh", "mhpmcounter%d", "mhpmcounter%dh", "mhpmevent%d"};
+        for (int k=0; k<5; k++) {
+            for (int i=0; i<29; i++) {
+                snprintf(hpm_name[k][i], sizeof(hpm_name[k][i]), fmt[k], i+3);
+            }
+        }
+        return true;
+    }();
+    (void)hpm_init;
+    for (int k=0; k<5; k++) {
+        if ((csr>=hpm_base[k]) && (csr<hpm_base[k]+29) && ((XLEN==32) || ((k!=1) && (k!=3)))) {
+            return hpm_name[k][csr-hpm_base[k]];
+        }
+    }
+    return NULL;
+}
+
+#define SHAMT_BITS ((XLEN==32) ? 5 : 6)
+
+char *disasm(uintx_t pc, uint32_t ir, char *buf, size_t size) {
+    if ((ir & 0x3)!=0x3) {
+        ir = rvc_expand(ir);
+    }
+    uint32_t opcode = ir & 0x7f;
+    uint32_t funct3 = (ir >> 12) & 0x7;
+    uint32_t funct7 = (ir >> 25) & 0x7f;
+    const char *rd  = reg_name[(ir >> 7 ) & 0x1f];
+    const char *rs1 = reg_name[(ir >> 15) & 0x1f];
+    const char *rs2 = reg_name[(ir >> 20) & 0x1f];
+
+    int32_t  imm_i  = (int32_t)ir >> 20;
+    int32_t  imm_s  = ((int32_t)(ir & 0xfe000000) >> 20) | ((ir >> 7) & 0x1f);
+    int32_t  imm_b  = ((int32_t)(ir & 0x80000000) >> 19) | ((ir << 4) & 0x800) | ((ir >> 20) & 0x7e0) | ((ir >> 7) & 0x1e);
+    int32_t  imm_j  = ((int32_t)(ir & 0x80000000) >> 11) | (ir & 0xff000) | ((ir >> 9) & 0x800) | ((ir >> 20) & 0x7fe);
+    uint32_t imm_u  = ir >> 12;
+    uint32_t shamt  = (ir >> 20) & (XLEN-1);
+    uint64_t target;
+
+    static const char *load [8] = {"lb", "lh", "lw", "ld", "lbu", "lhu", "lwu", NULL};
+    static const char *store[8] = {"sb", "sh", "sw", "sd", NULL , NULL , NULL , NULL};
+    static const char *brnch[8] = {"beq", "bne", NULL, NULL, "blt", "bge", "bltu", "bgeu"};
+    static const char *alui [8] = {"addi", NULL, "slti", "sltiu", "xori", NULL, "ori", "andi"};
+    static const char *alu  [8] = {"add", "sll", "slt", "sltu", "xor", "srl", "or", "and"};
+    static const char *muldv[8] = {"mul", "mulh", "mulhsu", "mulhu", "div", "divu", "rem", "remu"};
+#if XLEN == 64
+    static const char *muldw[8] = {"mulw", NULL, NULL, NULL, "divw", "divuw", "remw", "remuw"};
+#endif
+    static const char *csri [8] = {NULL, "csrrw", "csrrs", "csrrc", NULL, "csrrwi", "csrrsi", "csrrci"};
+
+    switch (opcode) {
+    case 0b0110111: // lui
+        snprintf(buf, size, "lui\t%s,0x%x", rd, imm_u);
+        return buf;
+    case 0b0010111: // auipc
+        snprintf(buf, size, "auipc\t%s,0x%x", rd, imm_u);
+        return buf;
+    case 0b1101111: // jal
+        target = (uintx_t)(pc + imm_j);
+        if (((ir >> 7) & 0x1f)==0) {
+            snprintf(buf, size, "j\t%lx", target);
+        } else {
+            snprintf(buf, size, "jal\t%s,%lx", rd, target);
+        }
+        return buf;
+    case 0b1100111: // jalr
+        if (funct3!=0) break;
+        if (ir==0x00008067) { // jalr x0, 0(ra)
+            snprintf(buf, size, "ret");
+        } else {
+            snprintf(buf, size, "jalr\t%s,%d(%s)", rd, imm_i, rs1);
+        }
+        return buf;
+    case 0b1100011: // branch
+        if (brnch[funct3]==NULL) break;
+        target = (uintx_t)(pc + imm_b);
+        if ((funct3<=0b001) && (((ir >> 20) & 0x1f)==0)) {
+            snprintf(buf, size, "%sz\t%s,%lx", brnch[funct3], rs1, target);
+        } else {
+            snprintf(buf, size, "%s\t%s,%s,%lx", brnch[funct3], rs1, rs2, target);
+        }
+        return buf;
+    case 0b0000011: // load
+        if ((load[funct3]==NULL) || ((XLEN==32) && ((funct3==0b011) || (funct3==0b110)))) break;
+        snprintf(buf, size, "%s\t%s,%d(%s)", load[funct3], rd, imm_i, rs1);
+        return buf;
+    case 0b0100011: // store
+        if ((store[funct3]==NULL) || ((XLEN==32) && (funct3==0b011))) break;
+        snprintf(buf, size, "%s\t%s,%d(%s)", store[funct3], rs2, imm_s, rs1);
+        return buf;
+    case 0b0010011: // op-imm
+        if (funct3==0b001) {
+            if ((ir >> (20+SHAMT_BITS))!=0) break;
+            snprintf(buf, size, "slli\t%s,%s,%u", rd, rs1, shamt);
+        } else if (funct3==0b101) {
+            if (((ir >> (20+SHAMT_BITS)) & ~(0x400 >> SHAMT_BITS))!=0) break;
+            snprintf(buf, size, "%s\t%s,%s,%u", (ir & 0x40000000) ? "srai" : "srli", rd, rs1, shamt);
+        } else if (ir==0x00000013) {
+            snprintf(buf, size, "nop");
+        } else if ((funct3==0b000) && (((ir >> 15) & 0x1f)==0)) {
+            snprintf(buf, size, "li\t%s,%d", rd, imm_i);
+        } else if ((funct3==0b000) && (imm_i==0)) {
+            snprintf(buf, size, "mv\t%s,%s", rd, rs1);
+        } else {
+            snprintf(buf, size, "%s\t%s,%s,%d", alui[funct3], rd, rs1, imm_i);
+        }
+        return buf;
+    case 0b0110011: // op
+        if (funct7==0b0000001) {
+            snprintf(buf, size, "%s\t%s,%s,%s", muldv[funct3], rd, rs1, rs2);
+        } else if (funct7==0b0100000) {
+            if      (funct3==0b000) snprintf(buf, size, "sub\t%s,%s,%s", rd, rs1, rs2);
+            else if (funct3==0b101) snprintf(buf, size, "sra\t%s,%s,%s", rd, rs1, rs2);
+            else break;
+        } else if ((funct7==0) && (funct3==0b000) && (((ir >> 15) & 0x1f)==0)) {
+            snprintf(buf, size, "mv\t%s,%s", rd, rs2);
+        } else if (funct7==0) {
+            snprintf(buf, size, "%s\t%s,%s,%s", alu[funct3], rd, rs1, rs2);
+        } else {
+            break;
+        }
+        return buf;
+#if XLEN == 64
+    case 0b0011011: // op-imm-32
+        if      (funct3==0b000) snprintf(buf, size, "addiw\t%s,%s,%d", rd, rs1, imm_i);
+        else if ((funct3==0b001) && (funct7==0)) snprintf(buf, size, "slliw\t%s,%s,%u", rd, rs1, shamt & 0x1f);
+        else if ((funct3==0b101) && (funct7==0)) snprintf(buf, size, "srliw\t%s,%s,%u", rd, rs1, shamt & 0x1f);
+        else if ((funct3==0b101) && (funct7==0b0100000)) snprintf(buf, size, "sraiw\t%s,%s,%u", rd, rs1, shamt & 0x1f);
+        else break;
+        return buf;
+    case 0b0111011: // op-32
+        if      ((funct7==0b0000001) && (muldw[funct3]!=NULL)) snprintf(buf, size, "%s\t%s,%s,%s", muldw[funct3], rd, rs1, rs2);
+        else if ((funct7==0) && (funct3==0b000)) snprintf(buf, size, "addw\t%s,%s,%s", rd, rs1, rs2);
+        else if ((funct7==0) && (funct3==0b001)) snprintf(buf, size, "sllw\t%s,%s,%s", rd, rs1, rs2);
+        else if ((funct7==0) && (funct3==0b101)) snprintf(buf, size, "srlw\t%s,%s,%s", rd, rs1, rs2);
+        else if ((funct7==0b0100000) && (funct3==0b000)) snprintf(buf, size, "subw\t%s,%s,%s", rd, rs1, rs2);
+        else if ((funct7==0b0100000) && (funct3==0b101)) snprintf(buf, size, "sraw\t%s,%s,%s", rd, rs1, rs2);
+        else break;
+        return buf;
+#endif
+    case 0b0001111: // misc-mem
+        if      (funct3==0b000) snprintf(buf, size, "fence");
+        else if (funct3==0b001) snprintf(buf, size, "fence.i");
+        else break;
+        return buf;
+    case 0b0101111: { // amo
+        static const char *amo[32] = {
+            "amoadd", "amoswap", "lr"  , "sc"  , "amoxor" , NULL, NULL, NULL,
+            "amoor" , NULL     , NULL  , NULL  , "amoand" , NULL, NULL, NULL,
+            "amomin", NULL     , NULL  , NULL  , "amomax" , NULL, NULL, NULL,
+            "amominu", NULL    , NULL  , NULL  , "amomaxu", NULL, NULL, NULL,
+        };
+        const char *name = amo[ir >> 27];
+        if ((name==NULL) || ((funct3!=0b010) && ((XLEN==32) || (funct3!=0b011)))) break;
+        const char *w = (funct3==0b010) ? "w" : "d";
+        if ((ir >> 27)==0b00010) {
+            snprintf(buf, size, "%s.%s\t%s,(%s)", name, w, rd, rs1);
+        } else {
+            snprintf(buf, size, "%s.%s\t%s,%s,(%s)", name, w, rd, rs2, rs1);
+        }
+        return buf;
+    }
+    case 0b1110011: { // system
+        if (funct3==0) {
+            switch (ir) {
+            case 0x00000073: snprintf(buf, size, "ecall" ); return buf;
+            case 0x00100073: snprintf(buf, size, "ebreak"); return buf;
+            case 0x30200073: snprintf(buf, size, "mret"  ); return buf;
+            case 0x10200073: snprintf(buf, size, "sret"  ); return buf;
+            case 0x10500073: snprintf(buf, size, "wfi"   ); return buf;
+            }
+            if ((ir & 0xfe007fff)==0x12000073) {
+                snprintf(buf, size, "sfence.vma\t%s,%s", rs1, rs2);
+                return buf;
+            }
+            break;
+        }
+        if (csri[funct3]==NULL) break;
+        char        num[8];
+        const char *csr = csr_name(ir >> 20);
+        if (csr==NULL) {
+            snprintf(num, sizeof(num), "0x%x", ir >> 20);
+            csr = num;
+        }
+        if (funct3 & 0b100) {
+            snprintf(buf, size, "%s\t%s,%s,%u", csri[funct3], rd, csr, (ir >> 15) & 0x1f);
+        } else {
+            snprintf(buf, size, "%s\t%s,%s,%s", csri[funct3], rd, csr, rs1);
+        }
+        return buf;
+    }
+    }
+    snprintf(buf, size, "unknown");
+    return buf;
+}
@@ -0,0 +1,25 @@
+#if !defined(DISASM_H_)
+#define DISASM_H_
+
+#include <cstddef>
+#include <cstdint>
+#include "rvemu.h"
+
+// ABI name of integer register i.
+extern const char *reg_name[32];
+
+// Name of a CSR (as objdump prints it), or NULL if rvemu does not have it.
+const char *csr_name(uint32_t csr);
+
+// Text of the instruction at pc, in the syntax of objdump -d (ABI register
+// names, branch and jump targets as absolute addresses). ir is a 32-bit
+// instruction; a compressed one is disassembled as the instruction it
+// expands to. Writes at most size bytes to buf and returns buf.
+char *disasm(uintx_t pc, uint32_t ir, char *buf, size_t size);
+
+// Length in bytes (2 or 4) of the instruction whose low halfword is given.
+static inline int insn_length(uint16_t low) {
+    return ((low & 0x3)==0x3) ? 4 : 2;
+}
+
+#endif // DISASM_H_
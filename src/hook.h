@@ -0,0 +1,51 @@
+#if !defined(HOOK_H_)
+#define HOOK_H_
+
+#include <cstdint>
+#include "machine.h"
+
+//------------------------------------------------------------------------------
+// Per-instruction hooks
+//------------------------------------------------------------------------------
+// The analyses that look at every instruction (--profile, --mix,
+// --sample-stacks, --bbv/--simpoints and the commit loop of commit.h) share
+// one loop. run_hooked() runs the hart like Machine::run() and calls
+// hook(halt) after every eval(), when pc, ir (RVC expanded), cir,
+// is_compressed and r.pc describe the instruction; one hook can feed several
+// analyses. The loop also ends, without halting the other harts, when the
+// hook returns false.
+template<typename Hook> void run_hooked(Machine &m, Hook hook) {
+    for (;;) {
+        int  halt = m.eval();
+        bool more = hook(halt);
+        if (halt) {
+            m.smp->halt_all(&m);
+            break;
+        }
+        if (!more) {
+            break;
+        }
+    }
+}
+
+// Calls and returns among jal/jalr (ir RVC expanded), by the link registers
+// (x1, x5) of rd and rs1 as the ISA manual suggests for return-address
+// stacks: a link rd pushes the return address, a link rs1 of a jalr pops,
+// and a jalr with both pops and then pushes unless they are the same
+// register.
+#define LINK_CALL 0x1
+#define LINK_RET  0x2
+
+static inline int link_kind(uint32_t ir) {
+    uint8_t opcode = (ir >> 2) & 0x1f;
+    if ((opcode!=0b11011) && (opcode!=0b11001)) { // jal, jalr
+        return 0;
+    }
+    uint8_t rd     = (ir >> 7 ) & 0x1f;
+    uint8_t rs1    = (ir >> 15) & 0x1f;
+    bool    call   = (rd==1) || (rd==5);
+    bool    ret    = (opcode==0b11001) && ((rs1==1) || (rs1==5)) && (!call || (rs1!=rd));
+    return ((call) ? LINK_CALL : 0) | ((ret) ? LINK_RET : 0);
+}
+
+#endif // HOOK_H_
@@ -0,0 +1,108 @@
+#include <cstring>
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include "hostperf.h"
+
+#define HW_CACHE_MISS(cache) \
+    (PERF_COUNT_HW_CACHE_ ## cache | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16))
+
+static const struct {
+    const char *name  ;
+    uint32_t    type  ;
+    uint64_t    config;
+} events[HOSTPERF_EVENTS] = {
+    {"task-clock ns"   , PERF_TYPE_SOFTWARE, PERF_COUNT_SW_TASK_CLOCK          },
+    {"cycles"          , PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES          },
+    {"instructions"    , PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS        },
+    {"branches"        , PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_INSTRUCTIONS },
+    {"branch-misses"   , PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES       },
+    {"L1-icache-misses", PERF_TYPE_HW_CACHE, HW_CACHE_MISS(L1I)                },
+    {"L1-dcache-misses", PERF_TYPE_HW_CACHE, HW_CACHE_MISS(L1D)                },
+    {"LLC-misses"      , PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES        },
+    {"iTLB-misses"     , PERF_TYPE_HW_CACHE, HW_CACHE_MISS(ITLB)               },
+    {"page-faults"     , PERF_TYPE_SOFTWARE, PERF_COUNT_SW_PAGE_FAULTS         },
+};
+
+HostPerf::HostPerf() {
+    for (int i=0; i<HOSTPERF_EVENTS; i++) {
+        fd     [i] = -1;
+        count  [i] = 0;
+        running[i] = 0;
+    }
+}
+
+HostPerf::~HostPerf() {
+    for (int i=0; i<HOSTPERF_EVENTS; i++) {
+        if (fd[i]>=0) {
+            close(fd[i]);
+        }
+    }
+}
+
+bool HostPerf::open() {
+    bool any = false;
+    for (int i=0; i<HOSTPERF_EVENTS; i++) {
+        struct perf_event_attr attr;
+        memset(&attr, 0, sizeof(attr));
+        attr.size           = sizeof(attr);
+        attr.type           = events[i].type;
+        attr.config         = events[i].config;
+        attr.disabled       = 1;
+        attr.inherit        = 1; // and the threads of the other harts
+        attr.exclude_kernel = 1;
+        attr.exclude_hv     = 1;
+        attr.read_format    = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+        fd[i] = syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0); // this process, any CPU
+        any  |= (fd[i]>=0);
+    }
+    return any;
+}
+
+void HostPerf::start() {
+    for (int i=0; i<HOSTPERF_EVENTS; i++) {
+        if (fd[i]>=0) {
+            ioctl(fd[i], PERF_EVENT_IOC_RESET , 0);
+            ioctl(fd[i], PERF_EVENT_IOC_ENABLE, 0);
+        }
+    }
+}
+
+void HostPerf::stop() {
+    for (int i=0; i<HOSTPERF_EVENTS; i++) {
+        if (fd[i]>=0) {
+            ioctl(fd[i], PERF_EVENT_IOC_DISABLE, 0);
+        }
+    }
+    for (int i=0; i<HOSTPERF_EVENTS; i++) {
+        uint64_t v[3]; // value, time enabled, time running
+        if ((fd[i]<0) || (read(fd[i], v, sizeof(v))!=sizeof(v))) {
+            continue;
+        }
+        running[i] = (v[1]!=0) ? (double)v[2] / v[1] : 0;
+        count  [i] = (running[i]>0) ? (uint64_t)(v[0] / running[i]) : 0;
+    }
+}
+
+void HostPerf::report(FILE *fp, uint64_t instret) {
+    double n = (instret!=0) ? (double)instret : 1.0;
+    fprintf(fp, "\nhost counters: %lu guest instructions\n", instret);
+    for (int i=0; i<HOSTPERF_EVENTS; i++) {
+        if ((fd[i]<0) || (running[i]==0)) {
+            fprintf(fp, "  %-16s  %14s\n", events[i].name, "not counted");
+            continue;
+        }
+        fprintf(fp, "  %-16s  %14lu  %8.3f per instruction", events[i].name, count[i], count[i] / n);
+        if ((i==HOSTPERF_INSTRUCTIONS) && (fd[HOSTPERF_CYCLES]>=0) && (count[HOSTPERF_CYCLES]!=0)) {
+            fprintf(fp, "  (IPC %.2f)", (double)count[i] / count[HOSTPERF_CYCLES]);
+        }
+        if ((i==HOSTPERF_BRANCH_MISSES) && (fd[HOSTPERF_BRANCHES]>=0) && (count[HOSTPERF_BRANCHES]!=0)) {
+            fprintf(fp, "  (%.2f%% of branches)", 100.0 * count[i] / count[HOSTPERF_BRANCHES]);
+        }
+        if (running[i]<0.999) {
+            fprintf(fp, "  [scaled, counted %.0f%%]", 100 * running[i]);
+        }
+        fprintf(fp, "\n");
+    }
+}
@@ -0,0 +1,51 @@
+#if !defined(HOSTPERF_H_)
+#define HOSTPERF_H_
+
+#include <cstdio>
+#include <cstdint>
+
+//------------------------------------------------------------------------------
+// Host hardware counters (--hostperf)
+//------------------------------------------------------------------------------
+// Counts host events of the emulator itself with perf_event_open, from just
+// before the harts start to their halt (loading and reports are not counted),
+// and prints them in total and per guest instruction: where host cycles go
+// (dispatch mispredicts, instruction cache and iTLB misses of the decoder,
+// data misses of guest memory) without an external perf.
+//
+// User-mode events only, so that it works with perf_event_paranoid<=2.
+// Threads of other harts are counted too (inherit). task-clock and page
+// faults are software events and are there even without a PMU; a hardware
+// event the host does not have (a VM without a PMU, ...) is reported as
+// "not counted". When the PMU has fewer counters than events, the kernel
+// multiplexes them and the counts are scaled from the time each one was
+// counted.
+enum HostPerfEvent {
+    HOSTPERF_TASK_CLOCK   , // ns
+    HOSTPERF_CYCLES       ,
+    HOSTPERF_INSTRUCTIONS ,
+    HOSTPERF_BRANCHES     ,
+    HOSTPERF_BRANCH_MISSES,
+    HOSTPERF_L1I_MISSES   ,
+    HOSTPERF_L1D_MISSES   , // loads
+    HOSTPERF_LLC_MISSES   ,
+    HOSTPERF_ITLB_MISSES  ,
+    HOSTPERF_PAGE_FAULTS  , // first touches of guest RAM, mostly
+    HOSTPERF_EVENTS
+};
+
+struct HostPerf {
+    int      fd     [HOSTPERF_EVENTS]; // -1 if the host does not have the event
+    uint64_t count  [HOSTPERF_EVENTS];
+    double   running[HOSTPERF_EVENTS]; // fraction of the time it was counted
+
+    HostPerf();
+    ~HostPerf();
+
+    bool open (); // false if no event can be counted
+    void start();
+    void stop ();
+    void report(FILE *fp, uint64_t instret);
+};
+
+#endif // HOSTPERF_H_
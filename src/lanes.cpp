@@ -0,0 +1,452 @@
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include "machine.h"
+#include "rvc.h"
+#include "lanes.h"
+
+// The lane loops are meant to be vectorized, which -O2 only does for trivial
+// loops. Build with NATIVE=1 to use AVX2/AVX-512.
+#pragma GCC optimize ("tree-vectorize", "vect-cost-model=dynamic")
+
+Lanes::Lanes(const char *memfile, int n, bool syscall_proxy) {
+    this->n = n;
+    lane  .resize(n);
+    output.resize(n);
+    x     .assign(33*n, 0);
+    pc    .resize(n);
+    mask  .assign(n, 0);
+    bare  .assign(n, 0);
+    cycle .resize(n);
+    event .resize(n);
+    ram   .resize(n);
+    nactive = n;
+    for (int i=0; i<n; i++) {
+        Machine *m = new Machine(memfile);
+        m->halt          = 0;
+        m->syscall_proxy = syscall_proxy;
+        m->mhartid       = i;
+        m->console       = &output[i];
+        lane[i] = m;
+        ram [i] = m->ram.ram;
+        pc  [i] = m->r.pc;
+        sync(i);
+    }
+    ram_size  = lane[0]->ram.size;
+    mmio_base = lane[0]->mmio_base;
+    verify_code = false;
+    steps     = 0;
+    lockstep  = 0;
+    fallbacks = 0;
+}
+
+Lanes::~Lanes() {
+    for (int i=0; i<n; i++) {
+        delete lane[i];
+    }
+}
+
+void Lanes::run() {
+    while (nactive>0) {
+        step();
+    }
+}
+
+// Reload the per-lane copies of Machine state after the Machine has run.
+void Lanes::sync(int i) {
+    Machine *m = lane[i];
+    cycle[i] = m->cycle;
+    event[i] = m->next_event.load(std::memory_order_relaxed);
+    bare [i] = ((m->fetch_tlb==NULL) && (m->data_tlb==NULL) && !m->hpm_active) ? (uintx_t)-1 : 0;
+    if (m->halt) {
+        pc[i] = LANE_DONE; // never the lowest pc again
+        nactive--;
+    }
+}
+
+// One instruction of lane i on its own Machine.
+void Lanes::fallback(int i) {
+    Machine *m = lane[i];
+    for (int r=1; r<32; r++) {
+        m->reg[r] = X(r)[i];
+    }
+    m->r.pc  = pc[i];
+    m->cycle = cycle[i];
+    m->eval();
+    if ((m->ir & 0x707f)==0x100f) { // fence.i
+        verify_code = true;
+    }
+    for (int r=1; r<32; r++) {
+        X(r)[i] = m->reg[r];
+    }
+    pc[i] = m->r.pc;
+    sync(i);
+    fallbacks++;
+}
+
+// What Machine::eval() does after exec() for the lanes of the group: count
+// the instruction and call event() when its time has come.
+void Lanes::retire() {
+    uintx_t *m   = mask.data();
+    uint64_t due = 0;
+    uint64_t cnt = 0;
+    for (int i=0; i<n; i++) {
+        cycle[i] += m[i] & 1;
+        cnt      += m[i] & 1;
+        due      |= m[i] & (uintx_t)-(uintx_t)(cycle[i]>=event[i]);
+    }
+    lockstep += cnt;
+    if (!due) {
+        return;
+    }
+    for (int i=0; i<n; i++) {
+        if (m[i] && (cycle[i]>=event[i])) {
+            Machine *mc = lane[i];
+            mc->halt  = 0;
+            mc->r.pc  = pc[i];
+            mc->cycle = cycle[i];
+            mc->event();
+            pc[i]     = mc->r.pc;
+            sync(i);
+        }
+    }
+}
+
+void Lanes::step() {
+    // the group: the lanes at the lowest pc
+    uintx_t *m   = mask.data();
+    uintx_t  pc0 = LANE_DONE;
+    for (int i=0; i<n; i++) {
+        pc0 = (pc[i]<pc0) ? pc[i] : pc0;
+    }
+    uintx_t solo = 0;
+    for (int i=0; i<n; i++) {
+        m[i]  = (uintx_t)-(uintx_t)(pc[i]==pc0);
+        solo |= m[i] & ~bare[i];
+    }
+    int lead = 0;
+    while ((lead<n) && !(m[lead] & bare[lead])) {
+        lead++;
+    }
+
+    // The instruction is fetched from the first lane without translation.
+    // Lanes with translation run on their own. Code is the same in all lanes
+    // until one of them executes fence.i; from then on lanes whose code
+    // differs run on their own too.
+    uint32_t ir  = 0;
+    bool     ok  = (lead<n) && (pc0<mmio_base) && (pc0<=ram_size-4);
+    int      len = 4;
+    if (ok) {
+        memcpy(&ir, ram[lead]+pc0, 4);
+        uint32_t cmp = 0xffffffff;
+        if ((ir & 0x3)!=0b11) {
+            len = 2;
+            cmp = 0xffff;
+        }
+        for (int i=0; (solo || verify_code) && (i<n); i++) {
+            uint32_t word = ir;
+            if (m[i] && verify_code) {
+                memcpy(&word, ram[i]+pc0, 4);
+            }
+            if (m[i] && (!bare[i] || ((word ^ ir) & cmp))) {
+                m[i] = 0;
+                fallback(i);
+            }
+        }
+        ok = (len==4) || ((ir = rvc_expand(ir & 0xffff))!=0);
+    }
+    if (ok && exec(ir, pc0, len)) {
+        steps++;
+        retire();
+        return;
+    }
+    for (int i=0; i<n; i++) {
+        if (m[i]) {
+            fallback(i);
+        }
+    }
+}
+
+//------------------------------------------------------------------------------
+// Group execution
+//------------------------------------------------------------------------------
+static inline uintx_t sext32(uintx_t x) {
+    return ((intx_t)x << (XLEN-32)) >> (XLEN-32);
+}
+
+static inline uintx_t div_s(uintx_t a, uintx_t b) {
+    if (b==0) return -1;
+    if (((intx_t)a==((intx_t)1 << (XLEN-1))) && ((intx_t)b==-1)) return a;
+    return (intx_t)a / (intx_t)b;
+}
+static inline uintx_t div_u(uintx_t a, uintx_t b) { return (b==0) ? (uintx_t)-1 : a / b; }
+static inline uintx_t rem_s(uintx_t a, uintx_t b) {
+    if (b==0) return a;
+    if (((intx_t)a==((intx_t)1 << (XLEN-1))) && ((intx_t)b==-1)) return 0;
+    return (intx_t)a % (intx_t)b;
+}
+static inline uintx_t rem_u(uintx_t a, uintx_t b) { return (b==0) ? a : a % b; }
+
+#if XLEN == 64
+static inline uintx_t divw_s(uintx_t a, uintx_t b) {
+    if ((int32_t)b==0) return -1;
+    if (((int32_t)a==INT32_MIN) && ((int32_t)b==-1)) return (int32_t)a;
+    return sext32((int32_t)a / (int32_t)b);
+}
+static inline uintx_t divw_u(uintx_t a, uintx_t b) { return ((uint32_t)b==0) ? (uintx_t)-1 : sext32((uint32_t)a / (uint32_t)b); }
+static inline uintx_t remw_s(uintx_t a, uintx_t b) {
+    if ((int32_t)b==0) return a;
+    if (((int32_t)a==INT32_MIN) && ((int32_t)b==-1)) return 0;
+    return sext32((int32_t)a % (int32_t)b);
+}
+static inline uintx_t remw_u(uintx_t a, uintx_t b) { return ((uint32_t)b==0) ? a : sext32((uint32_t)a % (uint32_t)b); }
+#endif
+
+// the bits above shamt in slli/srli/srai, and their value for srai
+#if XLEN == 32
+#define SHIFT_FUNCT 25
+#define SHIFT_SRA   0x20
+#else
+#define SHIFT_FUNCT 26
+#define SHIFT_SRA   0x10
+#endif
+
+// d = expr for the lanes of the group. Written as a select over all lanes so
+// that the loop has no branches and vectorizes; a, b are the source rows.
+#define LANE_OP(expr) \
+    for (int i=0; i<n; i++) { \
+        uintx_t v = (expr); \
+        d[i] = (v & m[i]) | (d[i] & ~m[i]); \
+    }
+
+// Executes ir for the group at pc0, or returns false (and changes nothing) if
+// the lanes have to run it on their own Machines.
+bool Lanes::exec(uint32_t ir, uintx_t pc0, int len) {
+    uint8_t  opcode = (ir >> 2 ) & 0x1f;
+    uint8_t  rd     = (ir >> 7 ) & 0x1f;
+    uint8_t  funct3 = (ir >> 12) & 0x7 ;
+    uint8_t  rs1    = (ir >> 15) & 0x1f;
+    uint8_t  rs2    = (ir >> 20) & 0x1f;
+    uint8_t  funct7 = (ir >> 25) & 0x7f;
+    uintx_t  imm    = sext32((int32_t)ir >> 20);
+    uintx_t  sh     = imm & (XLEN-1);
+    uintx_t *a      = X(rs1);
+    uintx_t *b      = X(rs2);
+    uintx_t *d      = X((rd==0) ? 32 : rd);
+    uintx_t *m      = mask.data();
+    uintx_t *p      = pc.data();
+    uintx_t  next   = pc0 + len;
+
+    switch (opcode) {
+    case 0b01101: // lui
+        imm = sext32(ir & 0xfffff000);
+        LANE_OP(imm);
+        break;
+    case 0b00101: // auipc
+        imm = sext32(ir & 0xfffff000);
+        LANE_OP(pc0 + imm);
+        break;
+    case 0b00100: // op-imm
+        switch (funct3) {
+        case 0b000: LANE_OP(a[i] + imm); break;                           // addi
+        case 0b010: LANE_OP((uintx_t)((intx_t)a[i] < (intx_t)imm)); break; // slti
+        case 0b011: LANE_OP((uintx_t)(a[i] < imm)); break;                // sltiu
+        case 0b100: LANE_OP(a[i] ^ imm); break;                           // xori
+        case 0b110: LANE_OP(a[i] | imm); break;                           // ori
+        case 0b111: LANE_OP(a[i] & imm); break;                           // andi
+        case 0b001: // slli
+            if ((ir >> SHIFT_FUNCT)!=0) return false;
+            LANE_OP(a[i] << sh);
+            break;
+        case 0b101: // srli/srai
+            if ((ir >> SHIFT_FUNCT)==0) {
+                LANE_OP(a[i] >> sh);
+            } else if ((ir >> SHIFT_FUNCT)==SHIFT_SRA) {
+                LANE_OP((uintx_t)((intx_t)a[i] >> sh));
+            } else {
+                return false;
+            }
+            break;
+        }
+        break;
+    case 0b01100: // op
+        if (funct7==0x01) {
+            switch (funct3) {
+            case 0b000: LANE_OP(a[i] * b[i]); break; // mul
+            case 0b001: LANE_OP((uintx_t)(((int2x_t)(intx_t)a[i] * (int2x_t)(intx_t)b[i]) >> XLEN)); break; // mulh
+            case 0b010: LANE_OP((uintx_t)(((int2x_t)(intx_t)a[i] * (int2x_t)b[i]) >> XLEN)); break;         // mulhsu
+            case 0b011: LANE_OP((uintx_t)(((uint2x_t)a[i] * (uint2x_t)b[i]) >> XLEN)); break;                 // mulhu
+            case 0b100: LANE_OP(div_s(a[i], b[i])); break; // div
+            case 0b101: LANE_OP(div_u(a[i], b[i])); break; // divu
+            case 0b110: LANE_OP(rem_s(a[i], b[i])); break; // rem
+            case 0b111: LANE_OP(rem_u(a[i], b[i])); break; // remu
+            }
+        } else if (funct7==0x00) {
+            switch (funct3) {
+            case 0b000: LANE_OP(a[i] + b[i]); break;                              // add
+            case 0b001: LANE_OP(a[i] << (b[i] & (XLEN-1))); break;                // sll
+            case 0b010: LANE_OP((uintx_t)((intx_t)a[i] < (intx_t)b[i])); break;   // slt
+            case 0b011: LANE_OP((uintx_t)(a[i] < b[i])); break;                   // sltu
+            case 0b100: LANE_OP(a[i] ^ b[i]); break;                              // xor
+            case 0b101: LANE_OP(a[i] >> (b[i] & (XLEN-1))); break;                // srl
+            case 0b110: LANE_OP(a[i] | b[i]); break;                              // or
+            case 0b111: LANE_OP(a[i] & b[i]); break;                              // and
+            }
+        } else if (funct7==0x20) {
+            switch (funct3) {
+            case 0b000: LANE_OP(a[i] - b[i]); break;                                         // sub
+            case 0b101: LANE_OP((uintx_t)((intx_t)a[i] >> (b[i] & (XLEN-1)))); break;        // sra
+            default   : return false;
+            }
+        } else {
+            return false;
+        }
+        break;
+#if XLEN == 64
+    case 0b00110: // op-imm-32
+        switch (funct3) {
+        case 0b000: LANE_OP(sext32(a[i] + imm)); break; // addiw
+        case 0b001: // slliw
+            if (funct7!=0x00) return false;
+            LANE_OP(sext32((uint32_t)a[i] << (sh & 0x1f)));
+            break;
+        case 0b101: // srliw/sraiw
+            if (funct7==0x00) {
+                LANE_OP(sext32((uint32_t)a[i] >> (sh & 0x1f)));
+            } else if (funct7==0x20) {
+                LANE_OP(sext32((int32_t)a[i] >> (sh & 0x1f)));
+            } else {
+                return false;
+            }
+            break;
+        default:
+            return false;
+        }
+        break;
+    case 0b01110: // op-32
+        if (funct7==0x01) {
+            switch (funct3) {
+            case 0b000: LANE_OP(sext32(a[i] * b[i])); break; // mulw
+            case 0b100: LANE_OP(divw_s(a[i], b[i])); break;  // divw
+            case 0b101: LANE_OP(divw_u(a[i], b[i])); break;  // divuw
+            case 0b110: LANE_OP(remw_s(a[i], b[i])); break;  // remw
+            case 0b111: LANE_OP(remw_u(a[i], b[i])); break;  // remuw
+            default   : return false;
+            }
+        } else if ((funct7==0x00) || (funct7==0x20)) {
+            switch (funct3 | ((funct7==0x20) ? 0x8 : 0)) {
+            case 0b0000: LANE_OP(sext32(a[i] + b[i])); break;                           // addw
+            case 0b1000: LANE_OP(sext32(a[i] - b[i])); break;                           // subw
+            case 0b0001: LANE_OP(sext32((uint32_t)a[i] << (b[i] & 0x1f))); break;       // sllw
+            case 0b0101: LANE_OP(sext32((uint32_t)a[i] >> (b[i] & 0x1f))); break;       // srlw
+            case 0b1101: LANE_OP(sext32((int32_t)a[i] >> (b[i] & 0x1f))); break;        // sraw
+            default    : return false;
+            }
+        } else {
+            return false;
+        }
+        break;
+#endif
+    case 0b11000: // branch
+    {
+        imm = sext32((((int32_t)ir >> 19) & 0xfffff000) | ((ir << 4) & 0x800) | ((ir >> 20) & 0x7e0) | ((ir >> 7) & 0x1e));
+        uintx_t taken = pc0 + imm;
+        d = p;
+        switch (funct3) {
+        case 0b000: LANE_OP((a[i]==b[i]) ? taken : next); break;                    // beq
+        case 0b001: LANE_OP((a[i]!=b[i]) ? taken : next); break;                    // bne
+        case 0b100: LANE_OP(((intx_t)a[i]< (intx_t)b[i]) ? taken : next); break;   // blt
+        case 0b101: LANE_OP(((intx_t)a[i]>=(intx_t)b[i]) ? taken : next); break;   // bge
+        case 0b110: LANE_OP((a[i]< b[i]) ? taken : next); break;                    // bltu
+        case 0b111: LANE_OP((a[i]>=b[i]) ? taken : next); break;                    // bgeu
+        default   : return false;
+        }
+        return true; // pc already updated
+    }
+    case 0b11011: // jal
+        imm = sext32((((int32_t)ir >> 11) & 0xfff00000) | (ir & 0x000ff000) | ((ir >> 9) & 0x800) | ((ir >> 20) & 0x7fe));
+        LANE_OP(next);
+        d = p;
+        LANE_OP(pc0 + imm);
+        return true;
+    case 0b11001: // jalr (target first: rd may be rs1)
+        if (funct3!=0b000) return false;
+        for (int i=0; i<n; i++) {
+            if (m[i]) {
+                uintx_t target = a[i] + imm;
+                d[i] = next;
+                p[i] = target;
+            }
+        }
+        return true;
+    case 0b00000: // load
+    case 0b01000: // store
+    {
+        bool store = (opcode==0b01000);
+        bool valid = (store) ? ((funct3<=0b010) || ((XLEN==64) && (funct3==0b011)))
+                             : ((funct3!=0b111) && ((XLEN==64) || ((funct3!=0b011) && (funct3!=0b110))));
+        if (!valid) {
+            return false;
+        }
+        int sz = 1 << (funct3 & 0x3);
+        if (store) {
+            imm = sext32((((int32_t)ir >> 20) & 0xffffffe0) | ((ir >> 7) & 0x1f));
+        }
+        for (int i=0; i<n; i++) {
+            if (!m[i]) {
+                continue;
+            }
+            uintx_t addr = a[i] + imm;
+            if ((addr>=mmio_base) || (addr>ram_size-sz)) {
+                m[i] = 0;
+                fallback(i); // devices (tohost) and access faults
+                continue;
+            }
+            uint8_t *host = ram[i] + addr;
+            if (store) {
+                uint64_t data = b[i];
+                memcpy(host, &data, sz); // little-endian host
+                continue;
+            }
+            uint64_t data = 0;
+            memcpy(&data, host, sz);
+            switch (funct3) {
+            case 0b000: data = (int8_t )data; break;
+            case 0b001: data = (int16_t)data; break;
+            case 0b010: data = (int32_t)data; break;
+            }
+            d[i] = data;
+        }
+        break;
+    }
+    default:
+        return false;
+    }
+    d = p;
+    LANE_OP(next);
+    return true;
+}
+
+//------------------------------------------------------------------------------
+int Lanes::summary(std::vector<BatchResult> &results, double seconds) {
+    uint64_t instret = 0;
+    results.resize(n);
+    for (int i=0; i<n; i++) {
+        Machine *m = lane[i];
+        results[i].path      = "lane" + std::to_string(i);
+        results[i].bad_image = false;
+        results[i].exit_code = m->exit_code;
+        results[i].timeout   = (m->cycle>=TIMEOUT);
+        results[i].instret   = m->cycle + m->minstret_offset;
+        results[i].seconds   = 0;
+        results[i].console   = output[i];
+        instret             += results[i].instret;
+    }
+    int passed = batch_report(results, false);
+    printf("\n%d/%d passed, %d failed (host %.3f s, %.1f MIPS)\n",
+           passed, n, n-passed, seconds, instret / seconds / 1e6);
+    printf("lockstep: %lu groups, %.2f lanes per group, %.2f%% of instructions by Machine::eval()\n",
+           steps, (steps!=0) ? (double)lockstep / steps : 0.0,
+           100.0 * fallbacks / (lockstep + fallbacks));
+    return (passed==n) ? 0 : 1;
+}
@@ -0,0 +1,66 @@
+#if !defined(LANES_H_)
+#define LANES_H_
+
+#include <string>
+#include <vector>
+#include "rvemu.h"
+#include "batch.h"
+
+struct Machine;
+
+// --lanes N: N copies of one program (same image, mhartid = lane number)
+// executed in lockstep. The integer registers of all lanes are kept as a
+// structure of arrays, x[reg][lane], so an instruction is fetched and decoded
+// once and then applied to every lane at that pc with one loop over the lanes,
+// which the compiler turns into vector code.
+//
+// Lanes that branch differently split up. Every step runs the group of lanes
+// with the lowest pc; lanes that fell behind catch up with the others there
+// (min-pc reconvergence, as in SIMT hardware).
+//
+// Only loads/stores to RAM and the integer computational, branch and jump
+// instructions of RV32/64IMC are executed by the group. Everything else
+// (CSRs, ecall, AMOs, fence, traps, MMIO/tohost, translated addresses) is run
+// lane by lane by the lane's own Machine, so each lane still behaves exactly
+// like a standalone rvemu.
+#define LANE_DONE ((uintx_t)-1) // pc of a lane that has halted
+
+struct Lanes {
+    int      n;
+    std::vector<Machine *>   lane  ;
+    std::vector<std::string> output; // of each lane
+
+    // state of lane i, in structure-of-arrays form
+    std::vector<uintx_t>   x    ; // x[r*n + i]: register r; r==32 is the sink for x0
+    std::vector<uintx_t>   pc   ;
+    std::vector<uintx_t>   mask ; // all ones for the lanes of the current group
+    std::vector<uintx_t>   bare ; // all ones if addresses are not translated and !hpm_active
+    std::vector<uint64_t>  cycle; // Machine::cycle
+    std::vector<uint64_t>  event; // Machine::next_event
+    std::vector<uint8_t *> ram  ;
+    uint64_t ram_size ;
+    uintx_t  mmio_base;
+    bool     verify_code; // a lane has executed fence.i: its code may differ
+    int      nactive  ;
+
+    // statistics
+    uint64_t steps    ; // instructions issued to a group
+    uint64_t lockstep ; // lane-instructions executed by groups
+    uint64_t fallbacks; // lane-instructions executed by Machine::eval()
+
+    Lanes(const char *memfile, int n, bool syscall_proxy);
+    ~Lanes();
+
+    uintx_t *X(int r) { return &x[r*n]; }
+    void run ();
+    void step();
+    bool exec(uint32_t ir, uintx_t pc0, int len);
+    void retire();
+    void fallback(int i);
+    void sync    (int i);
+
+    // Per-lane outcome, in the format of --batch. Returns the exit status.
+    int  summary(std::vector<BatchResult> &results, double seconds);
+};
+
+#endif // LANES_H_
@@ -0,0 +1,591 @@
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cerrno>
+#include <ctime>
+#include <climits>
+#include <elf.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/random.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/uio.h>
+#include "machine.h"
+#include "csr.h"
+#include "loader.h"
+#include "syscall.h"
+#include "linux.h"
+
+// Linux user-mode emulation. The guest runs in U-mode with a flat address
+// space: guest virtual address == offset in RAM, nothing below it is mapped
+// by a kernel, and ecall is translated to host system calls.
+//
+//   0                  ELF image (LINUX_PIE_BASE for static-pie)
+//   brk_base..brk_max  heap (brk)
+//   brk_max..          mmap area, allocated top-down
+//   ..ram.size         stack (LINUX_STACK_SIZE)
+
+#define PAGE_ROUNDUP(x) (((x) + LINUX_PAGE_SIZE-1) & ~(uintx_t)(LINUX_PAGE_SIZE-1))
+
+static const struct {
+    int linux_flag;
+    int host_flag ;
+} open_flag_table[] = {
+    {LINUX_O_CREAT    , O_CREAT    },
+    {LINUX_O_EXCL     , O_EXCL     },
+    {LINUX_O_NOCTTY   , O_NOCTTY   },
+    {LINUX_O_TRUNC    , O_TRUNC    },
+    {LINUX_O_APPEND   , O_APPEND   },
+    {LINUX_O_NONBLOCK , O_NONBLOCK },
+    {LINUX_O_DIRECTORY, O_DIRECTORY},
+    {LINUX_O_NOFOLLOW , O_NOFOLLOW },
+    {LINUX_O_CLOEXEC  , O_CLOEXEC  },
+};
+
+static int host_open_flags(uintx_t flags) {
+    int ret = flags & LINUX_O_ACCMODE;
+    for (auto &f : open_flag_table) {
+        if (flags & f.linux_flag) ret |= f.host_flag;
+    }
+    return ret;
+}
+
+static uintx_t linux_open_flags(int flags) {
+    uintx_t ret = flags & O_ACCMODE;
+    for (auto &f : open_flag_table) {
+        if (flags & f.host_flag) ret |= f.linux_flag;
+    }
+    return ret;
+}
+
+static int host_dirfd(uintx_t dirfd) {
+    return ((intx_t)dirfd==LINUX_AT_FDCWD) ? AT_FDCWD : (int)dirfd;
+}
+
+static void put_timespec(uint8_t *p, uint64_t nsec) {
+    put_uint(p+0, nsec / 1000000000, 8);
+    put_uint(p+8, nsec % 1000000000, 8);
+}
+
+static void put_str(uint8_t *p, const char *str, int len) {
+    memset(p, 0, len);
+    strncpy((char *)p, str, len-1);
+}
+
+//------------------------------------------------------------------------------
+// Process setup
+//------------------------------------------------------------------------------
+Machine::Machine(int argc, char **argv, char **envp) {
+#if XLEN == 32
+    fprintf(stderr, "Error: Linux user mode requires rvemu64.\n");
+    exit(0);
+#endif
+    clint  = new CLINT;
+    smp    = new SMP(this);
+    hartid = 0;
+    ram.resize(LINUX_MEMSIZE);
+
+    ElfInfo info;
+    if (!is_elf(argv[0])) {
+        fprintf(stderr, "Error: %s is not an ELF file.\n", argv[0]);
+        exit(0);
+    }
+    load_elf(ram, argv[0], info, true, LINUX_PIE_BASE);
+    reset(info.entry);
+
+    char *path = realpath(argv[0], NULL);
+    exe = (path!=NULL) ? path : argv[0];
+    free(path);
+
+    // U-mode process with no devices; time/cycle/instret stay readable
+    priv          = PRV_U;
+    mcounteren    = COUNTEREN_CY | COUNTEREN_TM | COUNTEREN_IR;
+    scounteren    = COUNTEREN_CY | COUNTEREN_TM | COUNTEREN_IR;
+    mmio_base     = (uintx_t)-1;
+    syscall_proxy = true;
+    linux_user    = true;
+    update_vm();
+    schedule();
+
+    uintx_t stack_top = ram.size;
+    uintx_t stack_end = stack_top - LINUX_STACK_SIZE;
+    brk_base = PAGE_ROUNDUP(info.end);
+    brk      = brk_base;
+    brk_max  = PAGE_ROUNDUP(brk_base + (stack_end - brk_base) / 4);
+    mmap_free.clear();
+    mmap_free[brk_max] = stack_end;
+
+    // Initial stack, from the top: strings, AT_RANDOM bytes, then (16-byte
+    // aligned) argc, argv[], NULL, envp[], NULL, auxv[], AT_NULL.
+    uintx_t sp = stack_top;
+    auto push_bytes = [&](const void *data, uintx_t len) {
+        sp -= len;
+        memcpy(ram.ptr(sp, len), data, len);
+        return sp;
+    };
+    int envc = 0;
+    while (envp[envc]!=NULL) {
+        envc++;
+    }
+    uintx_t execfn = push_bytes(exe.c_str(), exe.size()+1);
+    uintx_t *argv_addr = new uintx_t[argc];
+    uintx_t *envp_addr = new uintx_t[envc];
+    for (int i=envc-1; i>=0; i--) {
+        envp_addr[i] = push_bytes(envp[i], strlen(envp[i])+1);
+    }
+    for (int i=argc-1; i>=0; i--) {
+        argv_addr[i] = push_bytes(argv[i], strlen(argv[i])+1);
+    }
+    // fixed rather than host-random, so runs are reproducible
+    static const uint8_t random_bytes[16] = {
+        0x72, 0x76, 0x65, 0x6d, 0x75, 0x2d, 0x72, 0x61,
+        0x6e, 0x64, 0x6f, 0x6d, 0x2d, 0x73, 0x65, 0x65,
+    };
+    uintx_t random = push_bytes(random_bytes, sizeof(random_bytes));
+
+    uintx_t hwcap = 0;
+    for (char c : {'I', 'M', 'A', 'F', 'D', 'C', 'V'}) {
+        hwcap |= misa & MISA_EXT(c);
+    }
+    const uintx_t auxv[][2] = {
+        {AT_PHDR  , info.phdr       },
+        {AT_PHENT , info.phent      },
+        {AT_PHNUM , info.phnum      },
+        {AT_PAGESZ, LINUX_PAGE_SIZE },
+        {AT_BASE  , 0               },
+        {AT_FLAGS , 0               },
+        {AT_ENTRY , info.entry      },
+        {AT_UID   , getuid()        },
+        {AT_EUID  , geteuid()       },
+        {AT_GID   , getgid()        },
+        {AT_EGID  , getegid()       },
+        {AT_HWCAP , hwcap           },
+        {AT_CLKTCK, 100             },
+        {AT_RANDOM, random          },
+        {AT_SECURE, 0               },
+        {AT_EXECFN, execfn          },
+        {AT_NULL  , 0               },
+    };
+    int words = 1 + (argc+1) + (envc+1) + 2*(sizeof(auxv)/sizeof(auxv[0]));
+    sp = (sp - words*sizeof(uintx_t)) & ~(uintx_t)0xf;
+    uintx_t p = sp;
+    auto push_word = [&](uintx_t data) {
+        put_uint(ram.ptr(p, sizeof(uintx_t)), data, sizeof(uintx_t));
+        p += sizeof(uintx_t);
+    };
+    push_word(argc);
+    for (int i=0; i<argc; i++) push_word(argv_addr[i]);
+    push_word(0);
+    for (int i=0; i<envc; i++) push_word(envp_addr[i]);
+    push_word(0);
+    for (auto &a : auxv) {
+        push_word(a[0]);
+        push_word(a[1]);
+    }
+    delete[] argv_addr;
+    delete[] envp_addr;
+
+    reg[2] = sp;
+}
+
+//------------------------------------------------------------------------------
+// Address space
+//------------------------------------------------------------------------------
+// Allocate [addr, addr+len) from the mmap area. Without MAP_FIXED the highest
+// free range that fits is used. Pages returned to the free map are always
+// zero, so only MAP_FIXED over live pages needs clearing.
+uintx_t Machine::linux_mmap(uintx_t addr, uintx_t len, int flags, int fd, uintx_t offset) {
+    len = PAGE_ROUNDUP(len);
+    if ((len==0) || (addr & (LINUX_PAGE_SIZE-1))) {
+        return -EINVAL;
+    }
+    if (flags & LINUX_MAP_FIXED) {
+        if (ram.ptr(addr, len)==NULL) {
+            return -ENOMEM;
+        }
+        linux_munmap(addr, len);
+    } else {
+        addr = 0;
+        for (auto it=mmap_free.rbegin(); it!=mmap_free.rend(); ++it) {
+            if (it->second - it->first >= len) {
+                addr = it->second - len;
+                break;
+            }
+        }
+        if (addr==0) {
+            return -ENOMEM;
+        }
+    }
+
+    // carve [addr, addr+len) out of the free ranges
+    uintx_t end = addr + len;
+    auto it = mmap_free.upper_bound(addr);
+    if (it!=mmap_free.begin()) {
+        --it;
+    }
+    while ((it!=mmap_free.end()) && (it->first<end)) {
+        uintx_t s = it->first;
+        uintx_t e = it->second;
+        if (e<=addr) {
+            ++it;
+            continue;
+        }
+        it = mmap_free.erase(it);
+        if (s<addr) mmap_free[s]   = addr;
+        if (e>end ) mmap_free[end] = e;
+    }
+
+    if (!(flags & LINUX_MAP_ANONYMOUS)) {
+        // private copy of the file; writes are not carried back to it
+        if (pread(fd, ram.ptr(addr, len), len, offset)==-1) {
+            intx_t ret = -errno;
+            linux_munmap(addr, len);
+            return ret;
+        }
+    }
+    return addr;
+}
+
+int Machine::linux_munmap(uintx_t addr, uintx_t len) {
+    len = PAGE_ROUNDUP(len);
+    if ((addr & (LINUX_PAGE_SIZE-1)) || (ram.ptr(addr, len)==NULL)) {
+        return -EINVAL;
+    }
+    uint8_t *p = ram.ptr(addr, len);
+    if (madvise(p, len, MADV_DONTNEED)!=0) {
+        memset(p, 0, len);
+    }
+
+    // only the mmap area goes back to the free map
+    uintx_t start = (addr     > brk_max) ? addr     : brk_max;
+    uintx_t end   = (addr+len < ram.size - LINUX_STACK_SIZE) ? addr+len : ram.size - LINUX_STACK_SIZE;
+    if (start>=end) {
+        return 0;
+    }
+    auto it = mmap_free.upper_bound(start);
+    if (it!=mmap_free.begin()) {
+        --it;
+    }
+    while ((it!=mmap_free.end()) && (it->first<=end)) {
+        if (it->second>=start) {
+            if (it->first <start) start = it->first ;
+            if (it->second>end  ) end   = it->second;
+            it = mmap_free.erase(it);
+        } else {
+            ++it;
+        }
+    }
+    mmap_free[start] = end;
+    return 0;
+}
+
+//------------------------------------------------------------------------------
+// System calls
+//------------------------------------------------------------------------------
+// a7: syscall number, a0-a5: arguments, a0: return value (-errno on error)
+void Machine::linux_syscall() {
+    uintx_t  num = reg[17];
+    uintx_t  a0  = reg[10];
+    uintx_t  a1  = reg[11];
+    uintx_t  a2  = reg[12];
+    uintx_t  a3  = reg[13];
+    uintx_t  a4  = reg[14];
+    uintx_t  a5  = reg[15];
+    intx_t   ret;
+    uint8_t     *p;
+    const char  *path;
+    struct stat  st;
+    struct timespec ts;
+    struct iovec    iov[IOV_MAX];
+    uint64_t     nsec, usec;
+    uintx_t      sig;
+
+    switch (num) {
+    //--------------------------------------------------------------------------
+    // Files
+    case LINUX_SYS_openat:
+        if ((path = guest_str(ram, a1))==NULL) { ret = -EFAULT; break; }
+        ret = openat(host_dirfd(a0), path, host_open_flags(a2), a3);
+        break;
+    case LINUX_SYS_close:
+        // the emulator's own stdin/stdout/stderr stay open
+        ret = (a0<=2) ? 0 : close(a0);
+        break;
+    case LINUX_SYS_read:
+        if ((p = ram.ptr(a1, a2))==NULL) { ret = -EFAULT; break; }
+        ret = read(a0, p, a2);
+        break;
+    case LINUX_SYS_write:
+        if ((p = ram.ptr(a1, a2))==NULL) { ret = -EFAULT; break; }
+        ret = write(a0, p, a2);
+        break;
+    case LINUX_SYS_readv:
+    case LINUX_SYS_writev:
+        // struct iovec {void *iov_base; size_t iov_len;}
+        if ((a2>IOV_MAX) || ((p = ram.ptr(a1, a2*16))==NULL)) { ret = (a2>IOV_MAX) ? -EINVAL : -EFAULT; break; }
+        ret = 0;
+        for (uintx_t i=0; i<a2; i++) {
+            uint64_t base, len;
+            memcpy(&base, p+16*i+0, 8);
+            memcpy(&len , p+16*i+8, 8);
+            if ((iov[i].iov_base = ram.ptr(base, len))==NULL) { ret = -EFAULT; break; }
+            iov[i].iov_len = len;
+        }
+        if (ret!=0) break;
+        ret = (num==LINUX_SYS_readv) ? readv(a0, iov, a2) : writev(a0, iov, a2);
+        break;
+    case LINUX_SYS_pread64:
+        if ((p = ram.ptr(a1, a2))==NULL) { ret = -EFAULT; break; }
+        ret = pread(a0, p, a2, a3);
+        break;
+    case LINUX_SYS_pwrite64:
+        if ((p = ram.ptr(a1, a2))==NULL) { ret = -EFAULT; break; }
+        ret = pwrite(a0, p, a2, a3);
+        break;
+    case LINUX_SYS_lseek:
+        ret = lseek(a0, (intx_t)a1, a2);
+        break;
+    case LINUX_SYS_fstat:
+        if ((p = ram.ptr(a1, 128))==NULL) { ret = -EFAULT; break; }
+        if ((ret = fstat(a0, &st))==0) put_stat(p, st);
+        break;
+    case LINUX_SYS_newfstatat:
+        if (((path = guest_str(ram, a1))==NULL) || ((p = ram.ptr(a2, 128))==NULL)) { ret = -EFAULT; break; }
+        ret = fstatat(host_dirfd(a0), path, &st,
+                      ((a3 & LINUX_AT_SYMLINK_NOFOLLOW) ? AT_SYMLINK_NOFOLLOW : 0) |
+                      ((a3 & LINUX_AT_EMPTY_PATH      ) ? AT_EMPTY_PATH       : 0));
+        if (ret==0) put_stat(p, st);
+        break;
+    case LINUX_SYS_getdents64:
+        // struct linux_dirent64 is the same on the host
+        if ((p = ram.ptr(a1, a2))==NULL) { ret = -EFAULT; break; }
+        ret = getdents64(a0, p, a2);
+        break;
+    case LINUX_SYS_readlinkat:
+        if (((path = guest_str(ram, a1))==NULL) || ((p = ram.ptr(a2, a3))==NULL)) { ret = -EFAULT; break; }
+        if (strcmp(path, "/proc/self/exe")==0) {
+            ret = (exe.size() < a3) ? exe.size() : a3;
+            memcpy(p, exe.c_str(), ret);
+        } else {
+            ret = readlinkat(host_dirfd(a0), path, (char *)p, a3);
+        }
+        break;
+    case LINUX_SYS_faccessat:
+        if ((path = guest_str(ram, a1))==NULL) { ret = -EFAULT; break; }
+        ret = faccessat(host_dirfd(a0), path, a2, 0);
+        break;
+    case LINUX_SYS_mkdirat:
+        if ((path = guest_str(ram, a1))==NULL) { ret = -EFAULT; break; }
+        ret = mkdirat(host_dirfd(a0), path, a2);
+        break;
+    case LINUX_SYS_unlinkat:
+        if ((path = guest_str(ram, a1))==NULL) { ret = -EFAULT; break; }
+        ret = unlinkat(host_dirfd(a0), path, (a2 & LINUX_AT_REMOVEDIR) ? AT_REMOVEDIR : 0);
+        break;
+    case LINUX_SYS_chdir:
+        if ((path = guest_str(ram, a0))==NULL) { ret = -EFAULT; break; }
+        ret = chdir(path);
+        break;
+    case LINUX_SYS_getcwd:
+        if ((p = ram.ptr(a0, a1))==NULL) { ret = -EFAULT; break; }
+        ret = (getcwd((char *)p, a1)==NULL) ? -1 : (intx_t)strlen((char *)p)+1;
+        break;
+    case LINUX_SYS_dup:
+        ret = dup(a0);
+        break;
+    case LINUX_SYS_dup3:
+        ret = dup3(a0, a1, host_open_flags(a2 & LINUX_O_CLOEXEC));
+        break;
+    case LINUX_SYS_fcntl:
+        switch (a1) {
+        case F_DUPFD: case F_DUPFD_CLOEXEC: case F_GETFD: case F_SETFD:
+            ret = fcntl(a0, a1, (int)a2);
+            break;
+        case F_GETFL:
+            ret = fcntl(a0, F_GETFL);
+            if (ret!=-1) ret = linux_open_flags(ret);
+            break;
+        case F_SETFL:
+            ret = fcntl(a0, F_SETFL, host_open_flags(a2));
+            break;
+        default:
+            ret = -EINVAL;
+            break;
+        }
+        break;
+    case LINUX_SYS_ioctl:
+        // terminal queries only, so that isatty() and line buffering work
+        if      (a1==LINUX_TCGETS    ) { if ((p = ram.ptr(a2, 36))==NULL) { ret = -EFAULT; break; } ret = ioctl(a0, TCGETS    , p); }
+        else if (a1==LINUX_TIOCGWINSZ) { if ((p = ram.ptr(a2,  8))==NULL) { ret = -EFAULT; break; } ret = ioctl(a0, TIOCGWINSZ, p); }
+        else                           { ret = -ENOTTY; }
+        break;
+    case LINUX_SYS_umask:
+        ret = umask(a0);
+        break;
+
+    //--------------------------------------------------------------------------
+    // Process
+    case LINUX_SYS_exit:
+    case LINUX_SYS_exit_group:
+        exit_code = a0 & 0xff;
+        halt      = 1;
+        ret       = 0;
+        break;
+    case LINUX_SYS_kill:
+    case LINUX_SYS_tkill:
+    case LINUX_SYS_tgkill:
+        // there is one process with one thread; any signal to it is fatal
+        sig = (num==LINUX_SYS_tgkill) ? a2 : a1;
+        ret = 0;
+        if (sig==0) break;
+        fprintf(stderr, "Error: guest killed by signal %ld\n", (uint64_t)sig);
+        exit_code = 128 + sig;
+        halt      = 1;
+        break;
+    case LINUX_SYS_getpid:
+    case LINUX_SYS_gettid:
+    case LINUX_SYS_set_tid_address:
+        ret = 1;
+        break;
+    case LINUX_SYS_getppid: ret = 0        ; break;
+    case LINUX_SYS_getuid : ret = getuid() ; break;
+    case LINUX_SYS_geteuid: ret = geteuid(); break;
+    case LINUX_SYS_getgid : ret = getgid() ; break;
+    case LINUX_SYS_getegid: ret = getegid(); break;
+    case LINUX_SYS_set_robust_list:
+    case LINUX_SYS_futex:
+    case LINUX_SYS_sched_yield:
+    case LINUX_SYS_sigaltstack:
+    case LINUX_SYS_riscv_flush_icache:
+        ret = 0;
+        break;
+    case LINUX_SYS_rt_sigaction:
+        // handlers are accepted but never called
+        if ((a2!=0) && ((p = ram.ptr(a2, 24))!=NULL)) memset(p, 0, 24);
+        ret = 0;
+        break;
+    case LINUX_SYS_rt_sigprocmask:
+        if ((a2!=0) && ((p = ram.ptr(a2, 8))!=NULL)) memset(p, 0, 8);
+        ret = 0;
+        break;
+    case LINUX_SYS_sched_getaffinity:
+        if ((a1<8) || ((p = ram.ptr(a2, 8))==NULL)) { ret = -EINVAL; break; }
+        put_uint(p, 1, 8); // hart 0
+        ret = 8;
+        break;
+    case LINUX_SYS_prlimit64:
+        // struct rlimit64 {rlim_cur; rlim_max;}
+        if ((a3!=0) && ((p = ram.ptr(a3, 16))!=NULL)) {
+            uint64_t lim = (a1==LINUX_RLIMIT_STACK) ? LINUX_STACK_SIZE : ~0ULL;
+            put_uint(p+0, lim, 8);
+            put_uint(p+8, lim, 8);
+        }
+        ret = 0;
+        break;
+    case LINUX_SYS_uname:
+        // struct new_utsname: six 65-byte strings
+        if ((p = ram.ptr(a0, 6*65))==NULL) { ret = -EFAULT; break; }
+        put_str(p+0*65, "Linux"  , 65);
+        put_str(p+1*65, "rvemu"  , 65);
+        put_str(p+2*65, "6.1.0"  , 65);
+        put_str(p+3*65, "#1"     , 65);
+        put_str(p+4*65, "riscv64", 65);
+        put_str(p+5*65, ""       , 65);
+        ret = 0;
+        break;
+    case LINUX_SYS_sysinfo:
+        if ((p = ram.ptr(a0, 112))==NULL) { ret = -EFAULT; break; }
+        memset(p, 0, 112);
+        put_uint(p+  0, clint->mtime(cycle) / MTIME_FREQ, 8); // uptime
+        put_uint(p+ 32, ram.size                      , 8); // totalram
+        put_uint(p+ 40, ram.size - brk_max            , 8); // freeram
+        put_uint(p+ 80, 1                             , 2); // procs
+        put_uint(p+104, 1                             , 4); // mem_unit
+        ret = 0;
+        break;
+    case LINUX_SYS_getrusage:
+        if ((p = ram.ptr(a1, 144))==NULL) { ret = -EFAULT; break; }
+        memset(p, 0, 144);
+        usec = (uint64_t)((uint128_t)clint->mtime(cycle) * 1000000 / MTIME_FREQ);
+        put_uint(p+0, usec / 1000000, 8); // ru_utime
+        put_uint(p+8, usec % 1000000, 8);
+        ret = 0;
+        break;
+
+    //--------------------------------------------------------------------------
+    // Memory
+    case LINUX_SYS_brk:
+        if ((a0>=brk_base) && (a0<=brk_max)) {
+            if (a0<brk) memset(ram.ptr(a0, brk-a0), 0, brk-a0); // grows back zeroed
+            brk = a0;
+        }
+        ret = brk;
+        break;
+    case LINUX_SYS_mmap:
+        ret = linux_mmap(a0, a1, a3, a4, a5);
+        break;
+    case LINUX_SYS_munmap:
+        ret = linux_munmap(a0, a1);
+        break;
+    case LINUX_SYS_mremap:
+        ret = -ENOMEM; // callers fall back to mmap+copy
+        break;
+    case LINUX_SYS_mprotect:
+    case LINUX_SYS_madvise:
+        ret = 0;
+        break;
+
+    //--------------------------------------------------------------------------
+    // Time: the wall clock is the host's, every other clock is virtual time
+    // so that measurements agree with rdtime.
+    case LINUX_SYS_clock_gettime:
+        if ((p = ram.ptr(a1, 16))==NULL) { ret = -EFAULT; break; }
+        if (a0==LINUX_CLOCK_REALTIME) {
+            clock_gettime(CLOCK_REALTIME, &ts);
+            nsec = (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+        } else {
+            nsec = (uint64_t)((uint128_t)clint->mtime(cycle) * 1000000000 / MTIME_FREQ);
+        }
+        put_timespec(p, nsec);
+        ret = 0;
+        break;
+    case LINUX_SYS_clock_getres:
+        if ((a1!=0) && ((p = ram.ptr(a1, 16))!=NULL)) put_timespec(p, 1);
+        ret = 0;
+        break;
+    case LINUX_SYS_gettimeofday:
+        if ((p = ram.ptr(a0, 16))==NULL) { ret = -EFAULT; break; }
+        clock_gettime(CLOCK_REALTIME, &ts);
+        put_uint(p+0, ts.tv_sec        , 8);
+        put_uint(p+8, ts.tv_nsec / 1000, 8);
+        ret = 0;
+        break;
+    case LINUX_SYS_nanosleep:
+    case LINUX_SYS_clock_nanosleep:
+        ret = 0; // nothing else runs, so sleeping is a no-op
+        break;
+
+    //--------------------------------------------------------------------------
+    case LINUX_SYS_getrandom:
+        if ((p = ram.ptr(a0, a1))==NULL) { ret = -EFAULT; break; }
+        ret = getrandom(p, a1, 0);
+        break;
+    case LINUX_SYS_riscv_hwprobe:
+    case LINUX_SYS_statx:
+    case LINUX_SYS_rseq:
+        ret = -ENOSYS; // libc falls back to older interfaces
+        break;
+    default:
+        fprintf(stderr, "Warning: unsupported syscall %ld\n", (uint64_t)num);
+        ret = -ENOSYS;
+        break;
+    }
+    if (ret==-1) {
+        ret = -errno;
+    }
+    reg[10] = ret;
+}
@@ -0,0 +1,100 @@
+#if !defined(LINUX_H_)
+#define LINUX_H_
+
+//------------------------------------------------------------------------------
+// Linux system call numbers (asm-generic, riscv64)
+//------------------------------------------------------------------------------
+#define LINUX_SYS_getcwd             17
+#define LINUX_SYS_dup                23
+#define LINUX_SYS_dup3               24
+#define LINUX_SYS_fcntl              25
+#define LINUX_SYS_ioctl              29
+#define LINUX_SYS_mkdirat            34
+#define LINUX_SYS_unlinkat           35
+#define LINUX_SYS_faccessat          48
+#define LINUX_SYS_chdir              49
+#define LINUX_SYS_openat             56
+#define LINUX_SYS_close              57
+#define LINUX_SYS_getdents64         61
+#define LINUX_SYS_lseek              62
+#define LINUX_SYS_read               63
+#define LINUX_SYS_write              64
+#define LINUX_SYS_readv              65
+#define LINUX_SYS_writev             66
+#define LINUX_SYS_pread64            67
+#define LINUX_SYS_pwrite64           68
+#define LINUX_SYS_readlinkat         78
+#define LINUX_SYS_newfstatat         79
+#define LINUX_SYS_fstat              80
+#define LINUX_SYS_exit               93
+#define LINUX_SYS_exit_group         94
+#define LINUX_SYS_set_tid_address    96
+#define LINUX_SYS_futex              98
+#define LINUX_SYS_set_robust_list    99
+#define LINUX_SYS_nanosleep          101
+#define LINUX_SYS_clock_gettime      113
+#define LINUX_SYS_clock_getres       114
+#define LINUX_SYS_clock_nanosleep    115
+#define LINUX_SYS_sched_getaffinity  123
+#define LINUX_SYS_sched_yield        124
+#define LINUX_SYS_kill               129
+#define LINUX_SYS_tkill              130
+#define LINUX_SYS_tgkill             131
+#define LINUX_SYS_sigaltstack        132
+#define LINUX_SYS_rt_sigaction       134
+#define LINUX_SYS_rt_sigprocmask     135
+#define LINUX_SYS_uname              160
+#define LINUX_SYS_getrusage          165
+#define LINUX_SYS_umask              166
+#define LINUX_SYS_gettimeofday       169
+#define LINUX_SYS_getpid             172
+#define LINUX_SYS_getppid            173
+#define LINUX_SYS_getuid             174
+#define LINUX_SYS_geteuid            175
+#define LINUX_SYS_getgid             176
+#define LINUX_SYS_getegid            177
+#define LINUX_SYS_gettid             178
+#define LINUX_SYS_sysinfo            179
+#define LINUX_SYS_brk                214
+#define LINUX_SYS_munmap             215
+#define LINUX_SYS_mremap             216
+#define LINUX_SYS_mmap               222
+#define LINUX_SYS_mprotect           226
+#define LINUX_SYS_madvise            233
+#define LINUX_SYS_riscv_hwprobe      258
+#define LINUX_SYS_riscv_flush_icache 259
+#define LINUX_SYS_prlimit64          261
+#define LINUX_SYS_getrandom          278
+#define LINUX_SYS_statx              291
+#define LINUX_SYS_rseq               293
+
+//------------------------------------------------------------------------------
+// Flags (asm-generic)
+//------------------------------------------------------------------------------
+#define LINUX_O_ACCMODE      00000003
+#define LINUX_O_CREAT        00000100
+#define LINUX_O_EXCL         00000200
+#define LINUX_O_NOCTTY       00000400
+#define LINUX_O_TRUNC        00001000
+#define LINUX_O_APPEND       00002000
+#define LINUX_O_NONBLOCK     00004000
+#define LINUX_O_DIRECTORY    00200000
+#define LINUX_O_NOFOLLOW     00400000
+#define LINUX_O_CLOEXEC      02000000
+
+#define LINUX_AT_FDCWD       -100
+#define LINUX_AT_SYMLINK_NOFOLLOW 0x100
+#define LINUX_AT_REMOVEDIR   0x200
+#define LINUX_AT_EMPTY_PATH  0x1000
+
+#define LINUX_MAP_FIXED      0x10
+#define LINUX_MAP_ANONYMOUS  0x20
+
+#define LINUX_CLOCK_REALTIME 0
+
+#define LINUX_RLIMIT_STACK   3
+
+#define LINUX_TCGETS         0x5401
+#define LINUX_TIOCGWINSZ     0x5413
+
+#endif // LINUX_H_
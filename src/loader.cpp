@@ -0,0 +1,211 @@
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <algorithm>
+#include <elf.h>
+#include "loader.h"
+
+#if   XLEN == 32
+typedef Elf32_Ehdr Elf_Ehdr;
+typedef Elf32_Phdr Elf_Phdr;
+typedef Elf32_Shdr Elf_Shdr;
+typedef Elf32_Sym  Elf_Sym ;
+#define ELF_ST_TYPE ELF32_ST_TYPE
+#define ELF_ST_BIND ELF32_ST_BIND
+#define ELFCLASS   ELFCLASS32
+#else
+typedef Elf64_Ehdr Elf_Ehdr;
+typedef Elf64_Phdr Elf_Phdr;
+typedef Elf64_Shdr Elf_Shdr;
+typedef Elf64_Sym  Elf_Sym ;
+#define ELF_ST_TYPE ELF64_ST_TYPE
+#define ELF_ST_BIND ELF64_ST_BIND
+#define ELFCLASS   ELFCLASS64
+#endif
+
+bool is_elf(const char *filename) {
+    FILE *fp;
+    unsigned char magic[SELFMAG];
+
+    if ((fp = fopen(filename, "rb"))==NULL) {
+        return false;
+    }
+    bool ret = (fread(magic, 1, SELFMAG, fp)==SELFMAG) && (memcmp(magic, ELFMAG, SELFMAG)==0);
+    fclose(fp);
+    return ret;
+}
+
+bool image_ok(const char *filename, uint64_t ram_size) {
+    FILE *fp;
+    if ((fp = fopen(filename, "rb"))==NULL) {
+        return false;
+    }
+    bool ok = true;
+    if (!is_elf(filename)) {
+        // readmem() pads the image to a word
+        ok = (fseek(fp, 0, SEEK_END)==0) && (ftell(fp)>=0) && ((((uint64_t)ftell(fp) + 3) & ~(uint64_t)3)<=ram_size);
+        fclose(fp);
+        return ok;
+    }
+    Elf_Ehdr ehdr;
+    Elf_Phdr phdr;
+    ok = (fread(&ehdr, sizeof(ehdr), 1, fp)==1) && (ehdr.e_ident[EI_CLASS]==ELFCLASS) && (ehdr.e_machine==EM_RISCV);
+    for (int i=0; ok && (i<ehdr.e_phnum); i++) {
+        ok = (fseek(fp, ehdr.e_phoff + i*ehdr.e_phentsize, SEEK_SET)==0) && (fread(&phdr, sizeof(phdr), 1, fp)==1);
+        if (ok && (phdr.p_type==PT_LOAD)) {
+            ok = (phdr.p_paddr<=ram_size) && (phdr.p_memsz<=ram_size-phdr.p_paddr) && (phdr.p_filesz<=phdr.p_memsz) &&
+                 (fseek(fp, 0, SEEK_END)==0) && (phdr.p_offset + phdr.p_filesz<=(uint64_t)ftell(fp));
+        }
+    }
+    fclose(fp);
+    return ok;
+}
+
+void load_elf(RAM &ram, const char *filename, ElfInfo &info, bool virt, uintx_t bias) {
+    FILE     *fp;
+    Elf_Ehdr  ehdr;
+    Elf_Phdr  phdr;
+
+    // open
+    if ((fp = fopen(filename, "rb"))==NULL) {
+        fprintf(stderr, "Error: elf file (%s) cannot be found.\n", filename);
+        exit(0);
+    }
+
+    // check header
+    if ((fread(&ehdr, sizeof(ehdr), 1, fp)!=1) ||
+        (ehdr.e_ident[EI_CLASS]!=ELFCLASS) || (ehdr.e_machine!=EM_RISCV)) {
+        fprintf(stderr, "Error: %s is not a RV%d ELF file.\n", filename, XLEN);
+        exit(0);
+    }
+
+    if (!virt || (ehdr.e_type!=ET_DYN)) {
+        bias = 0;
+    }
+
+    // load PT_LOAD segments, zero-filling .bss
+    info.entry = ehdr.e_entry + bias;
+    info.end   = 0;
+    info.phdr  = 0;
+    info.phent = ehdr.e_phentsize;
+    info.phnum = ehdr.e_phnum;
+    for (int i=0; i<ehdr.e_phnum; i++) {
+        if ((fseek(fp, ehdr.e_phoff + i*ehdr.e_phentsize, SEEK_SET)!=0) ||
+            (fread(&phdr, sizeof(phdr), 1, fp)!=1)) {
+            fprintf(stderr, "Error: elf program header of %s cannot be read.\n", filename);
+            exit(0);
+        }
+        if (virt && (phdr.p_type==PT_INTERP)) {
+            fprintf(stderr, "Error: %s is dynamically linked; only static executables are supported.\n", filename);
+            exit(0);
+        }
+        if (phdr.p_type==PT_PHDR) {
+            info.phdr = phdr.p_vaddr + bias;
+        }
+        if (phdr.p_type!=PT_LOAD) {
+            continue;
+        }
+        uintx_t addr = (virt) ? phdr.p_vaddr + bias : phdr.p_paddr;
+        if ((info.phdr==0) && (phdr.p_offset==0)) {
+            info.phdr = addr + ehdr.e_phoff; // headers are part of the first segment
+        }
+        if (phdr.p_filesz>phdr.p_memsz) {
+            fprintf(stderr, "Error: elf segment of %s has more file than memory bytes.\n", filename);
+            exit(0);
+        }
+        // in RAM as a whole, so neither the read nor the .bss fill can run past it
+        uint8_t *p = ram.ptr(addr, phdr.p_memsz);
+        if (p==NULL) {
+            fprintf(stderr, "Error: elf segment (0x%08lx-0x%08lx) is out of range.\n",
+                    (uint64_t)addr, (uint64_t)(addr + phdr.p_memsz));
+            exit(0);
+        }
+        if ((fseek(fp, phdr.p_offset, SEEK_SET)!=0) ||
+            (fread(p, 1, phdr.p_filesz, fp)!=phdr.p_filesz)) {
+            fprintf(stderr, "Error: elf segment of %s cannot be read.\n", filename);
+            exit(0);
+        }
+        memset(p + phdr.p_filesz, 0, phdr.p_memsz - phdr.p_filesz);
+        if (addr + phdr.p_memsz > info.end) {
+            info.end = addr + phdr.p_memsz;
+        }
+    }
+
+    // close
+    fclose(fp);
+}
+
+bool load_symbols(const char *filename, std::vector<Symbol> &syms, uintx_t bias) {
+    FILE     *fp;
+    Elf_Ehdr  ehdr;
+    Elf_Shdr  symtab, strtab;
+
+    if ((fp = fopen(filename, "rb"))==NULL) {
+        return false;
+    }
+    if ((fread(&ehdr, sizeof(ehdr), 1, fp)!=1) || (ehdr.e_ident[EI_CLASS]!=ELFCLASS)) {
+        fclose(fp);
+        return false;
+    }
+    if (ehdr.e_type!=ET_DYN) {
+        bias = 0;
+    }
+
+    // .symtab and the string table it links to
+    bool found = false;
+    for (int i=0; (i<ehdr.e_shnum) && !found; i++) {
+        found = (fseek(fp, ehdr.e_shoff + i*ehdr.e_shentsize, SEEK_SET)==0) &&
+                (fread(&symtab, sizeof(symtab), 1, fp)==1) && (symtab.sh_type==SHT_SYMTAB);
+    }
+    if (!found ||
+        (fseek(fp, ehdr.e_shoff + symtab.sh_link*ehdr.e_shentsize, SEEK_SET)!=0) ||
+        (fread(&strtab, sizeof(strtab), 1, fp)!=1)) {
+        fclose(fp);
+        return false;
+    }
+    std::vector<char> str(strtab.sh_size + 1, 0);
+    if ((fseek(fp, strtab.sh_offset, SEEK_SET)!=0) ||
+        (fread(str.data(), 1, strtab.sh_size, fp)!=strtab.sh_size)) {
+        fclose(fp);
+        return false;
+    }
+
+    Elf_Sym sym;
+    for (uint64_t off=0; off+sizeof(sym)<=symtab.sh_size; off+=sizeof(sym)) {
+        if ((fseek(fp, symtab.sh_offset + off, SEEK_SET)!=0) || (fread(&sym, sizeof(sym), 1, fp)!=1)) {
+            break;
+        }
+        int type = ELF_ST_TYPE(sym.st_info);
+        int bind = ELF_ST_BIND(sym.st_info);
+        if ((sym.st_shndx==SHN_UNDEF) || (sym.st_shndx>=SHN_LORESERVE) || (sym.st_name>=strtab.sh_size)) {
+            continue;
+        }
+        if ((type==STT_FUNC) || ((type==STT_NOTYPE) && (bind==STB_GLOBAL))) {
+            syms.push_back({(uintx_t)(sym.st_value + bias), (uintx_t)sym.st_size, &str[sym.st_name]});
+        }
+    }
+    fclose(fp);
+
+    // one name per address, preferring one with a size
+    std::sort(syms.begin(), syms.end(), [](const Symbol &a, const Symbol &b) {
+        return (a.addr<b.addr) || ((a.addr==b.addr) && (a.size>b.size));
+    });
+    syms.erase(std::unique(syms.begin(), syms.end(), [](const Symbol &a, const Symbol &b) {
+        return a.addr==b.addr;
+    }), syms.end());
+    return true;
+}
+
+int find_symbol(const std::vector<Symbol> &syms, uintx_t pc) {
+    auto it = std::upper_bound(syms.begin(), syms.end(), pc, [](uintx_t pc, const Symbol &s) {
+        return pc<s.addr;
+    });
+    if (it==syms.begin()) {
+        return syms.size();
+    }
+    --it;
+    if ((it->size!=0) && (pc-it->addr>=it->size)) {
+        return syms.size();
+    }
+    return it - syms.begin();
+}
@@ -0,0 +1,47 @@
+#if !defined(LOADER_H_)
+#define LOADER_H_
+
+#include <string>
+#include <vector>
+#include "rvemu.h"
+#include "ram.h"
+
+struct ElfInfo {
+    uintx_t entry;
+    uintx_t end  ; // end of the highest loaded segment (initial program break)
+    uintx_t phdr ; // address of the program headers in memory (0 if not loaded)
+    uintx_t phent;
+    uintx_t phnum;
+};
+
+// Function symbol. size is 0 when the symbol table does not give one (labels
+// of assembly sources).
+struct Symbol {
+    uintx_t     addr;
+    uintx_t     size;
+    std::string name;
+};
+
+bool is_elf  (const char *filename);
+
+// true if Machine(filename) can load it into a RAM of ram_size bytes: a
+// readable memfile that fits, or a RV ELF file whose segments fit. The
+// loaders report anything else and exit; callers that must not exit (the
+// library) check first.
+bool image_ok(const char *filename, uint64_t ram_size);
+
+// Bare-metal images are loaded at their physical addresses. User programs
+// (virt) are loaded at their virtual addresses, and position-independent ones
+// are moved to bias.
+void load_elf(RAM &ram, const char *filename, ElfInfo &info, bool virt=false, uintx_t bias=0);
+
+// Functions (STT_FUNC) and global labels of .symtab, sorted by address. bias
+// is added to the addresses of position-independent executables, as in
+// load_elf(). Returns false if the file has no symbol table.
+bool load_symbols(const char *filename, std::vector<Symbol> &syms, uintx_t bias=0);
+
+// Index of the symbol that contains pc, or syms.size() if none does. A
+// symbol without a size extends to the next one.
+int  find_symbol(const std::vector<Symbol> &syms, uintx_t pc);
+
+#endif // LOADER_H_
@@ -1,19 +1,100 @@
 #include <cstdio>
 #include <cstdlib>
 #include "machine.h"
+#include "csr.h"
+#include "loader.h"
 
 Machine::Machine(const char *memfile) {
-    ram.readmem(memfile);
+    clint  = new CLINT;
+    smp    = new SMP(this);
+    hartid = 0;
+
+    ElfInfo info;
+    if (is_elf(memfile)) {
+        load_elf(ram, memfile, info);
+    } else {
+        info.entry = RESET_VECTOR;
+        info.end   = ram.readmem(memfile);
+    }
+    reset(info.entry);
+    brk_base = (info.end + 0xf) & ~(uintx_t)0xf;
+    brk      = brk_base;
+}
+
+void Machine::reset(uintx_t entry) {
     for (int i=0; i<32; i++) {
         reg[i] = 0;
     }
-    r.pc  = RESET_VECTOR;
+    r.pc  = entry;
     cycle = 0;
+    exit_code = 0;
+    ntrap     = 0;
+    store_len   = 0;
+    event_saved = false;
+    event_pc    = 0;
+    mhartid   = hartid;
 
+    priv       = PRV_M;
+#if XLEN == 32
+    misa       = ((uintx_t)1 << 30);
+    mstatus    = 0;
+#else
+    misa       = ((uintx_t)2 << 62);
+    mstatus    = MSTATUS_UXL & (MSTATUS_UXL >> 1); // UXL=64
+#endif
+    misa      |= MISA_EXT('I') | MISA_EXT('M') | MISA_EXT('A') | MISA_EXT('C') | MISA_EXT('S') | MISA_EXT('U');
+    mie        = 0;
+    mip        = 0;
+    mtvec      = 0;
+    mcounteren = 0;
+    mscratch   = 0;
+    mepc       = 0;
+    mcause     = 0;
+    mtval      = 0;
+    medeleg    = 0;
+    mideleg    = 0;
+    stvec      = 0;
+    scounteren = 0;
+    sscratch   = 0;
+    sepc       = 0;
+    scause     = 0;
+    stval      = 0;
+    satp       = 0;
+    mcycle_offset   = 0;
+    minstret_offset = 0;
+    for (int i=0; i<HPM_COUNTERS; i++) {
+        hpm_event [i] = HPM_NONE;
+        hpm_offset[i] = 0;
+    }
+    for (int i=0; i<HPM_EVENTS; i++) {
+        hpm_count[i] = 0;
+    }
+    hpm_active = false;
+    cache      = NULL;
+
+    kicked          = false;
+    quantum_end     = (uint64_t)-1;
+    timer_deadline  = clint->deadline(hartid, cycle);
+    schedule();
+
+    load_res_addr   = (uintx_t)-1;
+
+    mmio_base = MMIO_BASE;
+
+    tlb_flush();
+    update_vm();
+    tlb_hit   = 0;
+    tlb_miss  = 0;
     char_size = 0;
+    console   = NULL;
+
+    syscall_proxy = false;
+    linux_user    = false;
 
 #if defined(TRACE_RF)
-    if ((fp = fopen(TRACE_RF_FILE, "w"))==NULL) {
+    // hart 0 only
+    fp = NULL;
+    if ((hartid==0) && ((fp = fopen(TRACE_RF_FILE, "w"))==NULL)) {
         fprintf(stderr, "Error: trace rf file cannot be opened.\n");
         exit(0);
     }
@@ -21,23 +102,31 @@ Machine::Machine(const char *memfile) {
 }
 
 Machine::~Machine() {
+    if (hartid==0) {
+        delete clint;
+        delete smp;
+    }
 #if defined(TRACE_RF)
-    fclose(fp);
+    if (fp!=NULL) {
+        fclose(fp);
+    }
 #endif
 }
 
 #define TARGET_READ_UINT(size) \
 uint ## size ## _t Machine::target_read_uint ## size(uintx_t addr) { \
-    uint ## size ## _t data; \
-    switch (addr) { \
-    case MTIME_ADDR: \
-        data = 0; \
-        break; \
-    default: \
-        data = ram.read_uint ## size(addr); \
-        break; \
+    if (data_tlb!=NULL) { \
+        uintx_t idx = TLB_INDEX(addr); \
+        if (data_tlb->tag_r[idx]==TLB_TAG(addr, size/8)) { \
+            tlb_hit++; \
+            return *(uint ## size ## _t *)(data_tlb->addend[idx] + addr); \
+        } \
+        return mmu_read(addr, size/8, ACCESS_LOAD); \
+    } \
+    if (addr>=mmio_base) { \
+        return mmio_read(addr, size/8); \
     } \
-    return data; \
+    return ram.read_uint ## size(addr); \
 }
 TARGET_READ_UINT(8)
 TARGET_READ_UINT(16)
@@ -46,38 +135,237 @@ TARGET_READ_UINT(64)
 
 #define TARGET_WRITE_UINT(size) \
 void Machine::target_write_uint ## size(uintx_t addr, uint ## size ## _t data) { \
+    if (data_tlb!=NULL) { \
+        uintx_t idx = TLB_INDEX(addr); \
+        if (data_tlb->tag_w[idx]==TLB_TAG(addr, size/8)) { \
+            tlb_hit++; \
+            *(uint ## size ## _t *)(data_tlb->addend[idx] + addr) = data; \
+            return; \
+        } \
+        mmu_write(addr, data, size/8); \
+        return; \
+    } \
+    if (addr>=mmio_base) { \
+        mmio_write(addr, data, size/8); \
+        return; \
+    } \
     ram.write_uint ## size(addr, data); \
 }
 TARGET_WRITE_UINT(8)
 TARGET_WRITE_UINT(16)
+TARGET_WRITE_UINT(32)
 TARGET_WRITE_UINT(64)
 
-void Machine::target_write_uint32(uintx_t addr, uint32_t data) {
-    switch (addr) {
-    case TOHOST_ADDR:
-        if (data & 0x00010000) buf[char_size++] = (data & 0xff);
-        if (data & 0x00020000) {
-            for (int i=0; i<char_size; i++) {
-                printf("%c", buf[i]);
+// Host pointer for an AMO/LR/SC. They need natural alignment and RAM, and
+// AMOs fault as stores.
+uint8_t *Machine::amo_ptr(uintx_t addr, int len, int type) {
+    if (addr & (len-1)) {
+        throw Exception{(type==ACCESS_LOAD) ? (uintx_t)CAUSE_MISALIGNED_LOAD : (uintx_t)CAUSE_MISALIGNED_STORE, addr};
+    }
+    uint64_t paddr = translate(addr, type);
+    if (paddr+len>ram.size) {
+        throw Exception{(type==ACCESS_LOAD) ? (uintx_t)CAUSE_LOAD_ACCESS : (uintx_t)CAUSE_STORE_ACCESS, addr};
+    }
+    return ram.ram + paddr;
+}
+
+// old = *p; *p = expr(old), retried until no other hart got in between
+#define AMO_CAS(p, old, expr) \
+    old = __atomic_load_n(p, __ATOMIC_RELAXED); \
+    while (!__atomic_compare_exchange_n(p, &old, (expr), false, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED))
+
+// record what an AMO or a successful sc left in memory (store_*)
+#define AMO_STORE(addr, p) \
+    store_len  = sizeof(*(p)); \
+    store_addr = (addr); \
+    store_data = __atomic_load_n(p, __ATOMIC_RELAXED)
+
+// Instruction fetch goes through the execute permission of the current
+// privilege level (mstatus.MPRV does not apply).
+uint16_t Machine::fetch_uint16(uintx_t addr) {
+    if (fetch_tlb!=NULL) {
+        uintx_t idx = TLB_INDEX(addr);
+        if (fetch_tlb->tag_x[idx]==TLB_TAG(addr, 2)) {
+            tlb_hit++;
+            return *(uint16_t *)(fetch_tlb->addend[idx] + addr);
+        }
+        return mmu_read(addr, 2, ACCESS_FETCH);
+    }
+    if (addr>=mmio_base) {
+        return mmio_read(addr, 2);
+    }
+    if (addr>ram.size-2) {
+        throw Exception{CAUSE_FETCH_ACCESS, addr};
+    }
+    return *(uint16_t *)&ram.ram[addr];
+}
+
+// The instruction at addr, in one 32-bit read when all 4 bytes are in the
+// same translated page (TLB hit) or in RAM. Only at the end of a page or of
+// RAM is it fetched a halfword at a time, so that a compressed instruction
+// there does not fault on the halfword after it.
+uint32_t Machine::fetch_ir(uintx_t addr) {
+    if (fetch_tlb!=NULL) {
+        uintx_t idx = TLB_INDEX(addr);
+        if ((fetch_tlb->tag_x[idx]==TLB_TAG(addr, 2)) && ((addr & PGMASK)<=PGSIZE-4)) {
+            tlb_hit++;
+            return *(uint32_t *)(fetch_tlb->addend[idx] + addr);
+        }
+    } else if ((addr<mmio_base) && (addr<=ram.size-4)) {
+        return *(uint32_t *)&ram.ram[addr];
+    }
+    uint32_t ir = fetch_uint16(addr);
+    if ((ir & 0x3)==0b11) {
+        ir |= (uint32_t)fetch_uint16(addr+2) << 16;
+    }
+    return ir;
+}
+
+uint64_t Machine::mmio_read(uintx_t addr, int len) {
+    uint64_t data;
+    if ((addr-CLINT_BASE)<CLINT_SIZE) {
+        uintx_t offset = addr-CLINT_BASE;
+        int     hart;
+        if (offset<CLINT_MTIMECMP) {
+            hart = offset / 4;
+            data = (hart<smp->nharts) ? __atomic_load_n(&clint->msip[hart], __ATOMIC_RELAXED) : 0;
+            return data >> ((offset & 0x3 & -len) * 8);
+        }
+        if (offset<CLINT_MTIME) {
+            hart = (offset-CLINT_MTIMECMP) / 8;
+            data = (hart<smp->nharts) ? __atomic_load_n(&clint->mtimecmp[hart], __ATOMIC_RELAXED) : 0;
+        } else if ((offset & ~0x7)==CLINT_MTIME) {
+            data = clint->mtime(cycle);
+        } else {
+            data = 0;
+        }
+        return data >> ((offset & 0x7 & -len) * 8);
+    }
+    if ((addr & ~0x7)==MTIME_ADDR) {
+        return clint->mtime(cycle) >> ((addr & 0x4) * 8);
+    }
+    switch (len) {
+    case 1 : return ram.read_uint8 (addr);
+    case 2 : return ram.read_uint16(addr);
+    case 4 : return ram.read_uint32(addr);
+    default: return ram.read_uint64(addr);
+    }
+}
+
+void Machine::mmio_write(uintx_t addr, uint64_t data, int len) {
+    if ((addr-CLINT_BASE)<CLINT_SIZE) {
+        uintx_t  offset = addr-CLINT_BASE;
+        uint64_t value;
+        int      shift  = (offset & 0x7) * 8;
+        uint64_t mask   = ((len==8) ? (uint64_t)-1 : (((uint64_t)1 << (len*8)) - 1)) << shift;
+        int      hart   = -1; // all harts
+        if (offset<CLINT_MTIMECMP) {
+            hart = offset / 4;
+            if (hart>=smp->nharts) return;
+            if ((offset & 0x3)==0) {
+                __atomic_store_n(&clint->msip[hart], data & 0x1, __ATOMIC_RELAXED);
+            }
+        } else if (offset<CLINT_MTIME) {
+            hart = (offset-CLINT_MTIMECMP) / 8;
+            if (hart>=smp->nharts) return;
+            value = __atomic_load_n(&clint->mtimecmp[hart], __ATOMIC_RELAXED);
+            __atomic_store_n(&clint->mtimecmp[hart], (value & ~mask) | ((data << shift) & mask), __ATOMIC_RELAXED);
+        } else if ((offset & ~0x7)==CLINT_MTIME) {
+            value = clint->mtime(cycle);
+            clint->set_mtime(cycle, (value & ~mask) | ((data << shift) & mask));
+        } else {
+            return;
+        }
+        for (int i=0; i<smp->nharts; i++) {
+            if ((hart<0) || (hart==i)) {
+                if (i==hartid) {
+                    timer_deadline = clint->deadline(hartid, cycle);
+                    schedule();
+                } else {
+                    smp->harts[i]->kick();
+                }
+            }
+        }
+        return;
+    }
+    if ((addr==TOHOST_ADDR) && (len>=4)) {
+        tohost(data);
+        return;
+    }
+    switch (len) {
+    case 1 : ram.write_uint8 (addr, data); break;
+    case 2 : ram.write_uint16(addr, data); break;
+    case 4 : ram.write_uint32(addr, data); break;
+    default: ram.write_uint64(addr, data); break;
+    }
+}
+
+// tohost protocol
+//   (cmd << 16) | char : cmd=0b01 print char, cmd=0b10 power off (crt0)
+//   (code << 1) | 1    : exit with code (riscv-tests env/p, HTIF)
+void Machine::tohost(uint64_t data) {
+    if ((data >> 16)==0) {
+        if (data & 0x1) {
+            exit_code = data >> 1;
+            putchars();
+            if (console!=NULL) {
+                // the batch runner reports pass/fail itself
+            } else if (exit_code==0) {
+                printf("pass!\n");
+            } else {
+                printf("fail! (test %d)\n", exit_code);
             }
             halt = 1;
         }
-        break;
-    default:
-        ram.write_uint32(addr, data);
-        break;
+        return;
+    }
+    if (data & 0x00010000) buf[char_size++] = (data & 0xff);
+    if (data & 0x00020000) {
+        putchars();
+        halt = 1;
     }
 }
 
+void Machine::putchars() {
+    if (console!=NULL) {
+        console->append(buf, char_size);
+    } else {
+        for (uint32_t i=0; i<char_size; i++) {
+            printf("%c", buf[i]);
+        }
+    }
+    char_size = 0;
+}
+
 int Machine::eval() {
     halt = 0;
     cycle++;
     pc   = r.pc;
-    ir   = target_read_uint32(r.pc);
+    try {
+        exec();
+    } catch (const Exception &e) {
+        if ((e.cause==CAUSE_FETCH_ACCESS) || (e.cause==CAUSE_FETCH_PAGE_FAULT)) {
+            // nothing was fetched; leave no trace of the previous instruction
+            ir            = 0;
+            cir           = 0;
+            is_compressed = false;
+        }
+        trap(e.cause, e.tval);
+    }
+    if (cycle>=next_event.load(std::memory_order_relaxed)) {
+        event_pc    = r.pc;
+        event_saved = true;
+        event();
+    }
+    return halt;
+}
 
+void Machine::exec() {
+    ir            = fetch_ir(r.pc);
+    cir           = ir;
     is_compressed = ((ir & 0x3)!=0b11);
-    cir           = target_read_uint16(r.pc);
     instr         = "";
+    hpm_count[HPM_COMPRESSED] += is_compressed; // taken back by trap()
     cinstr        = "";
 
     uint8_t opcode_1_0 =  ir        & 0x3 ; // ir[ 1: 0]
@@ -96,6 +384,12 @@ int Machine::eval() {
     uintx_t addr  ;
     uintx_t data  ;
 
+    uint32_t *pw, oldw;
+#if XLEN == 64
+    uint64_t *pd, oldd;
+#endif
+    int       expected;
+
     switch (opcode_1_0) {
     case 0b00: // Quadrant 0
         rd     = 0x8 | ((ir >> 2 ) & 0x7); // ir[4:2] + 8
@@ -117,6 +411,7 @@ int Machine::eval() {
             uimm    = ((ir << 1) & 0x40) | ((ir >> 7) & 0x38) | ((ir >> 4) & 0x4);
             addr    = reg[rs1] + uimm;
             reg[rd] = (int32_t)target_read_uint32(addr);
+            hpm_count[HPM_LOAD]++;
             ir      = (uimm << 20) | (rs1 << 15) | (0b010 << 12) | (rd << 7) | 0b0000011;
             instr   = "lw";
             cinstr  = "c.lw";
@@ -126,6 +421,7 @@ int Machine::eval() {
             uimm    = ((ir << 1) & 0xc0) | ((ir >> 7) & 0x38);
             addr    = reg[rs1] + uimm;
             reg[rd] = (int64_t)target_read_uint64(addr);
+            hpm_count[HPM_LOAD]++;
             ir      = (uimm << 20) | (rs1 << 15) | (0b011 << 12) | (rd << 7) | 0b0000011;
             instr   = "ld";
             cinstr  = "c.ld";
@@ -135,6 +431,7 @@ int Machine::eval() {
             uimm   = ((ir << 1) & 0x40) | ((ir >> 7) & 0x38) | ((ir >> 4) & 0x4);
             addr   = reg[rs1] + uimm;
             target_write_uint32(addr, reg[rs2]);
+            hpm_count[HPM_STORE]++;
             ir     = ((uimm & 0xfe0) << 20) | (rs2 << 20) | (rs1 << 15) | (0b010 << 12) | ((uimm & 0x1f) << 7) | 0b0100011;
             instr  = "sw";
             cinstr = "c.sw";
@@ -144,6 +441,7 @@ int Machine::eval() {
             uimm   = ((ir << 1) & 0xc0) | ((ir >> 7) & 0x38);
             addr   = reg[rs1] + uimm;
             target_write_uint64(addr, reg[rs2]);
+            hpm_count[HPM_STORE]++;
             ir     = ((uimm & 0xfe0) << 20) | (rs2 << 20) | (rs1 << 15) | (0b011 << 12) | ((uimm & 0x1f) << 7) | 0b0100011;
             instr  = "sd";
             cinstr = "c.sd";
@@ -350,6 +648,7 @@ int Machine::eval() {
             imm    = ((intx_t)imm << (XLEN-32)) >> (XLEN-32); // sext
             if (reg[rs1]==0) {
                 r.pc = pc + imm;
+                hpm_count[HPM_BRANCH_TAKEN]++;
             } else {
                 r.pc = pc+2;
             }
@@ -364,6 +663,7 @@ int Machine::eval() {
             imm    = ((intx_t)imm << (XLEN-32)) >> (XLEN-32); // sext
             if (reg[rs1]!=0) {
                 r.pc = pc + imm;
+                hpm_count[HPM_BRANCH_TAKEN]++;
             } else {
                 r.pc = pc+2;
             }
@@ -397,6 +697,7 @@ int Machine::eval() {
             if (rd!=0) {
                 reg[rd] = (int32_t)target_read_uint32(addr);
             }
+            hpm_count[HPM_LOAD]++;
             r.pc   = pc+2;
             ir     = (uimm << 20) | (0x2 << 15) | (0b010 << 12) | (rd << 7) | 0b0000011;
             instr  = "lw";
@@ -409,6 +710,7 @@ int Machine::eval() {
             if (rd!=0) {
                 reg[rd] = (int64_t)target_read_uint64(addr);
             }
+            hpm_count[HPM_LOAD]++;
             r.pc   = pc+2;
             ir     = (uimm << 20) | (0x2 << 15) | (0b011 << 12) | (rd << 7) | 0b0000011;
             instr  = "ld";
@@ -434,9 +736,14 @@ int Machine::eval() {
                 }
             } else { // c.jalr/c.add
                 if (rs1==0) { // c.ebreak
-                    goto illegal_instr;
-                }
-                if (rs2==0) { // c.jalr
+                    if (rs2!=0) {
+                        goto illegal_instr;
+                    }
+                    trap(CAUSE_BREAKPOINT, pc);
+                    ir      = 0x00100073;
+                    instr   = "ebreak";
+                    cinstr  = "c.ebreak";
+                } else if (rs2==0) { // c.jalr
                     r.pc    = reg[rs1];
                     reg[1]  = pc+2;
                     ir      = (rs1 << 15) | (0x1 << 7) | 0b1100111;
@@ -455,6 +762,7 @@ int Machine::eval() {
             uimm   = ((ir >> 1) & 0xc0) | ((ir >> 7) & 0x3c);
             addr   = reg[2] + uimm;
             target_write_uint32(addr, reg[rs2]);
+            hpm_count[HPM_STORE]++;
             r.pc   = pc+2;
             ir     = ((uimm & 0xfe0) << 20) | (rs2 << 20) | (0x2 << 15) | (0b010 << 12) | ((uimm & 0x1f) << 7) | 0b0100011;
             instr  = "sw";
@@ -465,6 +773,7 @@ int Machine::eval() {
             uimm   = ((ir >> 1) & 0x1c0) | ((ir >> 7) & 0x38);
             addr   = reg[2] + uimm;
             target_write_uint64(addr, reg[rs2]);
+            hpm_count[HPM_STORE]++;
             r.pc   = pc+2;
             ir     = ((uimm & 0xfe0) << 20) | (rs2 << 20) | (0x2 << 15) | (0b011 << 12) | ((uimm & 0x1f) << 7) | 0b0100011;
             instr  = "sd";
@@ -518,6 +827,7 @@ int Machine::eval() {
             if (rd!=0) {
                 reg[rd] = data;
             }
+            hpm_count[HPM_LOAD]++;
             r.pc = pc+4;
             break; // load
         case 0b01000: // store
@@ -545,6 +855,7 @@ int Machine::eval() {
                 goto illegal_instr;
                 break;
             }
+            hpm_count[HPM_STORE]++;
             r.pc = pc+4;
             break; // store
         case 0b00100: // op-imm
@@ -818,10 +1129,10 @@ int Machine::eval() {
                 case 0b000: // addw/subw
                     if (funct7 & 0x20) { // subw
                         data  = (int32_t)(reg[rs1] - reg[rs2]);
-                        instr = "sub";
+                        instr = "subw";
                     } else { // addw
                         data  = (int32_t)(reg[rs1] + reg[rs2]);
-                        instr = "add";
+                        instr = "addw";
                     }
                     break;
                 case 0b001: // sllw
@@ -885,7 +1196,7 @@ int Machine::eval() {
                 break;
             case 0b101: // bge
                 cond  = ((intx_t)reg[rs1]>=(intx_t)reg[rs2]);
-                instr = "bne";
+                instr = "bge";
                 break;
             case 0b110: // bltu
                 cond  = (reg[rs1]<reg[rs2]);
@@ -903,6 +1214,7 @@ int Machine::eval() {
                 imm  = (((int32_t)ir >> 19) & 0xfffff000) | ((ir << 4) & 0x800) | ((ir >> 20) & 0x7e0) | ((ir >> 7) & 0x1e);
                 imm  = ((intx_t)imm << (XLEN-32)) >> (XLEN-32); // sext
                 r.pc = pc + imm;
+                hpm_count[HPM_BRANCH_TAKEN]++;
             } else {
                 r.pc = pc+4;
             }
@@ -928,8 +1240,13 @@ int Machine::eval() {
         case 0b00011: // misc-mem
             switch (funct3) {
             case 0b000: // fence
+                if (smp->nharts>1) {
+                    std::atomic_thread_fence(std::memory_order_seq_cst);
+                }
+                instr = "fence";
                 break;
             case 0b001: // fence.i
+                instr = "fence.i";
                 break;
             default:
                 goto illegal_instr;
@@ -938,143 +1255,272 @@ int Machine::eval() {
             r.pc = pc+4;
             break;
         case 0b01011: // amo
+                // Host atomics on the RAM backing the address, so that harts
+                // on other threads see them atomically. aq/rl are treated as
+                // sequentially consistent.
                 funct5 = ((ir >> 27) & 0x1f); // ir[31:27]
                 addr   = reg[rs1];
                 switch (funct3) {
                 case 0b010: // amo.w
-                    data = (uint32_t)target_read_uint32(addr);
+                    pw = (uint32_t *)amo_ptr(addr, 4, (funct5==0b00010) ? ACCESS_LOAD : ACCESS_STORE);
                     switch (funct5) {
                     case 0b00010: // lr.w
                         if (rs2!=0) {
                             goto illegal_instr;
                         }
-                        load_res_addr = addr;
+                        data           = __atomic_load_n(pw, __ATOMIC_SEQ_CST);
+                        load_res_addr  = addr;
+                        load_res_value = data;
+                        smp->granule((uint8_t *)pw-ram.ram).store(hartid);
                         instr = "lr.w";
                         break;
                     case 0b00011: // sc.w
-                        if (addr==load_res_addr) {
-                            target_write_uint32(addr, reg[rs2]);
-                            load_res_addr = (uintx_t)-1;
+                        expected = hartid;
+                        oldw     = load_res_value;
+                        if ((addr==load_res_addr) && smp->granule((uint8_t *)pw-ram.ram).compare_exchange_strong(expected, -1) &&
+                            __atomic_compare_exchange_n(pw, &oldw, (uint32_t)reg[rs2], false, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST)) {
                             data = 0;
                         } else {
                             data = 1;
                         }
+                        load_res_addr = (uintx_t)-1;
                         instr = "sc.w";
                         break;
                     case 0b00001: // amoswap.w
-                        target_write_uint32(addr,                 (int32_t)reg[rs2]);
+                        data = __atomic_exchange_n (pw, (uint32_t)reg[rs2], __ATOMIC_SEQ_CST);
                         instr = "amoswap.w";
                         break;
                     case 0b00000: // amoadd.w
-                        target_write_uint32(addr, (int32_t)data + (int32_t)reg[rs2]);
+                        data = __atomic_fetch_add  (pw, (uint32_t)reg[rs2], __ATOMIC_SEQ_CST);
                         instr = "amoadd.w";
                         break;
                     case 0b00100: // amoxor.w
-                        target_write_uint32(addr, (int32_t)data ^ (int32_t)reg[rs2]);
+                        data = __atomic_fetch_xor  (pw, (uint32_t)reg[rs2], __ATOMIC_SEQ_CST);
                         instr = "amoxor.w";
                         break;
                     case 0b01100: // amoand.w
-                        target_write_uint32(addr, (int32_t)data & (int32_t)reg[rs2]);
+                        data = __atomic_fetch_and  (pw, (uint32_t)reg[rs2], __ATOMIC_SEQ_CST);
                         instr = "amoand.w";
                         break;
                     case 0b01000: // amoor.w
-                        target_write_uint32(addr, (int32_t)data | (int32_t)reg[rs2]);
+                        data = __atomic_fetch_or   (pw, (uint32_t)reg[rs2], __ATOMIC_SEQ_CST);
                         instr = "amoor.w";
                         break;
                     case 0b10000: // amomin.w
-                        target_write_uint32(addr, ((int32_t)data < (int32_t)reg[rs2]) ? (int32_t)data : (int32_t)reg[rs2]);
+                        AMO_CAS(pw, oldw, ((int32_t)oldw < (int32_t)reg[rs2]) ? oldw : (uint32_t)reg[rs2]);
+                        data  = oldw;
                         instr = "amomin.w";
                         break;
                     case 0b10100: // amomax.w
-                        target_write_uint32(addr, ((int32_t)data > (int32_t)reg[rs2]) ? (int32_t)data : (int32_t)reg[rs2]);
+                        AMO_CAS(pw, oldw, ((int32_t)oldw > (int32_t)reg[rs2]) ? oldw : (uint32_t)reg[rs2]);
+                        data  = oldw;
                         instr = "amomax.w";
                         break;
                     case 0b11000: // amominu.w
-                        target_write_uint32(addr, ((uint32_t)data < (uint32_t)reg[rs2]) ? (int32_t)data : (int32_t)reg[rs2]);
+                        AMO_CAS(pw, oldw, (oldw < (uint32_t)reg[rs2]) ? oldw : (uint32_t)reg[rs2]);
+                        data  = oldw;
                         instr = "amominu.w";
                         break;
                     case 0b11100: // amomaxu.w
-                        target_write_uint32(addr, ((uint32_t)data > (uint32_t)reg[rs2]) ? (int32_t)data : (int32_t)reg[rs2]);
+                        AMO_CAS(pw, oldw, (oldw > (uint32_t)reg[rs2]) ? oldw : (uint32_t)reg[rs2]);
+                        data  = oldw;
                         instr = "amomaxu.w";
                         break;
                     default:
                         goto illegal_instr;
                         break;
                     }
+                    if ((funct5 & 0b11110)!=0b00010) {
+                        smp->granule((uint8_t *)pw-ram.ram).store(-1); // amo*: breaks other harts' reservations
+                    }
+                    if ((funct5!=0b00010) && ((funct5!=0b00011) || (data==0))) {
+                        AMO_STORE(addr, pw);
+                    }
                     if (rd!=0) {
                         reg[rd] = (int32_t)data;
                     }
                     break;
+#if XLEN == 64
                 case 0b011: // amo.d
-                    data = (uint64_t)target_read_uint64(addr);
+                    pd = (uint64_t *)amo_ptr(addr, 8, (funct5==0b00010) ? ACCESS_LOAD : ACCESS_STORE);
                     switch (funct5) {
                     case 0b00010: // lr.d
                         if (rs2!=0) {
                             goto illegal_instr;
                         }
-                        load_res_addr = addr;
+                        data           = __atomic_load_n(pd, __ATOMIC_SEQ_CST);
+                        load_res_addr  = addr;
+                        load_res_value = data;
+                        smp->granule((uint8_t *)pd-ram.ram).store(hartid);
                         instr = "lr.d";
                         break;
                     case 0b00011: // sc.d
-                        if (addr==load_res_addr) {
-                            target_write_uint64(addr, reg[rs2]);
-                            load_res_addr = (uintx_t)-1;
+                        expected = hartid;
+                        oldd     = load_res_value;
+                        if ((addr==load_res_addr) && smp->granule((uint8_t *)pd-ram.ram).compare_exchange_strong(expected, -1) &&
+                            __atomic_compare_exchange_n(pd, &oldd, (uint64_t)reg[rs2], false, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST)) {
                             data = 0;
                         } else {
                             data = 1;
                         }
+                        load_res_addr = (uintx_t)-1;
                         instr = "sc.d";
                         break;
                     case 0b00001: // amoswap.d
-                        target_write_uint64(addr,                 (int64_t)reg[rs2]);
+                        data = __atomic_exchange_n (pd, (uint64_t)reg[rs2], __ATOMIC_SEQ_CST);
                         instr = "amoswap.d";
                         break;
                     case 0b00000: // amoadd.d
-                        target_write_uint64(addr, (int64_t)data + (int64_t)reg[rs2]);
+                        data = __atomic_fetch_add  (pd, (uint64_t)reg[rs2], __ATOMIC_SEQ_CST);
                         instr = "amoadd.d";
                         break;
                     case 0b00100: // amoxor.d
-                        target_write_uint64(addr, (int64_t)data ^ (int64_t)reg[rs2]);
+                        data = __atomic_fetch_xor  (pd, (uint64_t)reg[rs2], __ATOMIC_SEQ_CST);
                         instr = "amoxor.d";
                         break;
                     case 0b01100: // amoand.d
-                        target_write_uint64(addr, (int64_t)data & (int64_t)reg[rs2]);
+                        data = __atomic_fetch_and  (pd, (uint64_t)reg[rs2], __ATOMIC_SEQ_CST);
                         instr = "amoand.d";
                         break;
                     case 0b01000: // amoor.d
-                        target_write_uint64(addr, (int64_t)data | (int64_t)reg[rs2]);
+                        data = __atomic_fetch_or   (pd, (uint64_t)reg[rs2], __ATOMIC_SEQ_CST);
                         instr = "amoor.d";
                         break;
                     case 0b10000: // amomin.d
-                        target_write_uint64(addr, ((int64_t)data < (int64_t)reg[rs2]) ? (int64_t)data : (int64_t)reg[rs2]);
+                        AMO_CAS(pd, oldd, ((int64_t)oldd < (int64_t)reg[rs2]) ? oldd : (uint64_t)reg[rs2]);
+                        data  = oldd;
                         instr = "amomin.d";
                         break;
                     case 0b10100: // amomax.d
-                        target_write_uint64(addr, ((int64_t)data > (int64_t)reg[rs2]) ? (int64_t)data : (int64_t)reg[rs2]);
+                        AMO_CAS(pd, oldd, ((int64_t)oldd > (int64_t)reg[rs2]) ? oldd : (uint64_t)reg[rs2]);
+                        data  = oldd;
                         instr = "amomax.d";
                         break;
                     case 0b11000: // amominu.d
-                        target_write_uint64(addr, ((uint64_t)data < (uint64_t)reg[rs2]) ? (int64_t)data : (int64_t)reg[rs2]);
+                        AMO_CAS(pd, oldd, (oldd < (uint64_t)reg[rs2]) ? oldd : (uint64_t)reg[rs2]);
+                        data  = oldd;
                         instr = "amominu.d";
                         break;
                     case 0b11100: // amomaxu.d
-                        target_write_uint64(addr, ((uint64_t)data > (uint64_t)reg[rs2]) ? (int64_t)data : (int64_t)reg[rs2]);
+                        AMO_CAS(pd, oldd, (oldd > (uint64_t)reg[rs2]) ? oldd : (uint64_t)reg[rs2]);
+                        data  = oldd;
                         instr = "amomaxu.d";
                         break;
                     default:
                         goto illegal_instr;
                         break;
                     }
+                    if ((funct5 & 0b11110)!=0b00010) {
+                        smp->granule((uint8_t *)pd-ram.ram).store(-1); // amo*: breaks other harts' reservations
+                    }
+                    if ((funct5!=0b00010) && ((funct5!=0b00011) || (data==0))) {
+                        AMO_STORE(addr, pd);
+                    }
                     if (rd!=0) {
                         reg[rd] = (int64_t)data;
                     }
                     break;
+#endif
                 default:
                     goto illegal_instr;
                     break;
                 }
+                hpm_count[HPM_AMO]++;
                 r.pc = pc+4;
             break;
+        case 0b11100: // system
+            if (funct3==0b000) {
+                switch (ir) {
+                case 0x00000073: // ecall
+                    if (syscall_proxy) {
+                        syscall();
+                        r.pc = pc+4;
+                    } else {
+                        trap(CAUSE_USER_ECALL+priv, 0);
+                    }
+                    instr = "ecall";
+                    break;
+                case 0x00100073: // ebreak
+                    trap(CAUSE_BREAKPOINT, pc);
+                    instr = "ebreak";
+                    break;
+                case 0x30200073: // mret
+                    if (priv<PRV_M) {
+                        goto illegal_instr;
+                    }
+                    mret();
+                    instr = "mret";
+                    break;
+                case 0x10200073: // sret
+                    if ((priv<PRV_S) || ((priv==PRV_S) && (mstatus & MSTATUS_TSR))) {
+                        goto illegal_instr;
+                    }
+                    sret();
+                    instr = "sret";
+                    break;
+                case 0x10500073: // wfi
+                    if ((priv<PRV_S) || ((priv==PRV_S) && (mstatus & MSTATUS_TW))) {
+                        goto illegal_instr;
+                    }
+                    wfi();
+                    r.pc  = pc+4;
+                    instr = "wfi";
+                    break;
+                default:
+                    if ((ir & 0xfe007fff)==0x12000073) { // sfence.vma
+                        if ((priv<PRV_S) || ((priv==PRV_S) && (mstatus & MSTATUS_TVM))) {
+                            goto illegal_instr;
+                        }
+                        tlb_flush();
+                        r.pc  = pc+4;
+                        instr = "sfence.vma";
+                        break;
+                    }
+                    goto illegal_instr;
+                    break;
+                }
+                break;
+            }
+            // Zicsr
+            uimm = (funct3 & 0x4) ? rs1 : reg[rs1]; // csr*i: zero-extended uimm[4:0]
+            imm  = (ir >> 20) & 0xfff; // csr
+            switch (funct3 & 0x3) {
+            case 0b01: // csrrw/csrrwi
+                if ((rd!=0) && !csr_read(imm, data)) {
+                    goto illegal_instr;
+                }
+                if (!csr_write(imm, uimm)) {
+                    goto illegal_instr;
+                }
+                instr = (funct3 & 0x4) ? "csrrwi" : "csrrw";
+                break;
+            case 0b10: // csrrs/csrrsi
+                if (!csr_read(imm, data)) {
+                    goto illegal_instr;
+                }
+                if ((rs1!=0) && !csr_write(imm, data | uimm)) {
+                    goto illegal_instr;
+                }
+                instr = (funct3 & 0x4) ? "csrrsi" : "csrrs";
+                break;
+            case 0b11: // csrrc/csrrci
+                if (!csr_read(imm, data)) {
+                    goto illegal_instr;
+                }
+                if ((rs1!=0) && !csr_write(imm, data & ~uimm)) {
+                    goto illegal_instr;
+                }
+                instr = (funct3 & 0x4) ? "csrrci" : "csrrc";
+                break;
+            default:
+                goto illegal_instr;
+                break;
+            }
+            if (rd!=0) {
+                reg[rd] = data;
+            }
+            r.pc = pc+4;
+            break; // system
         default:
             goto illegal_instr;
             break;
@@ -1085,25 +1531,18 @@ int Machine::eval() {
         break;
     }
 
-    if (cycle>=TIMEOUT) halt = 1;
-    return halt;
+    return;
 
 illegal_instr:
-    fprintf(stderr, "Error: illegal instruction detected!!\n");
-#if      XLEN == 32
-    fprintf(stderr, "pc=[0x%08x] ir=[0x%08x]\n", pc, ir);
-#else // XLEN == 64
-    fprintf(stderr, "pc=[0x%016lx] ir=[0x%08x]\n", pc, ir);
-#endif
-    exit(0);
+    trap(CAUSE_ILLEGAL_INSTRUCTION, (is_compressed) ? cir : ir);
 }
 
 #if defined(TRACE_RF)
 void Machine::dump_regs() {
 #if      XLEN == 32
-    fprintf(fp, "%08d %08x %08x", cycle, pc, ir);
+    fprintf(fp, "%08lu %08x %08x", cycle, pc, ir);
 #else // XLEN == 64
-    fprintf(fp, "%08d %016lx %08x", cycle, pc, ir);
+    fprintf(fp, "%08lu %016lx %08x", cycle, pc, ir);
 #endif
 #if defined(DEBUG)
     fprintf(fp, " %17s", instr);
@@ -2,11 +2,40 @@
 #define MACHINE_H_
 
 #include <cstdio>
+#include <atomic>
+#include <map>
+#include <string>
 #include "rvemu.h"
 #include "ram.h"
+#include "clint.h"
+#include "mmu.h"
+#include "smp.h"
+
+#define EXIT_TRAP -1 // exit_code after an unhandled trap
+
+// Events mhpmevent3-31 select. Counts are of retired instructions.
+enum HPMEvent {
+    HPM_NONE        , // the counter keeps the value written
+    HPM_LOAD        , // loads (not lr)
+    HPM_STORE       , // stores (not sc)
+    HPM_BRANCH_TAKEN, // conditional branches taken
+    HPM_COMPRESSED  , // RVC instructions
+    HPM_AMO         , // amo*, lr and sc
+    HPM_L1I_MISS    , // with --cache (cache.h); kept by the cache model
+    HPM_L1D_MISS    ,
+    HPM_L2_MISS     ,
+    HPM_EVENTS
+};
+#define HPM_COUNTERS 29 // mhpmcounter3-31
+
+struct CacheSim;
 
 struct Machine {
     RAM      ram    ;
+    CLINT   *clint  ; // shared by all harts
+    SMP     *smp    ;
+    int      hartid ;
+    uintx_t  mhartid; // hartid, or the lane number (--lanes)
 
     struct _reg {
         uintx_t pc;
@@ -15,18 +44,104 @@ struct Machine {
     uint32_t ir     ;
     uintx_t  reg[32];
 
-    uintx_t  load_res_addr;
+    uintx_t  load_res_addr ;
+    uint64_t load_res_value; // value read by lr, compared by sc
 
     uint8_t  halt   ;
-    uint32_t cycle  ;
+    uint64_t cycle  ;
+    int      exit_code;
+    uint64_t ntrap  ; // synchronous traps taken (the instruction did not retire)
+
+    // last AMO or successful sc, for commit logs (commit.h): what it left in
+    // memory. store_len is 0 until one sets it and only CommitLog clears it;
+    // plain stores are decoded by CommitLog, off the store path.
+    uint8_t  store_len ;
+    uintx_t  store_addr;
+    uint64_t store_data;
+    // r.pc as exec() left it, saved by eval() before event() can redirect it
+    // to an interrupt handler. event_saved is set with it; only CommitLog
+    // clears it.
+    bool     event_saved;
+    uintx_t  event_pc  ;
+
+    // privileged state
+    uint8_t  priv      ;
+    uintx_t  mstatus   ;
+    uintx_t  misa      ;
+    uintx_t  mie       ;
+    uintx_t  mip       ;
+    uintx_t  mtvec     ;
+    uint32_t mcounteren;
+    uintx_t  mscratch  ;
+    uintx_t  mepc      ;
+    uintx_t  mcause    ;
+    uintx_t  mtval     ;
+    uintx_t  medeleg   ;
+    uintx_t  mideleg   ;
+    uintx_t  stvec     ;
+    uint32_t scounteren;
+    uintx_t  sscratch  ;
+    uintx_t  sepc      ;
+    uintx_t  scause    ;
+    uintx_t  stval     ;
+    uintx_t  satp      ;
+
+    // mcycle/minstret are not counted per instruction; they are derived from
+    // cycle on read, and a CSR write only moves these offsets.
+    uint64_t mcycle_offset  ;
+    uint64_t minstret_offset;
+
+    // mhpmcounter3-31 are not counted per instruction either: exec() counts
+    // every event in hpm_count as it goes, and a counter reads as the count of
+    // its event plus an offset.
+    uint8_t  hpm_event [HPM_COUNTERS];
+    uint64_t hpm_offset[HPM_COUNTERS];
+    uint64_t hpm_count [HPM_EVENTS  ];
+    bool     hpm_active; // an mhpmevent selects an event below HPM_L1I_MISS
+    CacheSim *cache    ; // --cache, or NULL
+
+    // Interrupts are not polled per instruction: eval() only compares cycle
+    // with next_event, the earliest cycle at which something (timer deadline,
+    // a newly enabled pending interrupt, TIMEOUT) needs attention.
+    // Other harts may set next_event to 0 (with kicked) to get attention.
+    std::atomic<uint64_t> next_event;
+    std::atomic<bool>     kicked    ;
+    uint64_t timer_deadline;
+    uint64_t quantum_end   ; // end of the current scheduling quantum, or all ones
+
+    uintx_t  mmio_base; // MMIO_BASE, or all ones when there are no devices
+
+    // MMU (mmu.cpp). fetch_tlb/data_tlb point at the TLB of the effective
+    // privilege level, or are NULL when addresses are not translated.
+    TLB      tlb[2]   ; // PRV_U, PRV_S
+    TLB     *fetch_tlb;
+    TLB     *data_tlb ;
+    uint64_t tlb_hit  ;
+    uint64_t tlb_miss ;
 
     // tohost
     char buf[2048];
     uint32_t char_size;
+    std::string *console; // collects the guest's output (--batch), or NULL for stdout
+
+    // newlib syscall proxy (syscall.cpp)
+    bool     syscall_proxy;
+    uintx_t  brk_base     ;
+    uintx_t  brk          ;
+
+    // Linux user-mode emulation (linux.cpp)
+    bool     linux_user;
+    uintx_t  brk_max   ;
+    std::map<uintx_t, uintx_t> mmap_free; // unmapped [start, end) of the mmap area
+    std::string exe;
 
     Machine(const char* memfile);
+    Machine(int argc, char **argv, char **envp); // Linux user mode, argv[0] is the ELF file
+    Machine(Machine &boot, int hartid);         // secondary hart (smp.cpp)
     ~Machine();
 
+    void reset(uintx_t entry);
+
     uint8_t  target_read_uint8 (uintx_t addr);
     uint16_t target_read_uint16(uintx_t addr);
     uint32_t target_read_uint32(uintx_t addr);
@@ -37,7 +152,52 @@ struct Machine {
     void target_write_uint32(uintx_t addr, uint32_t data);
     void target_write_uint64(uintx_t addr, uint64_t data);
 
-    int eval();
+    uint16_t fetch_uint16(uintx_t addr);
+    uint32_t fetch_ir    (uintx_t addr);
+    uint8_t *amo_ptr(uintx_t addr, int len, int type);
+
+    uint64_t mmio_read (uintx_t addr, int len);
+    void     mmio_write(uintx_t addr, uint64_t data, int len);
+    void     tohost(uint64_t data);
+    void     putchars();
+
+    void syscall();
+    void linux_syscall();
+    uintx_t linux_mmap  (uintx_t addr, uintx_t len, int flags, int fd, uintx_t offset);
+    int     linux_munmap(uintx_t addr, uintx_t len);
+
+    // MMU (mmu.cpp)
+    void     update_vm ();
+    void     tlb_flush ();
+    uint64_t translate (uintx_t addr, int type);
+    uint64_t mmu_read  (uintx_t addr, int len, int type);
+    void     mmu_write (uintx_t addr, uint64_t data, int len);
+    uint64_t phys_read (uint64_t paddr, int len, int type);
+    void     phys_write(uint64_t paddr, uint64_t data, int len);
+
+    // CSR/trap (csr.cpp)
+    uint64_t read_mcycle  ();
+    uint64_t read_minstret();
+    uint64_t read_hpmcounter(int i); // i=0 for mhpmcounter3
+    bool     hpm_read (uint16_t csr, uintx_t &data);
+    bool     hpm_write(uint16_t csr, uintx_t  data);
+    bool csr_read (uint16_t csr, uintx_t &data);
+    bool csr_write(uint16_t csr, uintx_t  data);
+    uintx_t  read_mip();
+    uintx_t  pending_interrupts();
+    void trap(uintx_t cause, uintx_t tval);
+    void trap_enter(uintx_t cause, uintx_t tval, uintx_t epc);
+    void mret();
+    void sret();
+    void wfi();
+    void schedule();
+    void event();
+
+    int  eval();
+    void exec();
+    void run ();
+    int  run_quantum(uint64_t end);
+    void kick();
 
     // Debug
     bool       is_compressed;
@@ -1,29 +1,528 @@
 #include <cstdio>
 #include <cstdlib>
+#include <chrono>
+#include <getopt.h>
 #include "rvemu.h"
 #include "machine.h"
+#include "batch.h"
+#include "bench.h"
+#include "lanes.h"
+#include "simpoint.h"
+#include "profile.h"
+#include "mix.h"
+#include "commit.h"
+#include "hook.h"
+#include "spikelog.h"
+#include "sample.h"
+#include "hostperf.h"
+#include "cache.h"
+#include "timing.h"
+#include "bpred.h"
 
-int main(int argc, char **argv) {
-    if (argc!=2) {
-        fprintf(stderr, "Usage: ./rvemu <memfile>\n");
+static void usage() {
+    fprintf(stderr, "Usage: ./rvemu [options] <memfile>\n");
+    fprintf(stderr, "       ./rvemu [options] --linux <elf> [args...]\n");
+    fprintf(stderr, "       ./rvemu [options] --batch <memfile|dir>...\n");
+    fprintf(stderr, "  <memfile>      raw binary loaded at 0x0, or an ELF file\n");
+    fprintf(stderr, "  --syscall      proxy newlib system calls (ecall) to the host\n");
+    fprintf(stderr, "  --linux        run a static Linux executable in user mode\n");
+    fprintf(stderr, "  --harts N      run N harts sharing memory, one host thread each\n");
+    fprintf(stderr, "  --quantum Q    interleave the harts deterministically, Q instructions at a time\n");
+    fprintf(stderr, "  --parallel     with --quantum: run the quanta of the harts on their own threads\n");
+    fprintf(stderr, "  --batch        run each memfile (the *.bin files of a dir) and summarize pass/fail\n");
+    fprintf(stderr, "  --jobs N       with --batch: number of host threads (default: one per core)\n");
+    fprintf(stderr, "  --bench N      time N runs of each memfile (after a warm-up run) and print the\n");
+    fprintf(stderr, "                 median host time, its variance and MIPS\n");
+    fprintf(stderr, "  --bench-json FILE  also write them to FILE as JSON (tools/bench-compare.py)\n");
+    fprintf(stderr, "  --lanes N      run N copies of the program in lockstep (mhartid = copy number)\n");
+    fprintf(stderr, "  --interval N   SimPoint interval in instructions (default %d)\n", SIMPOINT_INTERVAL);
+    fprintf(stderr, "  --bbv FILE     write the basic-block vector of every interval to FILE\n");
+    fprintf(stderr, "  --simpoints FILE [--weights FILE]\n");
+    fprintf(stderr, "                 checkpoint the chosen intervals, replay them in parallel and\n");
+    fprintf(stderr, "                 estimate the whole program from them\n");
+    fprintf(stderr, "  --checkpoint-dir DIR  also write the checkpoints to DIR\n");
+    fprintf(stderr, "  --restore FILE start from a checkpoint\n");
+    fprintf(stderr, "  --profile FILE write instruction counts per function (self and inclusive) and\n");
+    fprintf(stderr, "                 the call graph and the annotated disassembly of the hottest ones\n");
+    fprintf(stderr, "                 to FILE (- for stderr)\n");
+    fprintf(stderr, "  --profile-folded FILE  write the instruction counts per call path as folded stacks\n");
+    fprintf(stderr, "  --mix          print the instruction mix (by class and mnemonic)\n");
+    fprintf(stderr, "  --mix-json FILE  also write it to FILE as JSON\n");
+    fprintf(stderr, "  --trace FILE   write a binary commit trace (rvemu-trace%d converts it to text)\n", XLEN);
+    fprintf(stderr, "  --log-commits FILE  write the commit log of spike --log-commits (- for stdout)\n");
+    fprintf(stderr, "  --sample FILE  sample the guest pc on a host timer; write folded stacks to FILE\n");
+    fprintf(stderr, "  --sample-rate HZ  samples per second, 1 to 1e9 (default %d)\n", SAMPLE_RATE);
+    fprintf(stderr, "  --sample-stacks   also record the guest call stack (a check per instruction)\n");
+    fprintf(stderr, "  --cache FILE   simulate L1I/L1D/L2 caches; write hits, misses, writebacks and the\n");
+    fprintf(stderr, "                 instructions that miss most to FILE (- for stderr)\n");
+    fprintf(stderr, "  --cache-l1i SPEC, --cache-l1d SPEC, --cache-l2 SPEC|none\n");
+    fprintf(stderr, "                 SIZE:WAYS:LINE[:lru|fifo|random[:wb|wt]] (default %s, %s, %s)\n",
+            CACHE_L1I, CACHE_L1D, CACHE_L2);
+    fprintf(stderr, "  --timing FILE  estimate the cycles of an in-order pipeline; write them and the\n");
+    fprintf(stderr, "                 CPI of each hazard to FILE (- for stderr)\n");
+    fprintf(stderr, "  --pipeline KEY=N,...  pipeline of --timing and of the CPI of --simpoints: stages,\n");
+    fprintf(stderr, "                 load_use, mul, div, branch, fetch (default\n");
+    fprintf(stderr, "                 stages=%d,load_use=%d,mul=%d,div=%d,branch=%d,fetch=%d)\n",
+            PIPELINE_STAGES, PIPELINE_LOAD_USE, PIPELINE_MUL, PIPELINE_DIV, PIPELINE_BRANCH, PIPELINE_FETCH);
+    fprintf(stderr, "  --bpred FILE   run branch predictors side by side; write the MPKI of each and the\n");
+    fprintf(stderr, "                 branches mispredicted most to FILE (- for stderr)\n");
+    fprintf(stderr, "  --bpred-models NAME[:N],...  bimodal, gshare, tage, btb, ras (default %s)\n", BPRED_MODELS);
+    fprintf(stderr, "  --hostperf     count host cycles, instructions, branch and cache/TLB misses of the\n");
+    fprintf(stderr, "                 run (perf_event_open) and print them per guest instruction\n");
+    exit(0);
+}
+
+static void print_stats(FILE *out, Machine *machine, const char *prefix) {
+    fprintf(out, "%scycle: %lu\n", prefix, machine->cycle);
+    if (machine->smp->nharts>1) {
+        fprintf(out, "%sinstret: %lu\n", prefix, machine->cycle + machine->minstret_offset);
+    }
+    uint64_t tlb_access = machine->tlb_hit + machine->tlb_miss;
+    if (tlb_access!=0) {
+        fprintf(out, "%stlb: %lu hits, %lu misses (%.2f%% hit rate)\n", prefix,
+                machine->tlb_hit, machine->tlb_miss, 100.0 * machine->tlb_hit / tlb_access);
+    }
+}
+
+int main(int argc, char **argv, char **envp) {
+    static struct option long_options[] = {
+        {"syscall" , no_argument      , NULL, 's'},
+        {"linux"   , no_argument      , NULL, 'l'},
+        {"harts"   , required_argument, NULL, 'p'},
+        {"quantum" , required_argument, NULL, 'q'},
+        {"parallel", no_argument      , NULL, 'P'},
+        {"batch"   , no_argument      , NULL, 'b'},
+        {"jobs"    , required_argument, NULL, 'j'},
+        {"bench"   , required_argument, NULL, 'n'},
+        {"bench-json", required_argument, NULL, 'N'},
+        {"lanes"   , required_argument, NULL, 'L'},
+        {"interval"      , required_argument, NULL, 'i'},
+        {"bbv"           , required_argument, NULL, 'B'},
+        {"simpoints"     , required_argument, NULL, 'S'},
+        {"weights"       , required_argument, NULL, 'W'},
+        {"checkpoint-dir", required_argument, NULL, 'C'},
+        {"restore"       , required_argument, NULL, 'R'},
+        {"profile"       , required_argument, NULL, 'f'},
+        {"profile-folded", required_argument, NULL, 'F'},
+        {"mix"           , no_argument      , NULL, 'm'},
+        {"mix-json"      , required_argument, NULL, 'J'},
+        {"trace"         , required_argument, NULL, 't'},
+        {"log-commits"   , required_argument, NULL, 'c'},
+        {"sample"        , required_argument, NULL, 'a'},
+        {"sample-rate"   , required_argument, NULL, 'r'},
+        {"sample-stacks" , no_argument      , NULL, 'k'},
+        {"hostperf"      , no_argument      , NULL, 'H'},
+        {"cache"         , required_argument, NULL, 'x'},
+        {"cache-l1i"     , required_argument, NULL, 'y'},
+        {"cache-l1d"     , required_argument, NULL, 'z'},
+        {"cache-l2"      , required_argument, NULL, 'Z'},
+        {"timing"        , required_argument, NULL, 'T'},
+        {"pipeline"      , required_argument, NULL, 'e'},
+        {"bpred"         , required_argument, NULL, 'g'},
+        {"bpred-models"  , required_argument, NULL, 'G'},
+        {NULL      , 0                , NULL,  0 },
+    };
+    bool syscall_proxy = false;
+    bool linux_user    = false;
+    int  nharts        = 1;
+    uint64_t quantum   = 0;
+    bool parallel      = false;
+    bool batch         = false;
+    int  jobs          = 0;
+    int  bench         = 0;
+    const char *bench_json = NULL;
+    int  nlanes        = 0;
+    uint64_t interval  = SIMPOINT_INTERVAL;
+    const char *bbv       = NULL;
+    const char *simpoints = NULL;
+    const char *weights   = NULL;
+    const char *ckpt_dir  = NULL;
+    const char *restore   = NULL;
+    const char *profile   = NULL;
+    const char *folded    = NULL;
+    bool        mix       = false;
+    const char *mix_json  = NULL;
+    const char *trace     = NULL;
+    const char *commits   = NULL;
+    const char *sample    = NULL;
+    int         sample_rate   = SAMPLE_RATE;
+    bool        sample_stacks = false;
+    bool        hostperf  = false;
+    const char *cache     = NULL;
+    const char *cache_l1i = CACHE_L1I;
+    const char *cache_l1d = CACHE_L1D;
+    const char *cache_l2  = CACHE_L2;
+    const char *timing    = NULL;
+    const char *pipeline  = NULL;
+    const char *bpred     = NULL;
+    const char *bpred_models = BPRED_MODELS;
+    int  opt;
+    // "+": stop at the first non-option, the rest belongs to the guest
+    while ((opt = getopt_long(argc, argv, "+", long_options, NULL))!=-1) {
+        switch (opt) {
+        case 's': syscall_proxy = true                ; break;
+        case 'l': linux_user    = true                ; break;
+        case 'p': nharts        = atoi(optarg)        ; break;
+        case 'q': quantum       = strtoull(optarg, NULL, 0); break;
+        case 'P': parallel      = true                ; break;
+        case 'b': batch         = true                ; break;
+        case 'j': jobs          = atoi(optarg)        ; break;
+        case 'n': bench         = atoi(optarg)        ; break;
+        case 'N': bench_json    = optarg              ; break;
+        case 'L': nlanes        = atoi(optarg)        ; break;
+        case 'i': interval      = strtoull(optarg, NULL, 0); break;
+        case 'B': bbv           = optarg              ; break;
+        case 'S': simpoints     = optarg              ; break;
+        case 'W': weights       = optarg              ; break;
+        case 'C': ckpt_dir      = optarg              ; break;
+        case 'R': restore       = optarg              ; break;
+        case 'f': profile       = optarg              ; break;
+        case 'F': folded        = optarg              ; break;
+        case 'm': mix           = true                ; break;
+        case 'J': mix_json      = optarg              ; mix = true; break;
+        case 't': trace         = optarg              ; break;
+        case 'c': commits       = optarg              ; break;
+        case 'a': sample        = optarg              ; break;
+        case 'r': sample_rate   = atoi(optarg)        ; break;
+        case 'k': sample_stacks = true                ; break;
+        case 'H': hostperf      = true                ; break;
+        case 'x': cache         = optarg              ; break;
+        case 'y': cache_l1i     = optarg              ; break;
+        case 'z': cache_l1d     = optarg              ; break;
+        case 'Z': cache_l2      = optarg              ; break;
+        case 'T': timing        = optarg              ; break;
+        case 'e': pipeline      = optarg              ; break;
+        case 'g': bpred         = optarg              ; break;
+        case 'G': bpred_models  = optarg              ; break;
+        default : usage();                              break;
+        }
+    }
+    if (batch) {
+        if ((optind==argc) || linux_user || (nharts!=1)) {
+            usage();
+        }
+        std::vector<std::string> files = batch_files(argc-optind, argv+optind);
+        if (files.empty()) {
+            fprintf(stderr, "Error: no memfiles to run.\n");
+            exit(0);
+        }
+        return run_batch(files, syscall_proxy, jobs);
+    }
+    if ((bench!=0) || (bench_json!=NULL)) {
+        if ((bench<1) || (optind==argc) || linux_user || (nharts!=1)) {
+            usage();
+        }
+        std::vector<std::string> files = batch_files(argc-optind, argv+optind);
+        if (files.empty()) {
+            fprintf(stderr, "Error: no memfiles to run.\n");
+            exit(0);
+        }
+        return run_bench(files, syscall_proxy, bench, bench_json);
+    }
+    if ((optind==argc) || (!linux_user && (optind!=argc-1))) {
+        usage();
+    }
+    if (nlanes!=0) {
+        if ((nlanes<0) || linux_user || (nharts!=1)) {
+            usage();
+        }
+        Lanes lanes(argv[optind], nlanes, syscall_proxy);
+        auto start = std::chrono::steady_clock::now();
+        lanes.run();
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        std::vector<BatchResult> results;
+        return lanes.summary(results, seconds);
+    }
+    if ((nharts<1) || (nharts>MAX_HARTS) || (linux_user && (nharts>1))) {
+        fprintf(stderr, "Error: --harts must be 1-%d (1 in Linux user mode).\n", MAX_HARTS);
         exit(0);
     }
-    const char *memfile = argv[1];
+    if (parallel && (quantum==0)) {
+        usage();
+    }
+
+    // checkpoints hold a single hart and a bare-metal sized RAM, so Linux
+    // user mode can only write basic-block vectors
+    if ((simpoints!=NULL) || (restore!=NULL) || (bbv!=NULL)) {
+        if ((nharts!=1) || (linux_user && ((simpoints!=NULL) || (restore!=NULL))) || (interval==0)) {
+            usage();
+        }
+    }
+    // these share one run_hooked() loop (--trace, --log-commits, --cache,
+    // --timing and --bpred through the commit log); SimPoint runs its own,
+    // which may stop early
+    bool commit_log = (trace!=NULL) || (commits!=NULL) || (cache!=NULL) || (timing!=NULL) || (bpred!=NULL);
+    bool profiling  = (profile!=NULL) || (folded!=NULL);
+    bool hooked     = profiling || mix || commit_log || sample_stacks;
+    if (hooked && ((bbv!=NULL) || (simpoints!=NULL))) {
+        usage();
+    }
+    if ((hooked || (sample!=NULL)) && (nharts!=1)) {
+        usage();
+    }
+    // the timer period is 1e9/rate ns: 0 would disarm it
+    if ((sample_stacks && (sample==NULL)) || (sample_rate<1) || (sample_rate>1000000000)) {
+        usage();
+    }
 
-    Machine machine(memfile);
-    int halt;
+    Machine *machine;
+    if (linux_user) {
+        machine = new Machine(argc-optind, argv+optind, envp);
+    } else {
+        machine = new Machine(argv[optind]);
+        machine->syscall_proxy = syscall_proxy;
+    }
+    SMP *smp = machine->smp;
+    for (int i=1; i<nharts; i++) {
+        new Machine(*machine, i);
+    }
+    if (restore!=NULL) {
+        Checkpoint ckpt;
+        if (!ckpt.read(restore)) {
+            fprintf(stderr, "Error: checkpoint (%s) cannot be read.\n", restore);
+            exit(0);
+        }
+        ckpt.restore(*machine);
+    }
 
-    while (1) {
-        halt = machine.eval();
-#if defined(TRACE_RF)
-        machine.dump_regs();
-#endif
-        if (halt) {
-            printf("\n"                         );
-            printf("cycle: %d\n" , machine.cycle);
-            break;
+    SimPoint *sp = NULL;
+    if ((bbv!=NULL) || (simpoints!=NULL)) {
+        sp = new SimPoint(interval);
+        sp->memfile       = argv[optind];
+        sp->syscall_proxy = syscall_proxy;
+        sp->pipeline      = pipeline;
+        if (ckpt_dir!=NULL) {
+            sp->ckpt_dir = ckpt_dir;
         }
-    };
+        if ((bbv!=NULL) && !sp->open_bbv(bbv)) {
+            fprintf(stderr, "Error: bbv file (%s) cannot be opened.\n", bbv);
+            exit(0);
+        }
+        if ((simpoints!=NULL) && !sp->read_points(simpoints, weights)) {
+            fprintf(stderr, "Error: simpoints (%s) or weights cannot be read.\n", simpoints);
+            exit(0);
+        }
+    }
+
+    Profile *prof = NULL;
+    if (profiling) {
+        prof = new Profile;
+        if ((profile!=NULL) && !prof->open(profile)) {
+            fprintf(stderr, "Error: profile file (%s) cannot be opened.\n", profile);
+            exit(0);
+        }
+        if (is_elf(argv[optind])) {
+            prof->load_symbols(argv[optind], (linux_user) ? LINUX_PIE_BASE : 0);
+        }
+    }
+
+    Mix         imix;
+    TraceWriter tw;
+    if ((trace!=NULL) && !tw.open(trace, machine->reg, machine->cycle, machine->r.pc, machine->priv)) {
+        fprintf(stderr, "Error: trace file (%s) cannot be opened.\n", trace);
+        exit(0);
+    }
+    SpikeLog sl;
+    if ((commits!=NULL) && !sl.open(commits)) {
+        fprintf(stderr, "Error: commit log (%s) cannot be opened.\n", commits);
+        exit(0);
+    }
+    CacheSim csim;
+    if (cache!=NULL) {
+        CacheConfig l1i, l1d, l2;
+        bool        has_l2 = (std::string(cache_l2)!="none");
+        if (!l1i.parse(cache_l1i) || !l1d.parse(cache_l1d) || (has_l2 && !l2.parse(cache_l2))) {
+            fprintf(stderr, "Error: cache (%s, %s, %s) is not SIZE:WAYS:LINE[:lru|fifo|random[:wb|wt]].\n",
+                    cache_l1i, cache_l1d, cache_l2);
+            exit(0);
+        }
+        if (!csim.open(cache)) {
+            fprintf(stderr, "Error: cache file (%s) cannot be opened.\n", cache);
+            exit(0);
+        }
+        csim.init(*machine, l1i, l1d, (has_l2) ? &l2 : NULL);
+        if (is_elf(argv[optind])) {
+            csim.load_symbols(argv[optind], (linux_user) ? LINUX_PIE_BASE : 0);
+        }
+    }
+    Pipeline pipe;
+    if ((pipeline!=NULL) && !pipe.configure(pipeline)) {
+        fprintf(stderr, "Error: pipeline (%s) is not KEY=N,... of stages, load_use, mul, div, branch, fetch.\n", pipeline);
+        exit(0);
+    }
+    if (timing!=NULL) {
+        if (!pipe.open(timing)) {
+            fprintf(stderr, "Error: timing file (%s) cannot be opened.\n", timing);
+            exit(0);
+        }
+    }
+    BranchSim bsim;
+    if (bpred!=NULL) {
+        if (!bsim.configure(bpred_models)) {
+            fprintf(stderr, "Error: branch predictors (%s) are not NAME[:N],... of bimodal, gshare, tage, btb, ras.\n", bpred_models);
+            exit(0);
+        }
+        if (!bsim.open(bpred)) {
+            fprintf(stderr, "Error: bpred file (%s) cannot be opened.\n", bpred);
+            exit(0);
+        }
+        if (is_elf(argv[optind])) {
+            bsim.load_symbols(argv[optind], (linux_user) ? LINUX_PIE_BASE : 0);
+        }
+    }
+    Sampler sampler;
+    if (sample!=NULL) {
+        if (is_elf(argv[optind])) {
+            sampler.load_symbols(argv[optind], (linux_user) ? LINUX_PIE_BASE : 0);
+        }
+        if (!sampler.start(*machine, sample_rate, sample_stacks)) {
+            fprintf(stderr, "Error: the host timer cannot be set.\n");
+            exit(0);
+        }
+    }
+    HostPerf hp;
+    if (hostperf) {
+        if (!hp.open()) {
+            fprintf(stderr, "Error: host performance counters cannot be opened (kernel.perf_event_paranoid).\n");
+            exit(0);
+        }
+        hp.start();
+    }
+    if (sp!=NULL) {
+        sp->run(*machine);
+    } else if (hooked) {
+        CommitLog log;
+        Commit    c;
+        if (commit_log) {
+            log.begin(*machine);
+        }
+        if (prof!=NULL) {
+            prof->begin(*machine);
+        }
+        if (mix) {
+            imix.begin(*machine);
+        }
+        if (sample_stacks) {
+            sampler.begin(*machine);
+        }
+        run_hooked(*machine, [&](int halt) {
+            if (prof!=NULL) {
+                prof->record(*machine, halt);
+            }
+            if (mix) {
+                imix.record(*machine);
+            }
+            if (sample_stacks) {
+                sampler.record(*machine);
+            }
+            if (commit_log) {
+                log.record(*machine, c);
+                if (trace!=NULL) {
+                    tw.write(c);
+                }
+                if (commits!=NULL) {
+                    sl.write(c, *machine);
+                }
+                if (cache!=NULL) {
+                    csim.record(c);
+                }
+                if (timing!=NULL) {
+                    pipe.record(c);
+                }
+                if (bpred!=NULL) {
+                    bsim.record(c);
+                }
+            }
+            return true;
+        });
+        if (prof!=NULL) {
+            prof->end();
+        }
+        if (!tw.close()) {
+            fprintf(stderr, "Error: trace file (%s) cannot be written.\n", trace);
+        }
+        if (!sl.close()) {
+            fprintf(stderr, "Error: commit log (%s) cannot be written.\n", commits);
+        }
+    } else if (quantum!=0) {
+        if (parallel) {
+            smp->run_parallel(quantum);
+        } else {
+            smp->run_quantum(quantum);
+        }
+    } else if (nharts==1) {
+        machine->run();
+    } else {
+        smp->run_threads();
+    }
+    if (hostperf) {
+        hp.stop();
+    }
+
+    if (sample!=NULL) {
+        sampler.stop();
+        if (!sampler.write_folded(sample)) {
+            fprintf(stderr, "Error: sample file (%s) cannot be written.\n", sample);
+        }
+    }
+
+    // keep the guest's stdout clean in Linux mode
+    FILE *out = (linux_user) ? stderr : stdout;
+    fflush(stdout);
+    fprintf(out, "\n");
+    if (nharts==1) {
+        print_stats(out, machine, "");
+    } else {
+        char prefix[16];
+        for (int i=0; i<nharts; i++) {
+            snprintf(prefix, sizeof(prefix), "hart%d ", i);
+            print_stats(out, smp->harts[i], prefix);
+        }
+    }
+    if (sp!=NULL) {
+        sp->report();
+        delete sp;
+    }
+    if (prof!=NULL) {
+        prof->report();
+        if ((folded!=NULL) && !prof->write_folded(folded)) {
+            fprintf(stderr, "Error: folded stacks file (%s) cannot be written.\n", folded);
+        }
+        delete prof;
+    }
+    if (sample!=NULL) {
+        fprintf(out, "samples: %lu at %d Hz", (uint64_t)sampler.nsamples, sample_rate);
+        if (sampler.dropped!=0) {
+            fprintf(out, " (%lu dropped)", (uint64_t)sampler.dropped);
+        }
+        fprintf(out, "\n");
+    }
+    if (mix) {
+        imix.report(out);
+        if ((mix_json!=NULL) && !imix.write_json(mix_json)) {
+            fprintf(stderr, "Error: mix file (%s) cannot be written.\n", mix_json);
+        }
+    }
+    if (cache!=NULL) {
+        csim.report();
+    }
+    if (timing!=NULL) {
+        pipe.report();
+    }
+    if (bpred!=NULL) {
+        bsim.report();
+    }
+    if (hostperf) {
+        uint64_t instret = 0;
+        for (int i=0; i<nharts; i++) {
+            instret += smp->harts[i]->cycle + smp->harts[i]->minstret_offset;
+        }
+        hp.report(out, instret);
+    }
 
-    return 0;
+    int exit_code = smp->exit_code;
+    for (int i=nharts-1; i>=0; i--) {
+        delete smp->harts[i]; // hart 0 (and with it the shared state) last
+    }
+    return exit_code;
 }
@@ -0,0 +1,104 @@
+#include <cstdio>
+#include <cstring>
+#include <algorithm>
+#include <map>
+#include <string>
+#include <vector>
+#include "machine.h"
+#include "mix.h"
+
+static const char *class_name[MIX_CLASSES] = {
+    "alu", "load", "store", "branch_taken", "branch_not_taken", "jump", "muldiv", "amo", "fence", "system",
+};
+
+// class by opcode[6:2] of a 32-bit instruction; OP/OP-32 with funct7=1 are
+// mul/div and branches are split into taken/not taken
+static const int8_t opcode_class[32] = {
+    MIX_LOAD , -1, -1, MIX_FENCE, MIX_ALU, MIX_ALU, MIX_ALU, -1, // 00000-00111
+    MIX_STORE, -1, -1, MIX_AMO  , MIX_ALU, MIX_ALU, MIX_ALU, -1, // 01000-01111
+    -1       , -1, -1, -1       , -1     , -1     , -1     , -1, // 10000-10111
+    MIX_TAKEN, MIX_JUMP, -1, MIX_JUMP, MIX_SYSTEM, -1, -1, -1,   // 11000-11111
+};
+
+Mix::Mix() {
+    icount     = 0;
+    compressed = 0;
+    ntrap      = 0;
+    for (int i=0; i<MIX_CLASSES; i++) {
+        cls[i] = 0;
+    }
+}
+
+void Mix::begin(Machine &m) {
+    ntrap = m.ntrap;
+}
+
+void Mix::record(Machine &m) {
+    if (m.ntrap!=ntrap) {
+        ntrap = m.ntrap;
+        return;
+    }
+    icount++;
+    compressed += m.is_compressed;
+    mnemonic[m.instr]++;
+    uint8_t opcode = (m.ir >> 2) & 0x1f;
+    int     c      = opcode_class[opcode];
+    if (((opcode==0b01100) || (opcode==0b01110)) && (((m.ir >> 25) & 0x7f)==0b0000001)) {
+        c = MIX_MULDIV;
+    } else if ((c==MIX_TAKEN) && (m.r.pc==m.pc+((m.is_compressed) ? 2 : 4))) {
+        c = MIX_NTAKEN;
+    }
+    if (c>=0) {
+        cls[c]++;
+    }
+}
+
+// mnemonics by count; the same mnemonic may come from several literals
+static std::vector<std::pair<std::string, uint64_t>> by_count(const std::unordered_map<const char *, uint64_t> &counts) {
+    std::map<std::string, uint64_t> merged;
+    for (auto &e : counts) {
+        merged[e.first] += e.second;
+    }
+    std::vector<std::pair<std::string, uint64_t>> v(merged.begin(), merged.end());
+    std::stable_sort(v.begin(), v.end(), [](const std::pair<std::string, uint64_t> &a, const std::pair<std::string, uint64_t> &b) {
+        return a.second>b.second;
+    });
+    return v;
+}
+
+void Mix::report(FILE *fp) {
+    double total = (icount!=0) ? (double)icount : 1.0;
+    fprintf(fp, "\ninstruction mix: %lu instructions, %lu compressed (%.2f%%), %lu full-width (%.2f%%)\n",
+            icount, compressed, 100.0*compressed/total, icount-compressed, 100.0*(icount-compressed)/total);
+    for (int i=0; i<MIX_CLASSES; i++) {
+        fprintf(fp, "  %-16s  %14lu  %6.2f%%\n", class_name[i], cls[i], 100.0*cls[i]/total);
+    }
+    fprintf(fp, "\n");
+    for (auto &e : by_count(mnemonic)) {
+        fprintf(fp, "  %-16s  %14lu  %6.2f%%\n", e.first.c_str(), e.second, 100.0*e.second/total);
+    }
+}
+
+bool Mix::write_json(const char *filename) {
+    FILE *fp = fopen(filename, "w");
+    if (fp==NULL) {
+        return false;
+    }
+    fprintf(fp, "{\n");
+    fprintf(fp, "  \"instructions\": %lu,\n", icount);
+    fprintf(fp, "  \"compressed\": %lu,\n", compressed);
+    fprintf(fp, "  \"full_width\": %lu,\n", icount-compressed);
+    fprintf(fp, "  \"classes\": {\n");
+    for (int i=0; i<MIX_CLASSES; i++) {
+        fprintf(fp, "    \"%s\": %lu%s\n", class_name[i], cls[i], (i<MIX_CLASSES-1) ? "," : "");
+    }
+    fprintf(fp, "  },\n");
+    fprintf(fp, "  \"mnemonics\": {\n");
+    auto v = by_count(mnemonic);
+    for (size_t i=0; i<v.size(); i++) {
+        fprintf(fp, "    \"%s\": %lu%s\n", v[i].first.c_str(), v[i].second, (i<v.size()-1) ? "," : "");
+    }
+    fprintf(fp, "  }\n");
+    fprintf(fp, "}\n");
+    return fclose(fp)==0;
+}
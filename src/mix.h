@@ -0,0 +1,52 @@
+#if !defined(MIX_H_)
+#define MIX_H_
+
+#include <cstdio>
+#include <unordered_map>
+#include "rvemu.h"
+
+struct Machine;
+
+//------------------------------------------------------------------------------
+// Instruction mix (--mix, --mix-json)
+//------------------------------------------------------------------------------
+// Dynamic counts of the retired instructions by mnemonic and by class,
+// counted as they execute. Mnemonics are those exec() sets in instr (a
+// compressed instruction counts as the instruction it expands to); classes
+// come from the opcode of the expanded instruction. Instructions that trap
+// (those trap() counts, as for minstret) are not counted.
+//
+// A branch counts as taken when the next pc is not the fall-through one, so
+// a taken branch to the next instruction counts as not taken.
+enum MixClass {
+    MIX_ALU   ,
+    MIX_LOAD  ,
+    MIX_STORE ,
+    MIX_TAKEN , // branch
+    MIX_NTAKEN, // branch
+    MIX_JUMP  ,
+    MIX_MULDIV,
+    MIX_AMO   , // including lr/sc
+    MIX_FENCE ,
+    MIX_SYSTEM, // csr*, ecall, ebreak, xret, wfi, sfence.vma
+    MIX_CLASSES
+};
+
+struct Mix {
+    uint64_t icount    ;
+    uint64_t compressed;
+    uint64_t cls[MIX_CLASSES];
+    uint64_t ntrap     ; // Machine::ntrap after the last instruction
+    std::unordered_map<const char *, uint64_t> mnemonic; // keyed by the instr literal
+
+    Mix();
+
+    // Counts the instructions of a run_hooked() loop (hook.h): begin()
+    // before it, record() after every eval().
+    void begin (Machine &m);
+    void record(Machine &m);
+    void report(FILE *fp);
+    bool write_json(const char *filename);
+};
+
+#endif // MIX_H_
@@ -0,0 +1,174 @@
+#include <cstdio>
+#include <cstdlib>
+#include "machine.h"
+#include "csr.h"
+#include "mmu.h"
+
+TLB::TLB() {
+    flush();
+}
+
+void TLB::flush() {
+    for (int i=0; i<TLB_SIZE; i++) {
+        tag_r[i] = TLB_INVALID;
+        tag_w[i] = TLB_INVALID;
+        tag_x[i] = TLB_INVALID;
+    }
+}
+
+static const uintx_t page_fault[] = {CAUSE_FETCH_PAGE_FAULT, CAUSE_LOAD_PAGE_FAULT, CAUSE_STORE_PAGE_FAULT};
+static const uintx_t access_fault[] = {CAUSE_FETCH_ACCESS, CAUSE_LOAD_ACCESS, CAUSE_STORE_ACCESS};
+
+// Select the TLBs for the current privilege level. Called whenever priv,
+// mstatus.MPRV/MPP or satp may have changed.
+void Machine::update_vm() {
+    bool    vm   = (satp & SATP_MODE)==SATP_MODE_SV;
+    uint8_t dprv = (mstatus & MSTATUS_MPRV) ? (mstatus & MSTATUS_MPP) >> MSTATUS_MPP_SHIFT : priv;
+    fetch_tlb = (vm && (priv<PRV_M)) ? &tlb[priv] : NULL;
+    data_tlb  = (vm && (dprv<PRV_M)) ? &tlb[dprv] : NULL;
+}
+
+// sfence.vma, satp writes and changes of SUM/MXR. There are no decoded-code
+// caches, so the TLBs are all there is to invalidate.
+void Machine::tlb_flush() {
+    tlb[PRV_U].flush();
+    tlb[PRV_S].flush();
+}
+
+// Virtual to physical address through the TLB, walking the page table on a
+// miss. Raises a page fault or an access fault.
+uint64_t Machine::translate(uintx_t addr, int type) {
+    TLB      *t   = (type==ACCESS_FETCH) ? fetch_tlb : data_tlb;
+    if (t==NULL) {
+        return addr;
+    }
+    uintx_t   idx = TLB_INDEX(addr);
+    uintx_t   tag = (type==ACCESS_FETCH) ? t->tag_x[idx] : (type==ACCESS_LOAD) ? t->tag_r[idx] : t->tag_w[idx];
+    if (tag==(addr & ~PGMASK)) {
+        tlb_hit++;
+        return (uint64_t)(t->addend[idx] + addr - (uintptr_t)ram.ram);
+    }
+    tlb_miss++;
+
+    uint8_t prv = (t==&tlb[PRV_S]) ? PRV_S : PRV_U;
+    Exception fault = {page_fault[type], addr};
+#if XLEN == 64
+    if ((intx_t)addr != ((intx_t)addr << (XLEN-39)) >> (XLEN-39)) {
+        throw fault; // not sign-extended from bit 38
+    }
+#endif
+
+    uint64_t a = (uint64_t)(satp & SATP_PPN) << PGSHIFT;
+    for (int level=PT_LEVELS-1; level>=0; level--) {
+        uintx_t  vpn      = (addr >> (PGSHIFT + level*PT_VPN_BITS)) & ((1 << PT_VPN_BITS) - 1);
+        uint64_t pte_addr = a + vpn*(XLEN/8);
+        uint8_t *p        = (pte_addr<ram.size) ? ram.ptr(pte_addr, XLEN/8) : NULL;
+        if (p==NULL) {
+            throw Exception{access_fault[type], addr};
+        }
+        uintx_t pte = *(uintx_t *)p;
+        uint64_t ppn = (pte >> 10) & PTE_PPN_MASK;
+        if (!(pte & PTE_V) || (!(pte & PTE_R) && (pte & PTE_W))) {
+            throw fault;
+        }
+        if (!(pte & (PTE_R | PTE_X))) {
+            a = ppn << PGSHIFT; // pointer to the next level
+            continue;
+        }
+
+        // leaf
+        bool u_ok = (prv==PRV_U) ? (pte & PTE_U) : (!(pte & PTE_U) || ((type!=ACCESS_FETCH) && (mstatus & MSTATUS_SUM)));
+        bool r_ok = (pte & PTE_R) || ((pte & PTE_X) && (mstatus & MSTATUS_MXR));
+        bool ok   = (type==ACCESS_FETCH) ? (pte & PTE_X) : (type==ACCESS_LOAD) ? r_ok : (pte & PTE_W);
+        if (!u_ok || !ok) {
+            throw fault;
+        }
+        uint64_t super = ((uint64_t)1 << (level*PT_VPN_BITS)) - 1;
+        if (ppn & super) {
+            throw fault; // misaligned superpage
+        }
+        // A/D are updated by the walker
+        uintx_t ad = PTE_A | ((type==ACCESS_STORE) ? PTE_D : 0);
+        if ((pte & ad)!=ad) {
+            pte |= ad;
+            *(uintx_t *)p = pte;
+        }
+        uint64_t paddr = ((ppn | ((addr >> PGSHIFT) & super)) << PGSHIFT) | (addr & PGMASK);
+
+        // Only RAM pages are cached; device accesses always walk.
+        uint64_t page = paddr & ~(uint64_t)PGMASK;
+        if (page+PGSIZE<=ram.size) {
+            uintx_t vpage = addr & ~PGMASK;
+            if (t->addend[idx]!=(uintptr_t)ram.ram + page - vpage) {
+                t->tag_r[idx] = TLB_INVALID;
+                t->tag_w[idx] = TLB_INVALID;
+                t->tag_x[idx] = TLB_INVALID;
+                t->addend[idx] = (uintptr_t)ram.ram + page - vpage;
+            }
+            // grant every access this PTE allows, not only the one that missed
+            bool du_ok = (prv==PRV_U) ? (pte & PTE_U) : (!(pte & PTE_U) || (mstatus & MSTATUS_SUM));
+            bool xu_ok = (prv==PRV_U) ? (pte & PTE_U) : !(pte & PTE_U);
+            if (du_ok && r_ok                          ) t->tag_r[idx] = vpage;
+            if (du_ok && (pte & PTE_W) && (pte & PTE_D)) t->tag_w[idx] = vpage;
+            if (xu_ok && (pte & PTE_X)                 ) t->tag_x[idx] = vpage;
+        }
+        return paddr;
+    }
+    throw fault;
+}
+
+uint64_t Machine::phys_read(uint64_t paddr, int len, int type) {
+    if (paddr+len<=ram.size) {
+        switch (len) {
+        case 1 : return ram.read_uint8 (paddr);
+        case 2 : return ram.read_uint16(paddr);
+        case 4 : return ram.read_uint32(paddr);
+        default: return ram.read_uint64(paddr);
+        }
+    }
+    if ((paddr>=mmio_base) && (paddr==(uintx_t)paddr)) {
+        return mmio_read(paddr, len);
+    }
+    throw Exception{access_fault[type], (uintx_t)paddr};
+}
+
+void Machine::phys_write(uint64_t paddr, uint64_t data, int len) {
+    if (paddr+len<=ram.size) {
+        switch (len) {
+        case 1 : ram.write_uint8 (paddr, data); break;
+        case 2 : ram.write_uint16(paddr, data); break;
+        case 4 : ram.write_uint32(paddr, data); break;
+        default: ram.write_uint64(paddr, data); break;
+        }
+        return;
+    }
+    if ((paddr>=mmio_base) && (paddr==(uintx_t)paddr)) {
+        mmio_write(paddr, data, len);
+        return;
+    }
+    throw Exception{CAUSE_STORE_ACCESS, (uintx_t)paddr};
+}
+
+// Slow paths of target_read/target_write/fetch with translation on: TLB
+// misses, misaligned and page-crossing accesses, and device pages.
+uint64_t Machine::mmu_read(uintx_t addr, int len, int type) {
+    if ((addr & PGMASK) + len <= PGSIZE) {
+        return phys_read(translate(addr, type), len, type);
+    }
+    uint64_t data = 0;
+    for (int i=0; i<len; i++) {
+        data |= phys_read(translate(addr+i, type), 1, type) << (i*8);
+    }
+    return data;
+}
+
+void Machine::mmu_write(uintx_t addr, uint64_t data, int len) {
+    if ((addr & PGMASK) + len <= PGSIZE) {
+        phys_write(translate(addr, ACCESS_STORE), data, len);
+        return;
+    }
+    translate(addr+len-1, ACCESS_STORE); // fault before anything is written
+    for (int i=0; i<len; i++) {
+        phys_write(translate(addr+i, ACCESS_STORE), data >> (i*8), 1);
+    }
+}
@@ -0,0 +1,76 @@
+#if !defined(MMU_H_)
+#define MMU_H_
+
+#include <cstdint>
+#include "rvemu.h"
+
+//------------------------------------------------------------------------------
+// Sv32 (RV32) / Sv39 (RV64)
+//------------------------------------------------------------------------------
+#define PGSHIFT 12
+#define PGSIZE  ((uintx_t)1 << PGSHIFT)
+#define PGMASK  (PGSIZE-1)
+
+#if XLEN == 32
+#define SATP_MODE       0x80000000
+#define SATP_MODE_SV    0x80000000 // Sv32
+#define SATP_PPN        0x003fffff
+#define PTE_PPN_MASK    0x3fffff
+#define PT_LEVELS       2
+#define PT_VPN_BITS     10
+#else
+#define SATP_MODE       0xf000000000000000
+#define SATP_MODE_SV    0x8000000000000000 // Sv39
+#define SATP_PPN        0x00000fffffffffff
+#define PTE_PPN_MASK    0xfffffffffff
+#define PT_LEVELS       3
+#define PT_VPN_BITS     9
+#endif
+
+#define PTE_V 0x01
+#define PTE_R 0x02
+#define PTE_W 0x04
+#define PTE_X 0x08
+#define PTE_U 0x10
+#define PTE_G 0x20
+#define PTE_A 0x40
+#define PTE_D 0x80
+
+#define ACCESS_FETCH 0
+#define ACCESS_LOAD  1
+#define ACCESS_STORE 2
+
+//------------------------------------------------------------------------------
+// Software TLB
+//------------------------------------------------------------------------------
+#if !defined(TLB_SIZE)
+#define TLB_SIZE 256 // entries, direct-mapped
+#endif
+
+#define TLB_INVALID ((uintx_t)-1)
+
+// One TLB per translated privilege level (U, S). An entry maps one virtual
+// page to host memory; tag_r/tag_w/tag_x hold the page address if that kind of
+// access is allowed, so a hit costs one compare. The tag is compared with the
+// address masked to the page and the access alignment, so misaligned accesses
+// always take the slow path and a hit never crosses a page.
+struct TLB {
+    uintx_t   tag_r [TLB_SIZE];
+    uintx_t   tag_w [TLB_SIZE];
+    uintx_t   tag_x [TLB_SIZE];
+    uintptr_t addend[TLB_SIZE]; // host address - guest virtual address
+
+    TLB();
+    void flush();
+};
+
+#define TLB_INDEX(addr)    (((addr) >> PGSHIFT) & (TLB_SIZE-1))
+#define TLB_TAG(addr, len) ((addr) & (~PGMASK | ((len)-1)))
+
+// Raised by the memory access paths and turned into a trap by eval().
+struct Exception {
+    uintx_t cause;
+    uintx_t tval ;
+};
+
+#endif // MMU_H_
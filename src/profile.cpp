@@ -0,0 +1,315 @@
+#include <cstdio>
+#include <cstdlib>
+#include <algorithm>
+#include <map>
+#include "machine.h"
+#include "hook.h"
+#include "profile.h"
+#include "disasm.h"
+
+Profile::Profile() {
+    fp     = NULL;
+    icount = 0;
+}
+
+Profile::~Profile() {
+    if ((fp!=NULL) && (fp!=stdout) && (fp!=stderr)) {
+        fclose(fp);
+    }
+}
+
+// "-" is stderr, which keeps the report apart from the guest's stdout
+bool Profile::open(const char *filename) {
+    fp = (std::string(filename)=="-") ? stderr : fopen(filename, "w");
+    return fp!=NULL;
+}
+
+void Profile::load_symbols(const char *elf, uintx_t bias) {
+    ::load_symbols(elf, syms, bias);
+}
+
+int Profile::lookup(uintx_t pc) {
+    return find_symbol(syms, pc);
+}
+
+void Profile::call(uintx_t target, uintx_t ret) {
+    int sym    = lookup(target);
+    int parent = (stack.empty()) ? -1 : stack.back().node;
+    ContextKey key = {parent, (sym<(int)syms.size()) ? (uint64_t)sym : ((uint64_t)1 << 63) | target};
+    auto it = children.find(key);
+    if (it==children.end()) {
+        it = children.emplace(key, contexts.size()).first;
+        contexts.push_back({parent, sym, target, 0, 0});
+    }
+    contexts[it->second].calls++;
+    stack.push_back({sym, ret, icount, it->second});
+    depth[sym]++;
+}
+
+void Profile::pop() {
+    Frame &f = stack.back();
+    if (--depth[f.sym]==0) {
+        inclusive[f.sym] += icount - f.icount;
+    }
+    stack.pop_back();
+}
+
+void Profile::ret(uintx_t target) {
+    for (size_t k=stack.size(); k>1; k--) {
+        if (stack[k-1].ret==target) {
+            while (stack.size()>=k) {
+                pop();
+            }
+            return;
+        }
+    }
+}
+
+void Profile::begin(Machine &m) {
+    depth    .assign(syms.size()+1, 0);
+    inclusive.assign(syms.size()+1, 0);
+    call(m.r.pc, (uintx_t)-1); // the entry point is the root of the call graph
+    bb = {m.r.pc, 0, 0};
+}
+
+void Profile::record(Machine &m, int halt) {
+    icount++;
+    bb_ir[bb.len] = (m.is_compressed) ? m.cir : m.ir;
+    bb.rvc       |= (uint64_t)m.is_compressed << bb.len;
+    bb.len++;
+    uint8_t opcode = (m.ir >> 2) & 0x1f;
+    uintx_t next   = m.pc + ((m.is_compressed) ? 2 : 4);
+    if ((opcode>=0b11000) || (m.r.pc!=next) || halt || (bb.len==PROFILE_BLOCK_MAX)) {
+        auto it = blocks.find(bb);
+        if (it==blocks.end()) {
+            it = blocks.emplace(bb, Block{0, std::vector<uint32_t>(bb_ir, bb_ir+bb.len)}).first;
+        }
+        it->second.count++;
+        contexts[stack.back().node].self += bb.len;
+
+        int link = link_kind(m.ir);
+        if (link & LINK_RET) {
+            ret(m.r.pc);
+        }
+        if (link & LINK_CALL) {
+            call(m.r.pc, next);
+        }
+        bb = {m.r.pc, 0, 0};
+    }
+}
+
+void Profile::end() {
+    while (!stack.empty()) {
+        pop();
+    }
+}
+
+std::string Profile::frame_name(int sym, uintx_t target) {
+    if (sym<(int)syms.size()) {
+        return syms[sym].name;
+    }
+    char hex[24];
+    snprintf(hex, sizeof(hex), "0x%lx", (uint64_t)target);
+    return hex;
+}
+
+// one line per calling context with instructions of its own: the path from
+// the root and the count
+bool Profile::write_folded(const char *filename) {
+    FILE *fp = fopen(filename, "w");
+    if (fp==NULL) {
+        return false;
+    }
+    std::vector<std::string> path(contexts.size());
+    for (size_t i=0; i<contexts.size(); i++) {
+        Context &c = contexts[i];
+        path[i] = frame_name(c.sym, c.target);
+        if (c.parent>=0) {
+            path[i] = path[c.parent] + ';' + path[i]; // parents come first
+        }
+        if (c.self!=0) {
+            fprintf(fp, "%s %lu\n", path[i].c_str(), c.self);
+        }
+    }
+    return fclose(fp)==0;
+}
+
+void Profile::report_call_graph(const std::vector<uint64_t> &self) {
+    size_t n = contexts.size();
+    size_t nsyms = syms.size();
+
+    // inclusive count per context; children come after their parents
+    std::vector<uint64_t> total(n);
+    for (size_t i=0; i<n; i++) {
+        total[i] = contexts[i].self;
+    }
+    for (size_t i=n; i-->0; ) {
+        if (contexts[i].parent>=0) {
+            total[contexts[i].parent] += total[i];
+        }
+    }
+
+    // edges between functions; inclusive only from outermost activations
+    struct Edge {
+        uint64_t calls;
+        uint64_t self ;
+        uint64_t total;
+    };
+    std::map<std::pair<int, int>, Edge> edges;
+    std::vector<uint64_t>            calls(nsyms+1, 0);
+    std::vector<std::vector<int>>    kids (n);
+    for (size_t i=0; i<n; i++) {
+        if (contexts[i].parent>=0) {
+            kids[contexts[i].parent].push_back(i);
+        }
+    }
+    std::vector<int> active(nsyms+1, 0);
+    std::vector<std::pair<int, bool>> todo = {{0, false}};
+    while (!todo.empty()) {
+        int  i     = todo.back().first;
+        bool leave = todo.back().second;
+        todo.pop_back();
+        Context &c = contexts[i];
+        if (leave) {
+            active[c.sym]--;
+            continue;
+        }
+        calls[c.sym] += c.calls;
+        if (c.parent>=0) {
+            Edge &e = edges[{contexts[c.parent].sym, c.sym}];
+            e.calls += c.calls;
+            e.self  += c.self;
+            e.total += (active[c.sym]==0) ? total[i] : 0;
+        }
+        active[c.sym]++;
+        todo.push_back({i, true});
+        for (int k : kids[i]) {
+            todo.push_back({k, false});
+        }
+    }
+
+    std::vector<int> order;
+    for (size_t i=0; i<=nsyms; i++) {
+        if (inclusive[i]!=0) {
+            order.push_back(i);
+        }
+    }
+    std::sort(order.begin(), order.end(), [&](int a, int b) {
+        return (inclusive[a]>inclusive[b]) || ((inclusive[a]==inclusive[b]) && (self[a]>self[b]));
+    });
+    std::vector<int> index(nsyms+1, 0);
+    for (size_t k=0; k<order.size(); k++) {
+        index[order[k]] = k+1;
+    }
+    auto name = [&](int i) {
+        return (i<(int)nsyms) ? syms[i].name.c_str() : "[unknown]";
+    };
+    double all = (icount!=0) ? (double)icount : 1.0;
+    char   num[32];
+
+    fprintf(fp, "\n# call graph: callers above each function, callees below\n");
+    fprintf(fp, "#\n");
+    fprintf(fp, "# %5s  %7s  %12s  %12s  %17s  %s\n", "index", "incl%", "self", "inclusive", "calls", "function");
+    for (int f : order) {
+        fprintf(fp, "\n");
+        bool caller = false;
+        for (auto &e : edges) {
+            if (e.first.second==f) {
+                snprintf(num, sizeof(num), "%lu/%lu", e.second.calls, calls[f]);
+                fprintf(fp, "  %5s  %7s  %12lu  %12lu  %17s      %s [%d]\n", "", "", e.second.self, e.second.total, num,
+                        name(e.first.first), index[e.first.first]);
+                caller = true;
+            }
+        }
+        if (!caller) {
+            fprintf(fp, "  %5s  %7s  %12s  %12s  %17s      <spontaneous>\n", "", "", "", "", "");
+        }
+        snprintf(num, sizeof(num), "[%d]", index[f]);
+        fprintf(fp, "  %5s  %6.2f%%  %12lu  %12lu  %17lu  %s %s\n", num, 100.0*inclusive[f]/all, self[f], inclusive[f],
+                calls[f], name(f), num);
+        for (auto &e : edges) {
+            if (e.first.first==f) {
+                snprintf(num, sizeof(num), "%lu/%lu", e.second.calls, calls[e.first.second]);
+                fprintf(fp, "  %5s  %7s  %12lu  %12lu  %17s      %s [%d]\n", "", "", e.second.self, e.second.total, num,
+                        name(e.first.second), index[e.first.second]);
+            }
+        }
+    }
+}
+
+void Profile::report() {
+    if (fp==NULL) {
+        return;
+    }
+    // instructions per pc
+    struct Line {
+        uint64_t count;
+        uint32_t ir   ;
+    };
+    std::map<uintx_t, Line> lines;
+    for (auto &b : blocks) {
+        uintx_t pc = b.first.start;
+        for (uint32_t i=0; i<b.first.len; i++) {
+            Line &l = lines[pc];
+            l.count += b.second.count;
+            l.ir     = b.second.ir[i];
+            pc      += ((b.first.rvc >> i) & 0x1) ? 2 : 4;
+        }
+    }
+
+    size_t nsyms = syms.size();
+    std::vector<uint64_t> self(nsyms+1, 0);
+    for (auto &l : lines) {
+        self[lookup(l.first)] += l.second.count;
+    }
+    std::vector<int> order;
+    for (size_t i=0; i<=nsyms; i++) {
+        if ((self[i]!=0) || (inclusive[i]!=0)) {
+            order.push_back(i);
+        }
+    }
+    std::sort(order.begin(), order.end(), [&](int a, int b) {
+        return (self[a]>self[b]) || ((self[a]==self[b]) && (inclusive[a]>inclusive[b]));
+    });
+    auto name = [&](int i) {
+        return (i<(int)nsyms) ? syms[i].name.c_str() : "[unknown]";
+    };
+    double total = (icount!=0) ? (double)icount : 1.0;
+
+    fprintf(fp, "# %lu instructions, %lu basic blocks\n", icount, (uint64_t)blocks.size());
+    fprintf(fp, "#\n");
+    fprintf(fp, "# %12s  %7s  %12s  %7s  %s\n", "self", "self%", "inclusive", "incl%", "function");
+    for (int i : order) {
+        fprintf(fp, "  %12lu  %6.2f%%  %12lu  %6.2f%%  %s\n",
+                self[i], 100.0*self[i]/total, inclusive[i], 100.0*inclusive[i]/total, name(i));
+    }
+
+    report_call_graph(self);
+
+    char text[64], raw[16];
+    for (size_t k=0; (k<order.size()) && (k<PROFILE_ANNOTATE); k++) {
+        int i = order[k];
+        if (self[i]==0) {
+            break;
+        }
+        fprintf(fp, "\n# %s: %lu instructions (%.2f%%)\n", name(i), self[i], 100.0*self[i]/total);
+        fprintf(fp, "# %12s  %7s  %16s  %8s  %s\n", "count", "percent", "address", "raw", "instruction");
+        uintx_t expect = 0;
+        bool    first  = true;
+        for (auto &l : lines) {
+            if (lookup(l.first)!=i) {
+                continue;
+            }
+            if (!first && (l.first!=expect)) {
+                fprintf(fp, "  %12s\n", "...");
+            }
+            first  = false;
+            int len = insn_length(l.second.ir);
+            expect  = l.first + len;
+            snprintf(raw, sizeof(raw), (len==4) ? "%08x" : "%04x", l.second.ir);
+            fprintf(fp, "  %12lu  %6.2f%%  %16lx  %8s  %s\n", l.second.count, 100.0*l.second.count/total,
+                    (uint64_t)l.first, raw, disasm(l.first, l.second.ir, text, sizeof(text)));
+        }
+    }
+    fflush(fp);
+}
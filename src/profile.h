@@ -0,0 +1,138 @@
+#if !defined(PROFILE_H_)
+#define PROFILE_H_
+
+#include <cstdio>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "rvemu.h"
+#include "loader.h"
+
+struct Machine;
+
+//------------------------------------------------------------------------------
+// Execution profile (--profile)
+//------------------------------------------------------------------------------
+// Exact instruction counts, gathered per basic block: the run loop counts a
+// block once when it ends, so there is one hash lookup per block rather than
+// per instruction. A block is identified by its entry pc, its length and which
+// of its instructions are compressed, which is all it takes to recover the pc
+// of every instruction in it.
+//
+// Calls and returns (link_kind(), hook.h) are followed on a shadow stack to
+// give every function the instructions executed while it was active
+// (inclusive), next to the ones executed in its own code (self). A return
+// pops back to the frame that expects that return address; one that no frame
+// expects (longjmp, context switch) is ignored.
+//
+// Every frame is also a node of a calling-context tree: one node per distinct
+// call path from the entry point, which is charged the instructions executed
+// in its own code while it is on top of the stack. Its paths are written as
+// folded stacks (--profile-folded) for flamegraphs, and the edges between
+// functions give a gprof-like call graph: the calls along each edge and the
+// instructions executed in the callee (self) and while it was active
+// (inclusive; for a recursive callee only its outermost activation counts).
+//
+// The report lists the functions of the ELF symbol table by self count, the
+// call graph, and the annotated disassembly of the PROFILE_ANNOTATE hottest
+// functions.
+#if !defined(PROFILE_ANNOTATE)
+#define PROFILE_ANNOTATE 5 // functions
+#endif
+
+#define PROFILE_BLOCK_MAX 64 // instructions; longer blocks are split
+
+struct BlockKey {
+    uintx_t  start;
+    uint32_t len  ;
+    uint64_t rvc  ; // bit i: instruction i is compressed
+
+    bool operator==(const BlockKey &b) const {
+        return (start==b.start) && (len==b.len) && (rvc==b.rvc);
+    }
+};
+
+struct BlockKeyHash {
+    size_t operator()(const BlockKey &k) const {
+        return (k.start * 0x9e3779b97f4a7c15ULL) ^ (k.rvc * 0xff51afd7ed558ccdULL) ^ k.len;
+    }
+};
+
+struct Block {
+    uint64_t              count;
+    std::vector<uint32_t> ir   ; // as first executed; compressed ones in the low halfword
+};
+
+struct Frame {
+    int      sym   ; // index in syms, or syms.size() for code without a symbol
+    uintx_t  ret   ; // return address the caller expects
+    uint64_t icount; // when the function was entered
+    int      node  ; // in contexts
+};
+
+// node of the calling-context tree
+struct Context {
+    int      parent; // -1 for the root
+    int      sym   ;
+    uintx_t  target; // entry address, which names code without a symbol
+    uint64_t calls ;
+    uint64_t self  ; // instructions executed in this context's own code
+};
+
+// child of a node: a symbol, or the entry address of code without one
+struct ContextKey {
+    int      parent;
+    uint64_t callee;
+
+    bool operator==(const ContextKey &k) const {
+        return (parent==k.parent) && (callee==k.callee);
+    }
+};
+
+struct ContextKeyHash {
+    size_t operator()(const ContextKey &k) const {
+        return (k.callee * 0x9e3779b97f4a7c15ULL) ^ k.parent;
+    }
+};
+
+struct Profile {
+    FILE                *fp;
+    std::vector<Symbol>  syms;
+    std::unordered_map<BlockKey, Block, BlockKeyHash> blocks;
+    uint64_t             icount;
+
+    // the block being run
+    BlockKey             bb;
+    uint32_t             bb_ir[PROFILE_BLOCK_MAX];
+
+    // shadow stack
+    std::vector<Frame>    stack    ;
+    std::vector<int>      depth    ; // frames per symbol (recursion counts once)
+    std::vector<uint64_t> inclusive;
+
+    // calling-context tree
+    std::vector<Context> contexts;
+    std::unordered_map<ContextKey, int, ContextKeyHash> children;
+
+    Profile();
+    ~Profile();
+
+    bool open(const char *filename);
+    void load_symbols(const char *elf, uintx_t bias);
+
+    // Counts the instructions of a run_hooked() loop (hook.h): begin()
+    // before it, record() after every eval(), end() after it.
+    void begin (Machine &m);
+    void record(Machine &m, int halt);
+    void end   ();
+    int  lookup(uintx_t pc);
+    void call(uintx_t target, uintx_t ret);
+    void ret (uintx_t target);
+    void pop ();
+    std::string frame_name(int sym, uintx_t target);
+    void report();
+    void report_call_graph(const std::vector<uint64_t> &self);
+    bool write_folded(const char *filename);
+};
+
+#endif // PROFILE_H_
@@ -1,14 +1,51 @@
 #include <cstdio>
 #include <cstdlib>
+#include <sys/mman.h>
 #include "ram.h"
+#include "csr.h"
+#include "mmu.h"
 
-#define READ_UINT(size) \
-uint ## size ## _t RAM::read_uint ## size(uintx_t addr) { \
-    if (addr>(MEMSIZE-size/8)) { \
-        fprintf(stderr, "Error: ram read address (0x%08lx) is out of range. (read_uint" #size ")\n", (uint64_t)addr); \
-        exit(0); \
+RAM::RAM() {
+    ram   = NULL;
+    size  = 0;
+    owner = false;
+    resize(MEMSIZE);
+}
+
+RAM::~RAM() {
+    if (owner) {
+        munmap(ram, size);
+    }
+}
+
+void RAM::resize(uint64_t size) {
+    if (owner) {
+        munmap(ram, this->size);
+    }
+    ram = (uint8_t *)mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (ram==MAP_FAILED) {
+        fprintf(stderr, "Error: ram (%lu bytes) cannot be allocated.\n", size);
+        exit(0);
+    }
+    this->size = size;
+    owner      = true;
+}
+
+void RAM::share(RAM &other) {
+    if (owner) {
+        munmap(ram, size);
+    }
+    ram   = other.ram;
+    size  = other.size;
+    owner = false;
+}
+
+#define READ_UINT(bits) \
+uint ## bits ## _t RAM::read_uint ## bits(uintx_t addr) { \
+    if (addr>(size-bits/8)) { \
+        throw Exception{CAUSE_LOAD_ACCESS, addr}; \
     } \
-    uint ## size ## _t *data = (uint ## size ## _t *)&ram[addr]; \
+    uint ## bits ## _t *data = (uint ## bits ## _t *)&ram[addr]; \
     return *data; \
 }
 READ_UINT(8)
@@ -16,13 +53,12 @@ READ_UINT(16)
 READ_UINT(32)
 READ_UINT(64)
 
-#define WRITE_UINT(size) \
-void RAM::write_uint ## size(uintx_t addr, uint ## size ## _t data) { \
-    if (addr>(MEMSIZE-size/8)) { \
-        fprintf(stderr, "Error: ram write address (0x%08lx) is out of range. (write_uint" #size ")\n", (uint64_t)addr); \
-        exit(0); \
+#define WRITE_UINT(bits) \
+void RAM::write_uint ## bits(uintx_t addr, uint ## bits ## _t data) { \
+    if (addr>(size-bits/8)) { \
+        throw Exception{CAUSE_STORE_ACCESS, addr}; \
     } \
-    uint ## size ##_t *p = (uint ## size ## _t *)&ram[addr]; \
+    uint ## bits ##_t *p = (uint ## bits ## _t *)&ram[addr]; \
     *p = data; \
 }
 WRITE_UINT(8)
@@ -30,7 +66,15 @@ WRITE_UINT(16)
 WRITE_UINT(32)
 WRITE_UINT(64)
 
-void RAM::readmem(const char *filename) {
+uint8_t *RAM::ptr(uintx_t addr, uint64_t len) {
+    if ((addr>size) || (len>size-addr)) {
+        return NULL;
+    }
+    return &ram[addr];
+}
+
+// returns the size of the image
+uintx_t RAM::readmem(const char *filename) {
     FILE *fp;
 
     // open
@@ -41,12 +85,19 @@ void RAM::readmem(const char *filename) {
 
     // read binfile and write ram
     uintx_t  addr = 0;
-    uint32_t data;
-    while (fread(&data, sizeof(uint32_t), 1, fp)!=0) {
+    uint32_t data = 0;
+    while (fread(&data, 1, sizeof(uint32_t), fp)!=0) { // a trailing halfword is zero-padded
+        if (addr>size-4) {
+            fprintf(stderr, "Error: memfile (%s) does not fit in ram.\n", filename);
+            exit(0);
+        }
         write_uint32(addr, data);
         addr=addr+4;
+        data=0;
     }
 
     // close
     fclose(fp);
+
+    return addr;
 }
@@ -4,7 +4,19 @@
 #include "rvemu.h"
 
 struct RAM {
-    uint8_t ram[MEMSIZE];
+    uint8_t  *ram  ;
+    uint64_t  size ;
+    bool      owner; // false if the space belongs to another RAM
+
+    RAM();
+    ~RAM();
+
+    // Reallocate as a zero-filled space of size bytes. Host pages are only
+    // committed when touched, so large guest spaces are cheap.
+    void resize(uint64_t size);
+
+    // Use the space of other (SMP harts share one RAM).
+    void share(RAM &other);
 
     // Read
     uint8_t  read_uint8 (uintx_t addr);
@@ -18,8 +30,12 @@ struct RAM {
     void write_uint32(uintx_t addr, uint32_t data);
     void write_uint64(uintx_t addr, uint64_t data);
 
+    // Host pointer to [addr, addr+len) or NULL if it is out of range. Used to
+    // hand guest buffers to the host without copying.
+    uint8_t *ptr(uintx_t addr, uint64_t len);
+
     // Memory init
-    void readmem(const char *filename);
+    uintx_t readmem(const char *filename);
 };
 
 #endif // RAM_H_
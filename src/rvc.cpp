@@ -0,0 +1,169 @@
+#include "rvc.h"
+
+#define OP_LOAD     0b0000011
+#define OP_IMM      0b0010011
+#define OP_IMM_32   0b0011011
+#define OP_STORE    0b0100011
+#define OP_OP       0b0110011
+#define OP_LUI      0b0110111
+#define OP_OP_32    0b0111011
+#define OP_BRANCH   0b1100011
+#define OP_JALR     0b1100111
+#define OP_JAL      0b1101111
+#define EBREAK      0x00100073
+
+static uint32_t enc_i(uint32_t imm, uint32_t rs1, uint32_t funct3, uint32_t rd, uint32_t opcode) {
+    return ((imm & 0xfff) << 20) | (rs1 << 15) | (funct3 << 12) | (rd << 7) | opcode;
+}
+
+static uint32_t enc_s(uint32_t imm, uint32_t rs2, uint32_t rs1, uint32_t funct3) {
+    return ((imm & 0xfe0) << 20) | (rs2 << 20) | (rs1 << 15) | (funct3 << 12) | ((imm & 0x1f) << 7) | OP_STORE;
+}
+
+static uint32_t enc_r(uint32_t funct7, uint32_t rs2, uint32_t rs1, uint32_t funct3, uint32_t rd, uint32_t opcode) {
+    return (funct7 << 25) | (rs2 << 20) | (rs1 << 15) | (funct3 << 12) | (rd << 7) | opcode;
+}
+
+static uint32_t enc_b(uint32_t imm, uint32_t rs1, uint32_t funct3) {
+    return ((imm & 0x1000) << 19) | ((imm & 0x7e0) << 20) | (rs1 << 15) | (funct3 << 12)
+         | ((imm & 0x1e) << 7) | ((imm & 0x800) >> 4) | OP_BRANCH;
+}
+
+static uint32_t enc_j(uint32_t imm, uint32_t rd) {
+    return ((imm & 0x100000) << 11) | ((imm & 0x7fe) << 20) | ((imm & 0x800) << 9) | (imm & 0xff000)
+         | (rd << 7) | OP_JAL;
+}
+
+// sign-extend the low bits of x
+static uint32_t sext(uint32_t x, int bits) {
+    return (uint32_t)((int32_t)(x << (32-bits)) >> (32-bits));
+}
+
+uint32_t rvc_expand(uint16_t cir) {
+    uint32_t c      = cir;
+    uint32_t funct3 = (c >> 13) & 0x7;
+    uint32_t rd     = (c >> 7) & 0x1f;   // also rs1
+    uint32_t rs2    = (c >> 2) & 0x1f;
+    uint32_t rdp    = 0x8 | ((c >> 2) & 0x7); // rd'/rs2'
+    uint32_t rs1p   = 0x8 | ((c >> 7) & 0x7); // rs1'/rd'
+    uint32_t imm6   = sext(((c >> 7) & 0x20) | ((c >> 2) & 0x1f), 6);
+    uint32_t shamt  = ((c >> 7) & 0x20) | ((c >> 2) & 0x1f);
+    uint32_t imm;
+
+    switch (c & 0x3) {
+    case 0b00: // Quadrant 0
+        switch (funct3) {
+        case 0b000: // c.addi4spn
+            imm = ((c >> 1) & 0x3c0) | ((c >> 7) & 0x30) | ((c >> 2) & 0x8) | ((c >> 4) & 0x4);
+            return (imm==0) ? 0 : enc_i(imm, 2, 0b000, rdp, OP_IMM);
+        case 0b010: // c.lw
+            imm = ((c << 1) & 0x40) | ((c >> 7) & 0x38) | ((c >> 4) & 0x4);
+            return enc_i(imm, rs1p, 0b010, rdp, OP_LOAD);
+        case 0b110: // c.sw
+            imm = ((c << 1) & 0x40) | ((c >> 7) & 0x38) | ((c >> 4) & 0x4);
+            return enc_s(imm, rdp, rs1p, 0b010);
+#if XLEN == 64
+        case 0b011: // c.ld
+            imm = ((c << 1) & 0xc0) | ((c >> 7) & 0x38);
+            return enc_i(imm, rs1p, 0b011, rdp, OP_LOAD);
+        case 0b111: // c.sd
+            imm = ((c << 1) & 0xc0) | ((c >> 7) & 0x38);
+            return enc_s(imm, rdp, rs1p, 0b011);
+#endif
+        default:
+            return 0;
+        }
+    case 0b01: // Quadrant 1
+        switch (funct3) {
+        case 0b000: // c.nop/c.addi
+            return enc_i(imm6, rd, 0b000, rd, OP_IMM);
+#if XLEN == 32
+        case 0b001: // c.jal
+#endif
+        case 0b101: // c.j
+            imm = ((c >> 1) & 0xb40) | ((c << 2) & 0x400) | ((c << 1) & 0x80) | ((c << 3) & 0x20) | ((c >> 7) & 0x10) | ((c >> 2) & 0xe);
+            return enc_j(sext(imm, 12), (funct3==0b001) ? 1 : 0);
+#if XLEN == 64
+        case 0b001: // c.addiw
+            return (rd==0) ? 0 : enc_i(imm6, rd, 0b000, rd, OP_IMM_32);
+#endif
+        case 0b010: // c.li
+            return enc_i(imm6, 0, 0b000, rd, OP_IMM);
+        case 0b011: // c.addi16sp/c.lui
+            if (rd==2) {
+                imm = ((c >> 3) & 0x200) | ((c << 4) & 0x180) | ((c << 1) & 0x40) | ((c << 3) & 0x20) | ((c >> 2) & 0x10);
+                return (imm==0) ? 0 : enc_i(sext(imm, 10), 2, 0b000, 2, OP_IMM);
+            }
+            return (imm6==0) ? 0 : ((imm6 << 12) | (rd << 7) | OP_LUI);
+        case 0b100: // c.misc-alu
+            switch ((c >> 10) & 0x3) {
+            case 0b00: // c.srli
+            case 0b01: // c.srai
+                if ((XLEN==32) && (shamt & 0x20)) {
+                    return 0;
+                }
+                return enc_i(shamt | ((c & 0x400) ? 0x400 : 0), rs1p, 0b101, rs1p, OP_IMM);
+            case 0b10: // c.andi
+                return enc_i(imm6, rs1p, 0b111, rs1p, OP_IMM);
+            default:
+                if (c & 0x1000) {
+#if XLEN == 64
+                    switch ((c >> 5) & 0x3) {
+                    case 0b00: return enc_r(0x20, rdp, rs1p, 0b000, rs1p, OP_OP_32); // c.subw
+                    case 0b01: return enc_r(0x00, rdp, rs1p, 0b000, rs1p, OP_OP_32); // c.addw
+                    }
+#endif
+                    return 0;
+                }
+                switch ((c >> 5) & 0x3) {
+                case 0b00: return enc_r(0x20, rdp, rs1p, 0b000, rs1p, OP_OP); // c.sub
+                case 0b01: return enc_r(0x00, rdp, rs1p, 0b100, rs1p, OP_OP); // c.xor
+                case 0b10: return enc_r(0x00, rdp, rs1p, 0b110, rs1p, OP_OP); // c.or
+                default  : return enc_r(0x00, rdp, rs1p, 0b111, rs1p, OP_OP); // c.and
+                }
+            }
+        case 0b110: // c.beqz
+        case 0b111: // c.bnez
+            imm = ((c >> 4) & 0x100) | ((c << 1) & 0xc0) | ((c << 3) & 0x20) | ((c >> 7) & 0x18) | ((c >> 2) & 0x6);
+            return enc_b(sext(imm, 9), rs1p, (funct3==0b110) ? 0b000 : 0b001);
+        }
+        return 0;
+    case 0b10: // Quadrant 2
+        switch (funct3) {
+        case 0b000: // c.slli
+            if ((XLEN==32) && (shamt & 0x20)) {
+                return 0;
+            }
+            return enc_i(shamt, rd, 0b001, rd, OP_IMM);
+        case 0b010: // c.lwsp
+            imm = ((c >> 7) & 0x20) | ((c >> 2) & 0x1c) | ((c << 4) & 0xc0);
+            return (rd==0) ? 0 : enc_i(imm, 2, 0b010, rd, OP_LOAD);
+        case 0b110: // c.swsp
+            imm = ((c >> 7) & 0x3c) | ((c >> 1) & 0xc0);
+            return enc_s(imm, rs2, 2, 0b010);
+#if XLEN == 64
+        case 0b011: // c.ldsp
+            imm = ((c >> 7) & 0x20) | ((c >> 2) & 0x18) | ((c << 4) & 0x1c0);
+            return (rd==0) ? 0 : enc_i(imm, 2, 0b011, rd, OP_LOAD);
+        case 0b111: // c.sdsp
+            imm = ((c >> 7) & 0x38) | ((c >> 1) & 0x1c0);
+            return enc_s(imm, rs2, 2, 0b011);
+#endif
+        case 0b100: // c.jr/c.mv/c.ebreak/c.jalr/c.add
+            if (!(c & 0x1000)) {
+                if (rs2==0) {
+                    return (rd==0) ? 0 : enc_i(0, rd, 0b000, 0, OP_JALR); // c.jr
+                }
+                return enc_r(0x00, rs2, 0, 0b000, rd, OP_OP); // c.mv
+            }
+            if (rs2==0) {
+                return (rd==0) ? EBREAK : enc_i(0, rd, 0b000, 1, OP_JALR); // c.ebreak/c.jalr
+            }
+            return enc_r(0x00, rs2, rd, 0b000, rd, OP_OP); // c.add
+        default:
+            return 0;
+        }
+    default: // not compressed
+        return 0;
+    }
+}
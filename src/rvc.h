@@ -0,0 +1,12 @@
+#if !defined(RVC_H_)
+#define RVC_H_
+
+#include <cstdint>
+#include "rvemu.h"
+
+// The 32-bit instruction a compressed instruction stands for, or 0 if it is
+// illegal or reserved (0 is not a valid 32-bit instruction either). Used by
+// decoders that only want to know the base ISA; exec() decodes RVC itself.
+uint32_t rvc_expand(uint16_t cir);
+
+#endif // RVC_H_
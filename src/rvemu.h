@@ -30,10 +30,36 @@
 //------------------------------------------------------------------------------
 #define MEMSIZE (128*1024) // 128 KiB
 
+// Linux user mode (--linux): guest virtual addresses map 1:1 onto RAM
+#if !defined(LINUX_MEMSIZE)
+#define LINUX_MEMSIZE    (1ULL<<30) // 1 GiB, committed on demand
+#endif
+#define LINUX_STACK_SIZE (8*1024*1024)
+#define LINUX_PIE_BASE   0x00010000 // load address of static-pie executables
+#define LINUX_PAGE_SIZE  4096
+
 #define RESET_VECTOR 0x00000000
-#define MTIME_ADDR   0x20000000
+#define CLINT_BASE   0x02000000
+#define MTIME_ADDR   0x20000000 // legacy alias of CLINT mtime
 #define TOHOST_ADDR  0x40008000
 
+#define MMIO_BASE    CLINT_BASE // every device lives at or above MMIO_BASE
+
+#if !defined(MAX_HARTS)
+#define MAX_HARTS    64
+#endif
+
+//------------------------------------------------------------------------------
+// Virtual time: the hart retires CPU_FREQ instructions per second and mtime
+// ticks at MTIME_FREQ.
+#if !defined(CPU_FREQ)
+#define CPU_FREQ   100000000 // 100 MHz
+#endif
+
+#if !defined(MTIME_FREQ)
+#define MTIME_FREQ 100000000 // 100 MHz
+#endif
+
 //==============================================================================
 #include <cstdint>
 
@@ -0,0 +1,186 @@
+#include <cstdio>
+#include <cstring>
+#include <atomic>
+#include <map>
+#include <string>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include "machine.h"
+#include "hook.h"
+#include "sample.h"
+
+// the thread of SIGEV_THREAD_ID; some C libraries (glibc up to at least
+// 2.36) only have the member it names
+#if !defined(sigev_notify_thread_id)
+#define sigev_notify_thread_id _sigev_un._tid
+#endif
+
+static Sampler *active; // the one the signal handler records for
+
+static void on_sigprof(int) {
+    if (active!=NULL) {
+        active->sample();
+    }
+}
+
+Sampler::Sampler() {
+    m        = NULL;
+    stacks   = false;
+    depth    = 0;
+    buf      = NULL;
+    used     = 0;
+    nsamples = 0;
+    dropped  = 0;
+}
+
+Sampler::~Sampler() {
+    stop();
+    delete[] buf;
+}
+
+void Sampler::load_symbols(const char *elf, uintx_t bias) {
+    ::load_symbols(elf, syms, bias);
+}
+
+bool Sampler::start(Machine &m, int rate, bool stacks) {
+    this->m      = &m;
+    this->stacks = stacks;
+    buf    = new uint64_t[SAMPLE_BUF_SIZE]; // pages are touched as samples come
+    active = this;
+
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = on_sigprof;
+    sa.sa_flags   = SA_RESTART;
+    sigemptyset(&sa.sa_mask);
+    if (sigaction(SIGPROF, &sa, NULL)!=0) {
+        return false;
+    }
+    // to this thread, the one that runs the hart
+    struct sigevent ev;
+    memset(&ev, 0, sizeof(ev));
+    ev.sigev_notify           = SIGEV_THREAD_ID;
+    ev.sigev_signo            = SIGPROF;
+    ev.sigev_notify_thread_id = syscall(SYS_gettid);
+    if (timer_create(CLOCK_MONOTONIC, &ev, &timer)!=0) {
+        return false;
+    }
+    struct itimerspec t;
+    t.it_interval.tv_sec  = 0;
+    t.it_interval.tv_nsec = (rate<=1) ? 999999999 : 1000000000/rate;
+    t.it_value            = t.it_interval;
+    return timer_settime(timer, 0, &t, NULL)==0;
+}
+
+void Sampler::stop() {
+    if (active!=this) {
+        return;
+    }
+    timer_delete(timer);
+    signal(SIGPROF, SIG_IGN);
+    active = NULL;
+}
+
+// In the signal handler: no allocation, only the preallocated buffer.
+void Sampler::sample() {
+    int    d    = depth;
+    int    n    = (d<SAMPLE_DEPTH_MAX) ? d : SAMPLE_DEPTH_MAX;
+    size_t u    = used;
+    if (u+2+n>SAMPLE_BUF_SIZE) {
+        dropped = dropped + 1;
+        return;
+    }
+    buf[u  ] = n;
+    buf[u+1] = m->pc;
+    for (int i=0; i<n; i++) {
+        buf[u+2+i] = frame[i];
+    }
+    used     = u+2+n;
+    nsamples = nsamples + 1;
+}
+
+void Sampler::call(uintx_t target, uintx_t ret) {
+    int d = depth;
+    if (d<SAMPLE_DEPTH_MAX) {
+        frame [d] = target;
+        expect[d] = ret;
+    }
+    std::atomic_signal_fence(std::memory_order_release); // frame before depth
+    depth = d+1;
+}
+
+// Pops back to the frame that expects the return address; a return that
+// no frame expects (longjmp, context switch) is ignored.
+void Sampler::ret(uintx_t target) {
+    int d = depth;
+    if (d>SAMPLE_DEPTH_MAX) {
+        depth = d-1; // beyond the frames kept: assume the innermost one returns
+        return;
+    }
+    for (int k=d; k>1; k--) {
+        if (expect[k-1]==target) {
+            depth = k-1;
+            return;
+        }
+    }
+}
+
+void Sampler::begin(Machine &m) {
+    call(m.r.pc, (uintx_t)-1); // the entry point is the root frame
+}
+
+void Sampler::record(Machine &m) {
+    int link = link_kind(m.ir);
+    if (link & LINK_RET) {
+        ret(m.r.pc);
+    }
+    if (link & LINK_CALL) {
+        call(m.r.pc, m.pc + ((m.is_compressed) ? 2 : 4));
+    }
+}
+
+bool Sampler::write_folded(const char *filename) {
+    auto name = [&](uint64_t pc) {
+        int i = find_symbol(syms, pc);
+        if (i<(int)syms.size()) {
+            return syms[i].name;
+        }
+        char hex[24];
+        snprintf(hex, sizeof(hex), "0x%lx", pc);
+        return std::string(hex);
+    };
+
+    std::map<std::string, uint64_t> folded;
+    for (size_t u=0; u<used; ) {
+        int         n  = buf[u];
+        uint64_t    pc = buf[u+1];
+        std::string stack;
+        for (int i=0; i<n; i++) {
+            if (i!=0) {
+                stack += ';';
+            }
+            stack += name(buf[u+2+i]);
+        }
+        // the function of pc, unless it is the innermost frame already
+        std::string leaf = name(pc);
+        if (n==0) {
+            stack = leaf;
+        } else if ((find_symbol(syms, pc)!=find_symbol(syms, buf[u+2+n-1])) ||
+                   (find_symbol(syms, pc)==(int)syms.size())) {
+            stack += ';' + leaf;
+        }
+        folded[stack]++;
+        u += 2+n;
+    }
+
+    FILE *fp = fopen(filename, "w");
+    if (fp==NULL) {
+        return false;
+    }
+    for (auto &f : folded) {
+        fprintf(fp, "%s %lu\n", f.first.c_str(), f.second);
+    }
+    return fclose(fp)==0;
+}
@@ -0,0 +1,73 @@
+#if !defined(SAMPLE_H_)
+#define SAMPLE_H_
+
+#include <cstdint>
+#include <ctime>
+#include <vector>
+#include "rvemu.h"
+#include "loader.h"
+
+struct Machine;
+
+//------------------------------------------------------------------------------
+// Sampling profiler (--sample)
+//------------------------------------------------------------------------------
+// A host interval timer (timer_create, SIGPROF to the thread of the hart)
+// interrupts the emulator rate times per second, and the signal handler
+// records the pc of the guest instruction being executed. The timer is a
+// CLOCK_MONOTONIC one: process CPU-time timers only fire on scheduler ticks,
+// which caps their rate at a few hundred Hz. Nothing is done per instruction, so
+// the hart runs in its usual loop.
+//
+// With --sample-stacks the hart runs in the loop of run_hooked() (hook.h),
+// which also keeps a shadow call stack (calls and returns are followed as in
+// --profile), and a sample records the stack too. That costs a check per
+// instruction.
+//
+// The samples are written as folded stacks, one line per distinct stack
+// ("main;foo;bar 42"), which flamegraph.pl and similar tools take as they
+// are. Frames are ELF symbols, or addresses when there is no symbol.
+#if !defined(SAMPLE_RATE)
+#define SAMPLE_RATE      997     // Hz; not a round number, so as not to beat with periodic guest work
+#endif
+#define SAMPLE_DEPTH_MAX 256     // frames of the shadow stack that are recorded
+#define SAMPLE_BUF_SIZE  (1<<22) // words of samples; samples that do not fit are dropped
+
+struct Sampler {
+    Machine *m     ;
+    bool     stacks;
+    timer_t  timer ;
+    std::vector<Symbol> syms;
+
+    // shadow stack: call targets and the return addresses their callers
+    // expect. depth may exceed SAMPLE_DEPTH_MAX; only that many are kept.
+    uintx_t      frame [SAMPLE_DEPTH_MAX];
+    uintx_t      expect[SAMPLE_DEPTH_MAX];
+    volatile int depth;
+
+    // written by the signal handler: per sample, the number of frames, the
+    // pc and the frames
+    uint64_t         *buf     ;
+    volatile size_t   used    ;
+    volatile uint64_t nsamples;
+    volatile uint64_t dropped ;
+
+    Sampler();
+    ~Sampler();
+
+    void load_symbols(const char *elf, uintx_t bias);
+    bool start(Machine &m, int rate, bool stacks);
+    void stop ();
+    void sample();
+
+    // Keeps the shadow stack over a run_hooked() loop (hook.h): begin()
+    // before it, record() after every eval().
+    void begin (Machine &m);
+    void record(Machine &m);
+    void call  (uintx_t target, uintx_t ret);
+    void ret   (uintx_t target);
+
+    bool write_folded(const char *filename);
+};
+
+#endif // SAMPLE_H_
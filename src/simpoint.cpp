@@ -0,0 +1,363 @@
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include "machine.h"
+#include "hook.h"
+#include "commit.h"
+#include "timing.h"
+#include "simpoint.h"
+
+//------------------------------------------------------------------------------
+// Checkpoint
+//------------------------------------------------------------------------------
+// every field but ram, for write()/read()
+#define CHECKPOINT_FIELDS(X) \
+    X(icount) X(reg) X(pc) X(cycle) X(priv) \
+    X(mstatus) X(misa) X(mie) X(mip) X(mtvec) X(mscratch) X(mepc) X(mcause) X(mtval) X(medeleg) X(mideleg) \
+    X(mcounteren) X(scounteren) X(stvec) X(sscratch) X(sepc) X(scause) X(stval) X(satp) \
+    X(mcycle_offset) X(minstret_offset) X(load_res_addr) X(load_res_value) X(brk_base) X(brk) \
+    X(msip) X(mtimecmp) X(mtime_offset)
+
+void Checkpoint::save(Machine &m, uint64_t icount) {
+    this->icount = icount;
+    memcpy(reg, m.reg, sizeof(reg));
+    pc              = m.r.pc;
+    cycle           = m.cycle;
+    priv            = m.priv;
+    mstatus         = m.mstatus;
+    misa            = m.misa;
+    mie             = m.mie;
+    mip             = m.mip;
+    mtvec           = m.mtvec;
+    mscratch        = m.mscratch;
+    mepc            = m.mepc;
+    mcause          = m.mcause;
+    mtval           = m.mtval;
+    medeleg         = m.medeleg;
+    mideleg         = m.mideleg;
+    mcounteren      = m.mcounteren;
+    scounteren      = m.scounteren;
+    stvec           = m.stvec;
+    sscratch        = m.sscratch;
+    sepc            = m.sepc;
+    scause          = m.scause;
+    stval           = m.stval;
+    satp            = m.satp;
+    mcycle_offset   = m.mcycle_offset;
+    minstret_offset = m.minstret_offset;
+    load_res_addr   = m.load_res_addr;
+    load_res_value  = m.load_res_value;
+    brk_base        = m.brk_base;
+    brk             = m.brk;
+    msip            = m.clint->msip[m.hartid];
+    mtimecmp        = m.clint->mtimecmp[m.hartid];
+    mtime_offset    = m.clint->mtime_offset;
+    ram.assign(m.ram.ram, m.ram.ram + m.ram.size);
+}
+
+void Checkpoint::restore(Machine &m) {
+    if (ram.size()!=m.ram.size) {
+        fprintf(stderr, "Error: checkpoint ram size (%lu bytes) differs from the machine's.\n", (uint64_t)ram.size());
+        exit(0);
+    }
+    memcpy(m.reg, reg, sizeof(reg));
+    m.r.pc            = pc;
+    m.cycle           = cycle;
+    m.priv            = priv;
+    m.mstatus         = mstatus;
+    m.misa            = misa;
+    m.mie             = mie;
+    m.mip             = mip;
+    m.mtvec           = mtvec;
+    m.mscratch        = mscratch;
+    m.mepc            = mepc;
+    m.mcause          = mcause;
+    m.mtval           = mtval;
+    m.medeleg         = medeleg;
+    m.mideleg         = mideleg;
+    m.mcounteren      = mcounteren;
+    m.scounteren      = scounteren;
+    m.stvec           = stvec;
+    m.sscratch        = sscratch;
+    m.sepc            = sepc;
+    m.scause          = scause;
+    m.stval           = stval;
+    m.satp            = satp;
+    m.mcycle_offset   = mcycle_offset;
+    m.minstret_offset = minstret_offset;
+    m.load_res_addr   = load_res_addr;
+    m.load_res_value  = load_res_value;
+    m.brk_base        = brk_base;
+    m.brk             = brk;
+    m.clint->msip    [m.hartid] = msip;
+    m.clint->mtimecmp[m.hartid] = mtimecmp;
+    m.clint->mtime_offset       = mtime_offset;
+    memcpy(m.ram.ram, ram.data(), ram.size());
+
+    m.halt = 0;
+    m.tlb_flush();
+    m.update_vm();
+    m.timer_deadline = m.clint->deadline(m.hartid, m.cycle);
+    m.schedule();
+}
+
+bool Checkpoint::write(const char *filename) {
+    FILE *fp = fopen(filename, "wb");
+    if (fp==NULL) {
+        return false;
+    }
+    uint32_t header[2] = {CHECKPOINT_MAGIC, XLEN};
+    uint64_t size      = ram.size();
+    fwrite(header, sizeof(header), 1, fp);
+    fwrite(&size , sizeof(size)  , 1, fp);
+#define WRITE_FIELD(f) fwrite(&f, sizeof(f), 1, fp);
+    CHECKPOINT_FIELDS(WRITE_FIELD)
+    fwrite(ram.data(), 1, size, fp);
+    return fclose(fp)==0;
+}
+
+bool Checkpoint::read(const char *filename) {
+    FILE *fp = fopen(filename, "rb");
+    if (fp==NULL) {
+        return false;
+    }
+    uint32_t header[2];
+    uint64_t size;
+    bool     ok = (fread(header, sizeof(header), 1, fp)==1) && (header[0]==CHECKPOINT_MAGIC) && (header[1]==XLEN)
+               && (fread(&size, sizeof(size), 1, fp)==1);
+#define READ_FIELD(f) ok = ok && (fread(&f, sizeof(f), 1, fp)==1);
+    CHECKPOINT_FIELDS(READ_FIELD)
+    if (ok) {
+        ram.resize(size);
+        ok = (fread(ram.data(), 1, size, fp)==size);
+    }
+    fclose(fp);
+    return ok;
+}
+
+//------------------------------------------------------------------------------
+// SimPoint
+//------------------------------------------------------------------------------
+SimPoint::SimPoint(uint64_t interval) {
+    this->interval = interval;
+    bbv_fp         = NULL;
+    memfile        = NULL;
+    syscall_proxy  = false;
+    pipeline       = NULL;
+}
+
+SimPoint::~SimPoint() {
+    if (bbv_fp!=NULL) {
+        fclose(bbv_fp);
+    }
+}
+
+bool SimPoint::open_bbv(const char *filename) {
+    return (bbv_fp = fopen(filename, "w"))!=NULL;
+}
+
+// SimPoint's output: "<interval> <cluster>" per line in simpoints and
+// "<weight> <cluster>" in weights. Without weights all points count alike.
+bool SimPoint::read_points(const char *simpoints, const char *weights_file) {
+    FILE *fp = fopen(simpoints, "r");
+    if (fp==NULL) {
+        return false;
+    }
+    std::vector<std::pair<uint64_t, int>> pts;
+    uint64_t iv;
+    int      cluster;
+    while (fscanf(fp, "%lu %d", &iv, &cluster)==2) {
+        pts.push_back({iv, cluster});
+    }
+    fclose(fp);
+
+    std::map<int, double> w;
+    if (weights_file!=NULL) {
+        if ((fp = fopen(weights_file, "r"))==NULL) {
+            return false;
+        }
+        double weight;
+        while (fscanf(fp, "%lf %d", &weight, &cluster)==2) {
+            w[cluster] = weight;
+        }
+        fclose(fp);
+    }
+    std::sort(pts.begin(), pts.end());
+    for (auto &p : pts) {
+        points .push_back(p.first);
+        weights.push_back((weights_file!=NULL) ? w[p.second] : 1.0 / pts.size());
+    }
+    ckpt .resize(points.size());
+    stats.resize(points.size());
+    return !points.empty();
+}
+
+void SimPoint::end_interval() {
+    std::vector<std::pair<int, uint64_t>> v(bb_count.begin(), bb_count.end());
+    std::sort(v.begin(), v.end());
+    fprintf(bbv_fp, "T");
+    for (auto &e : v) {
+        fprintf(bbv_fp, ":%d:%lu ", e.first, e.second);
+    }
+    fprintf(bbv_fp, "\n");
+    bb_count.clear();
+}
+
+void SimPoint::run(Machine &m) {
+    // checkpoints are handed to the workers as they are taken
+    std::mutex              lock;
+    std::condition_variable cv;
+    std::deque<int>         ready;
+    bool                    taken_all = false;
+    auto worker = [&]() {
+        for (;;) {
+            std::unique_lock<std::mutex> guard(lock);
+            cv.wait(guard, [&]{ return !ready.empty() || taken_all; });
+            if (ready.empty()) {
+                return;
+            }
+            int k = ready.front();
+            ready.pop_front();
+            guard.unlock();
+            replay(k);
+        }
+    };
+    std::vector<std::thread> threads;
+    int nthreads = std::min<int>(points.size(), std::max(1u, std::thread::hardware_concurrency()));
+    for (int i=0; i<nthreads; i++) {
+        threads.emplace_back(worker);
+    }
+
+    std::unordered_map<uintx_t, int> ids;
+    uintx_t  bb_start = m.r.pc;
+    uint64_t bb_len   = 0;
+    uint64_t icount   = 0;
+    size_t   next     = 0;
+    // Takes the checkpoint of the next point if it starts here. Returns false
+    // once the rest of the program is not needed.
+    auto checkpoint = [&]() {
+        if ((next<points.size()) && (icount==points[next]*interval)) {
+            ckpt[next].save(m, icount);
+            if (!ckpt_dir.empty()) {
+                std::string name = ckpt_dir + "/interval" + std::to_string(points[next]) + ".ckpt";
+                if (!ckpt[next].write(name.c_str())) {
+                    fprintf(stderr, "Error: checkpoint (%s) cannot be written.\n", name.c_str());
+                    exit(0);
+                }
+            }
+            {
+                std::lock_guard<std::mutex> guard(lock);
+                ready.push_back(next);
+            }
+            cv.notify_one();
+            next++;
+        }
+        return (next<points.size()) || (bbv_fp!=NULL);
+    };
+    if (checkpoint()) {
+        run_hooked(m, [&](int halt) {
+            icount++;
+            if (bbv_fp!=NULL) {
+                // a block ends at branch/jalr/jal/system (opcode 11000-11100)
+                // and wherever control does not fall through (traps,
+                // interrupts)
+                bb_len++;
+                uint8_t opcode = (m.ir >> 2) & 0x1f;
+                if ((opcode>=0b11000) || (m.r.pc!=m.pc+((m.is_compressed) ? 2 : 4)) || halt || ((icount % interval)==0)) {
+                    auto it = ids.find(bb_start);
+                    if (it==ids.end()) {
+                        it = ids.emplace(bb_start, ids.size()+1).first;
+                    }
+                    bb_count[it->second] += bb_len;
+                    bb_start = m.r.pc;
+                    bb_len   = 0;
+                }
+                if ((icount % interval)==0) {
+                    end_interval();
+                }
+            }
+            return !halt && checkpoint();
+        });
+    }
+    if ((bbv_fp!=NULL) && (icount % interval)!=0) {
+        end_interval();
+    }
+    if (next<points.size()) {
+        fprintf(stderr, "Warning: the program ended before interval %lu.\n", points[next]);
+        points .resize(next);
+        weights.resize(next);
+    }
+
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        taken_all = true;
+    }
+    cv.notify_all();
+    for (auto &t : threads) {
+        t.join();
+    }
+}
+
+// One interval from its checkpoint on a Machine of its own, through the
+// timing model. Its output is discarded.
+void SimPoint::replay(int k) {
+    auto     start = std::chrono::steady_clock::now();
+    Machine *m     = new Machine(memfile);
+    std::string console;
+    m->console       = &console;
+    m->syscall_proxy = syscall_proxy;
+    ckpt[k].restore(*m);
+
+    Pipeline  pipe;
+    if (pipeline!=NULL) {
+        pipe.configure(pipeline); // checked by main()
+    }
+    CommitLog log;
+    Commit    c;
+    log.begin(*m);
+    uint64_t instret = m->cycle + m->minstret_offset;
+    for (uint64_t i=0; i<interval; i++) {
+        int halt = log.step(*m, c);
+        pipe.record(c);
+        if (halt) {
+            break;
+        }
+    }
+    stats[k].instret  = m->cycle + m->minstret_offset - instret;
+    stats[k].cycles   = pipe.cycles();
+    stats[k].tlb_hit  = m->tlb_hit;
+    stats[k].tlb_miss = m->tlb_miss;
+    delete m;
+    stats[k].seconds  = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+void SimPoint::report() {
+    if (points.empty()) {
+        return;
+    }
+    double wsum = 0, cpi = 0, tlb = 0, mips = 0;
+    printf("\n%-8s  %10s  %8s  %12s  %8s  %10s\n", "simpoint", "interval", "weight", "instret", "CPI", "host ms");
+    for (size_t k=0; k<points.size(); k++) {
+        IntervalStats &s = stats[k];
+        uint64_t accesses = s.tlb_hit + s.tlb_miss;
+        double   c = (s.instret!=0) ? (double)s.cycles / s.instret : 0;
+        printf("%-8lu  %10lu  %8.4f  %12lu  %8.4f  %10.3f\n",
+               k, points[k], weights[k], s.instret, c, s.seconds * 1000);
+        wsum += weights[k];
+        cpi  += weights[k] * c;
+        tlb  += weights[k] * ((accesses!=0) ? (double)s.tlb_miss / accesses : 0);
+        mips += weights[k] * ((s.seconds!=0) ? s.instret / s.seconds / 1e6 : 0);
+    }
+    if (wsum==0) {
+        return;
+    }
+    printf("estimate (%lu points, weight %.4f): CPI %.4f, tlb miss rate %.2f%%, %.1f MIPS per replay thread\n",
+           points.size(), wsum, cpi / wsum, 100.0 * tlb / wsum, mips / wsum);
+}
@@ -0,0 +1,102 @@
+#if !defined(SIMPOINT_H_)
+#define SIMPOINT_H_
+
+#include <cstdio>
+#include <map>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "rvemu.h"
+
+struct Machine;
+
+//------------------------------------------------------------------------------
+// Checkpoint: the architectural state of a single hart and its RAM
+//------------------------------------------------------------------------------
+#define CHECKPOINT_MAGIC 0x4b435652 // "RVCK"
+
+struct Checkpoint {
+    uint64_t icount; // instructions (evals) before the checkpoint
+    uintx_t  reg[32];
+    uintx_t  pc;
+    uint64_t cycle;
+    uint8_t  priv;
+    uintx_t  mstatus, misa, mie, mip, mtvec, mscratch, mepc, mcause, mtval, medeleg, mideleg;
+    uint32_t mcounteren, scounteren;
+    uintx_t  stvec, sscratch, sepc, scause, stval, satp;
+    uint64_t mcycle_offset, minstret_offset;
+    uintx_t  load_res_addr;
+    uint64_t load_res_value;
+    uintx_t  brk_base, brk;
+    uint32_t msip;
+    uint64_t mtimecmp, mtime_offset;
+    std::vector<uint8_t> ram;
+
+    void save   (Machine &m, uint64_t icount);
+    void restore(Machine &m);
+    bool write(const char *filename);
+    bool read (const char *filename);
+};
+
+//------------------------------------------------------------------------------
+// SimPoint
+//------------------------------------------------------------------------------
+// The program is cut into intervals of a fixed number of instructions.
+//
+// --bbv: the basic-block vector of every interval is written in the format
+// of the SimPoint tool: one line per interval, "T:id:count :id:count ...",
+// where count is the number of instructions executed in basic block id.
+// Basic blocks are identified by their entry pc and end at a branch, jump,
+// system instruction, or any other change of control flow.
+//
+// --simpoints/--weights (SimPoint output: "interval cluster" and "weight
+// cluster" per line): the program runs functionally up to the last chosen
+// interval and takes a checkpoint at the start of each one. Worker threads
+// replay the intervals from their checkpoints while the functional run goes
+// on. The per-interval statistics, weighted, estimate the whole program; the
+// cycles of an interval are those of the pipeline timing model (timing.h,
+// --pipeline) fed with the commits of its replay.
+#if !defined(SIMPOINT_INTERVAL)
+#define SIMPOINT_INTERVAL 10000000 // instructions
+#endif
+
+struct IntervalStats {
+    uint64_t instret ;
+    uint64_t cycles  ; // of the timing model (Pipeline)
+    uint64_t tlb_hit ;
+    uint64_t tlb_miss;
+    double   seconds ; // host time of the replay
+};
+
+struct SimPoint {
+    uint64_t    interval;
+
+    // basic-block vectors
+    FILE       *bbv_fp;
+    std::unordered_map<int, uint64_t> bb_count; // block id -> instructions in this interval
+
+    // sampled simulation
+    std::vector<uint64_t>       points  ; // interval numbers, ascending
+    std::vector<double>         weights ;
+    std::vector<Checkpoint>     ckpt    ;
+    std::vector<IntervalStats>  stats   ;
+    std::string                 ckpt_dir; // where to write the checkpoints, if set
+    const char                 *memfile ;
+    bool                        syscall_proxy;
+    const char                 *pipeline; // Pipeline::configure() spec, or NULL
+
+    SimPoint(uint64_t interval);
+    ~SimPoint();
+
+    bool open_bbv     (const char *filename);
+    bool read_points  (const char *simpoints, const char *weights_file);
+
+    // Runs the machine in a run_hooked() loop (hook.h), collecting BBVs and
+    // checkpoints.
+    void run(Machine &m);
+    void end_interval();
+    void replay(int k);
+    void report();
+};
+
+#endif // SIMPOINT_H_
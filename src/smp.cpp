@@ -0,0 +1,177 @@
+#include <thread>
+#include <vector>
+#include "machine.h"
+#include "smp.h"
+
+SMP::SMP(Machine *boot) {
+    nharts   = 1;
+    harts[0] = boot;
+    for (int i=0; i<RESERVATION_TABLE; i++) {
+        reservation[i] = -1;
+    }
+    stop      = false;
+    exit_code = 0;
+    halt_hart[0]  = MAX_HARTS;
+    halt_hart[1]  = MAX_HARTS;
+    barrier_count = 0;
+    barrier_gen   = 0;
+}
+
+std::atomic<int> &SMP::granule(uint64_t paddr) {
+    return reservation[(paddr / RESERVATION_GRANULE) % RESERVATION_TABLE];
+}
+
+// Called by a hart when it halts (tohost, exit, TIMEOUT). The first one
+// decides the exit code; the others are stopped at their next instruction.
+void SMP::halt_all(Machine *hart) {
+    bool expected = false;
+    if (stop.compare_exchange_strong(expected, true)) {
+        exit_code = hart->exit_code;
+    }
+    for (int i=0; i<nharts; i++) {
+        if (harts[i]!=hart) {
+            harts[i]->kick();
+        }
+    }
+}
+
+void SMP::run_threads() {
+    std::vector<std::thread> threads;
+    for (int i=0; i<nharts; i++) {
+        threads.emplace_back(&Machine::run, harts[i]);
+    }
+    for (auto &t : threads) {
+        t.join();
+    }
+}
+
+//------------------------------------------------------------------------------
+// Quantum scheduler
+//------------------------------------------------------------------------------
+// Nobody can have halted in the quantum before round-1 (the system would have
+// stopped), so the slot of round+1 is still clear and two slots suffice.
+void SMP::halted_in(uint64_t round, int hartid) {
+    int cur = halt_hart[round & 1];
+    while ((hartid<cur) && !halt_hart[round & 1].compare_exchange_weak(cur, hartid));
+}
+
+// Called by every thread after the barrier of a quantum; all of them see the
+// same answer.
+bool SMP::end_quantum(uint64_t round) {
+    return halt_hart[round & 1] < MAX_HARTS;
+}
+
+void SMP::run_quantum(uint64_t quantum) {
+    uint64_t round = 0;
+    for (uint64_t end=quantum; ; end+=quantum, round++) {
+        for (int i=0; i<nharts; i++) {
+            if (harts[i]->run_quantum(end)) {
+                halted_in(round, i);
+            }
+        }
+        if (end_quantum(round)) {
+            break;
+        }
+    }
+    stop      = true;
+    exit_code = harts[halt_hart[round & 1]]->exit_code;
+}
+
+void SMP::run_parallel(uint64_t quantum) {
+    uint64_t last = 0;
+    auto worker = [&](int i) {
+        uint64_t round = 0;
+        for (uint64_t end=quantum; ; end+=quantum, round++) {
+            if (harts[i]->run_quantum(end)) {
+                halted_in(round, i);
+            }
+            barrier();
+            if (end_quantum(round)) {
+                break;
+            }
+        }
+        if (i==0) {
+            last = round;
+        }
+    };
+    std::vector<std::thread> threads;
+    for (int i=0; i<nharts; i++) {
+        threads.emplace_back(worker, i);
+    }
+    for (auto &t : threads) {
+        t.join();
+    }
+    stop      = true;
+    exit_code = harts[halt_hart[last & 1]]->exit_code;
+}
+
+// Spinning barrier: quanta are short, so sleeping on a condition variable
+// would cost more than the quantum itself.
+void SMP::barrier() {
+    uint64_t gen = barrier_gen;
+    if (barrier_count.fetch_add(1)+1==nharts) {
+        barrier_count = 0;
+        barrier_gen++;
+    } else {
+        while (barrier_gen==gen) {
+            std::this_thread::yield();
+        }
+    }
+}
+
+//------------------------------------------------------------------------------
+// Machine
+//------------------------------------------------------------------------------
+// Secondary hart: shares RAM, the CLINT and the SMP state with the boot hart
+// and starts at the same entry point.
+Machine::Machine(Machine &boot, int hartid) {
+    ram.share(boot.ram);
+    clint        = boot.clint;
+    smp          = boot.smp;
+    this->hartid = hartid;
+    smp->harts[hartid] = this;
+    smp->nharts  = hartid+1;
+    reset(boot.r.pc);
+    console       = boot.console;
+    syscall_proxy = boot.syscall_proxy;
+    brk_base      = boot.brk_base;
+    brk           = boot.brk;
+}
+
+// Interrupt the hart from another thread: it calls event() before its next
+// instruction.
+void Machine::kick() {
+    kicked     = true;
+    next_event = 0;
+}
+
+// Run until this hart halts.
+void Machine::run() {
+    int halt;
+    do {
+        halt = eval();
+#if defined(TRACE_RF)
+        if (fp!=NULL) {
+            dump_regs();
+        }
+#endif
+    } while (!halt);
+    smp->halt_all(this);
+}
+
+// Run until the end of the quantum (cycle reaches end) or a halt. Returns halt.
+int Machine::run_quantum(uint64_t end) {
+    quantum_end = end;
+    while (cycle<end) {
+        int halt = eval();
+#if defined(TRACE_RF)
+        if (fp!=NULL) {
+            dump_regs();
+        }
+#endif
+        if (halt) {
+            return halt;
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,55 @@
+#if !defined(SMP_H_)
+#define SMP_H_
+
+#include <atomic>
+#include "rvemu.h"
+
+struct Machine;
+
+// LR/SC reservations are tracked per granule of physical memory in a table
+// shared by all harts. An entry holds the id of the hart that reserved the
+// granule last, or -1. sc succeeds only if the hart still holds the granule
+// and memory still holds the value lr read (host compare-and-swap).
+#define RESERVATION_GRANULE 64   // bytes
+#define RESERVATION_TABLE   4096 // entries (granules hash onto them)
+
+// State shared by the harts of one system. The harts share RAM and the CLINT,
+// and each runs on its own host thread.
+struct SMP {
+    int       nharts;
+    Machine  *harts[MAX_HARTS];
+
+    std::atomic<int>  reservation[RESERVATION_TABLE];
+
+    std::atomic<bool> stop     ; // a hart has halted, the others follow
+    int               exit_code; // of the hart that halted first
+
+    // quantum scheduler
+    std::atomic<int>      halt_hart[2]; // lowest hart that halted in an even/odd quantum
+    std::atomic<int>      barrier_count;
+    std::atomic<uint64_t> barrier_gen  ;
+
+    SMP(Machine *boot);
+
+    std::atomic<int> &granule(uint64_t paddr);
+    void halt_all(Machine *hart);
+
+    // Free-running: one host thread per hart, no synchronization.
+    void run_threads();
+
+    // Deterministic: virtual time advances in quanta of the given number of
+    // instructions; every hart runs up to the end of the quantum before any
+    // hart starts the next one. run_quantum() runs the harts one after another
+    // on the calling thread and is bit-reproducible. run_parallel() runs them
+    // on their own threads with a barrier at every quantum boundary; it is
+    // reproducible as long as harts do not race on memory within a quantum.
+    // Either way the system stops at the end of the quantum in which a hart
+    // halts, with the exit code of the lowest such hart.
+    void run_quantum (uint64_t quantum);
+    void run_parallel(uint64_t quantum);
+    void halted_in   (uint64_t round, int hartid);
+    bool end_quantum (uint64_t round);
+    void barrier();
+};
+
+#endif // SMP_H_
@@ -0,0 +1,121 @@
+#include <cstdio>
+#include <cstring>
+#include "machine.h"
+#include "disasm.h"
+#include "spikelog.h"
+
+#define SPIKELOG_LINE_MAX 256 // bytes, longest line
+
+static const char hex[] = "0123456789abcdef";
+
+// "0x" and bits/4 hex digits, as spike prints values of that width
+static inline char *put_value(char *p, uint64_t v, int bits) {
+    *p++ = '0';
+    *p++ = 'x';
+    for (int i=bits-4; i>=0; i-=4) {
+        *p++ = hex[(v >> i) & 0xf];
+    }
+    return p;
+}
+
+static inline char *put_str(char *p, const char *s) {
+    while (*s!='\0') {
+        *p++ = *s++;
+    }
+    return p;
+}
+
+SpikeLog::SpikeLog() {
+    fp     = NULL;
+    hartid = -1;
+}
+
+SpikeLog::~SpikeLog() {
+    close();
+}
+
+bool SpikeLog::open(const char *filename) {
+    fp = (strcmp(filename, "-")==0) ? stdout : fopen(filename, "w");
+    if (fp==NULL) {
+        return false;
+    }
+    buf.resize(SPIKELOG_BUF_SIZE + SPIKELOG_LINE_MAX);
+    p = buf.data();
+    return true;
+}
+
+void SpikeLog::flush() {
+    fwrite(buf.data(), 1, p - buf.data(), fp);
+    p = buf.data();
+}
+
+void SpikeLog::write(const Commit &c, Machine &m) {
+    if (c.trap) {
+        return;
+    }
+    char num[16];
+    if (hartid!=m.hartid) {
+        hartid = m.hartid;
+        snprintf(core, sizeof(core), "core%4d: ", hartid);
+    }
+    p    = put_str(p, core);
+    *p++ = '0' + c.priv;
+    *p++ = ' ';
+    p    = put_value(p, c.pc, XLEN);
+    *p++ = ' ';
+    *p++ = '(';
+    p    = (c.compressed) ? put_value(p, c.cir, 16) : put_value(p, c.ir, 32);
+    *p++ = ')';
+
+    uint8_t opcode = (c.ir >> 2) & 0x1f;
+    uint8_t funct3 = (c.ir >> 12) & 0x7;
+    int     rd     = (c.ir >> 7) & 0x1f;
+    bool    csr    = (opcode==0b11100) && (funct3!=0) && (funct3!=0b100);
+    if ((((WRITES_RD >> opcode) & 0x1) || csr) && (rd!=0)) {
+        *p++ = ' ';
+        *p++ = 'x';
+        if (rd>=10) {
+            *p++ = '0' + rd/10;
+        }
+        *p++ = '0' + rd%10;
+        *p++ = ' ';
+        if (rd<10) {
+            *p++ = ' ';
+        }
+        p = put_value(p, m.reg[rd], XLEN);
+    }
+    // csrrw/csrrwi always write, csrrs/csrrc only with rs1 (uimm) not 0
+    uintx_t data;
+    if (csr && (((funct3 & 0x3)==0b01) || (((c.ir >> 15) & 0x1f)!=0)) && m.csr_read(c.ir >> 20, data)) {
+        const char *name = csr_name(c.ir >> 20);
+        snprintf(num, sizeof(num), " c%u_", c.ir >> 20);
+        p = put_str(p, num);
+        p = put_str(p, (name!=NULL) ? name : "unknown");
+        *p++ = ' ';
+        p = put_value(p, data, XLEN);
+    }
+    if (c.load) {
+        p = put_str(p, " mem ");
+        p = put_value(p, c.load_addr, XLEN);
+    }
+    if (c.store_len!=0) {
+        p    = put_str(p, " mem ");
+        p    = put_value(p, c.store_addr, XLEN);
+        *p++ = ' ';
+        p    = put_value(p, c.store_data, c.store_len*8);
+    }
+    *p++ = '\n';
+    if (p>=buf.data()+SPIKELOG_BUF_SIZE) {
+        flush();
+    }
+}
+
+bool SpikeLog::close() {
+    if (fp==NULL) {
+        return true;
+    }
+    flush();
+    bool ok = (fp==stdout) ? (fflush(fp)==0) : (fclose(fp)==0);
+    fp = NULL;
+    return ok;
+}
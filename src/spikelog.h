@@ -0,0 +1,43 @@
+#if !defined(SPIKELOG_H_)
+#define SPIKELOG_H_
+
+#include <cstdio>
+#include <vector>
+#include "rvemu.h"
+#include "trace.h"
+
+struct Machine;
+
+//------------------------------------------------------------------------------
+// Spike commit log (--log-commits)
+//------------------------------------------------------------------------------
+// The lines spike --log-commits writes, so that the two logs can be diffed:
+//
+//   core   0: 3 0x0000000080000010 (0x0182b283) x5  0x0000000080000018 mem 0x0000000080000018
+//   core   0: 3 0x0000000080000014 (0x4505) x10 0x0000000000000001
+//   core   0: 3 0x0000000080000016 (0x00b52023) mem 0x0000000080002000 0x00000001
+//
+// hart, privilege level, pc, the instruction as fetched, then the register
+// written (even with the value it had; not x0), the CSR written by a csr*
+// instruction, the address of a load and the address and data of a store.
+// Like spike, an instruction that traps is not logged. CSR writes that are
+// side effects (mstatus by xret, ...) are not logged.
+#define SPIKELOG_BUF_SIZE (1<<20)
+
+struct SpikeLog {
+    FILE             *fp ;
+    std::vector<char> buf;
+    char             *p  ;
+    int               hartid;   // of core
+    char              core[16]; // "core   0: "
+
+    SpikeLog();
+    ~SpikeLog();
+
+    bool open (const char *filename); // - for stdout
+    void write(const Commit &c, Machine &m);
+    bool close();
+    void flush();
+};
+
+#endif // SPIKELOG_H_
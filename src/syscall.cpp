@@ -0,0 +1,133 @@
+#include <cstdio>
+#include <cstring>
+#include <cerrno>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "machine.h"
+#include "syscall.h"
+
+// Guest buffers are passed to the host system calls as pointers into RAM::ram;
+// nothing is copied.
+
+static int open_flags(uintx_t flags) {
+    int ret = flags & NEWLIB_O_ACCMODE;
+    if (flags & NEWLIB_O_APPEND) ret |= O_APPEND;
+    if (flags & NEWLIB_O_CREAT ) ret |= O_CREAT ;
+    if (flags & NEWLIB_O_TRUNC ) ret |= O_TRUNC ;
+    if (flags & NEWLIB_O_EXCL  ) ret |= O_EXCL  ;
+    return ret;
+}
+
+void put_uint(uint8_t *p, uint64_t data, int len) {
+    memcpy(p, &data, len); // little-endian host
+}
+
+// struct kernel_stat of libgloss/riscv (the asm-generic layout, 128 bytes)
+void put_stat(uint8_t *p, struct stat &st) {
+    memset(p, 0, 128);
+    put_uint(p+  0, st.st_dev          , 8);
+    put_uint(p+  8, st.st_ino          , 8);
+    put_uint(p+ 16, st.st_mode         , 4);
+    put_uint(p+ 20, st.st_nlink        , 4);
+    put_uint(p+ 24, st.st_uid          , 4);
+    put_uint(p+ 28, st.st_gid          , 4);
+    put_uint(p+ 32, st.st_rdev         , 8);
+    put_uint(p+ 48, st.st_size         , 8);
+    put_uint(p+ 56, st.st_blksize      , 4);
+    put_uint(p+ 64, st.st_blocks       , 8);
+    put_uint(p+ 72, st.st_atim.tv_sec  , 8);
+    put_uint(p+ 80, st.st_atim.tv_nsec , 8);
+    put_uint(p+ 88, st.st_mtim.tv_sec  , 8);
+    put_uint(p+ 96, st.st_mtim.tv_nsec , 8);
+    put_uint(p+104, st.st_ctim.tv_sec  , 8);
+    put_uint(p+112, st.st_ctim.tv_nsec , 8);
+}
+
+// NUL-terminated guest string, or NULL if it runs out of RAM
+const char *guest_str(RAM &ram, uintx_t addr) {
+    uint8_t *p = ram.ptr(addr, 1);
+    if ((p==NULL) || (memchr(p, 0, ram.size-addr)==NULL)) {
+        return NULL;
+    }
+    return (const char *)p;
+}
+
+// a7: syscall number, a0-a5: arguments, a0: return value (-errno on error)
+void Machine::syscall() {
+    if (linux_user) {
+        linux_syscall();
+        return;
+    }
+    uintx_t  num = reg[17];
+    uintx_t  a0  = reg[10];
+    uintx_t  a1  = reg[11];
+    uintx_t  a2  = reg[12];
+    uintx_t  a3  = reg[13];
+    intx_t   ret;
+    uint8_t     *p;
+    const char  *path;
+    struct stat  st;
+    uint64_t     usec;
+
+    switch (num) {
+    case SYS_write:
+        if ((p = ram.ptr(a1, a2))==NULL) { ret = -EFAULT; break; }
+        if ((a0==1) && (console!=NULL)) { console->append((char *)p, a2); ret = a2; break; }
+        if ((a0==1) || (a0==2)) fflush(stdout);
+        ret = write(a0, p, a2);
+        break;
+    case SYS_read:
+        if ((p = ram.ptr(a1, a2))==NULL) { ret = -EFAULT; break; }
+        ret = read(a0, p, a2);
+        break;
+    case SYS_open:
+        if ((path = guest_str(ram, a0))==NULL) { ret = -EFAULT; break; }
+        ret = open(path, open_flags(a1), a2);
+        break;
+    case SYS_openat:
+        if ((path = guest_str(ram, a1))==NULL) { ret = -EFAULT; break; }
+        ret = openat(((intx_t)a0==NEWLIB_AT_FDCWD) ? AT_FDCWD : (int)a0, path, open_flags(a2), a3);
+        break;
+    case SYS_close:
+        // the emulator's own stdin/stdout/stderr stay open
+        ret = (a0<=2) ? 0 : close(a0);
+        break;
+    case SYS_lseek:
+        ret = lseek(a0, (intx_t)a1, a2);
+        break;
+    case SYS_fstat:
+        if ((p = ram.ptr(a1, 128))==NULL) { ret = -EFAULT; break; }
+        if ((ret = fstat(a0, &st))==0) put_stat(p, st);
+        break;
+    case SYS_gettimeofday:
+        // virtual time since reset, consistent with mtime
+        if ((p = ram.ptr(a0, 16))==NULL) { ret = -EFAULT; break; }
+        usec = (uint64_t)((uint128_t)clint->mtime(cycle) * 1000000 / MTIME_FREQ);
+        put_uint(p+0, usec / 1000000, 8);
+        put_uint(p+8, usec % 1000000, 8);
+        ret = 0;
+        break;
+    case SYS_brk:
+        if ((a0>=brk_base) && (a0<=ram.size)) {
+            brk = a0;
+        }
+        ret = brk;
+        break;
+    case SYS_exit:
+    case SYS_exit_group:
+        putchars();
+        exit_code = a0;
+        halt      = 1;
+        ret       = 0;
+        break;
+    default:
+        fprintf(stderr, "Warning: unsupported syscall %ld\n", (uint64_t)num);
+        ret = -ENOSYS;
+        break;
+    }
+    if (ret==-1) {
+        ret = -errno;
+    }
+    reg[10] = ret;
+}
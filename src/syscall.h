@@ -0,0 +1,41 @@
+#if !defined(SYSCALL_H_)
+#define SYSCALL_H_
+
+//------------------------------------------------------------------------------
+// newlib (libgloss/riscv) system call numbers
+//------------------------------------------------------------------------------
+#define SYS_openat       56
+#define SYS_close        57
+#define SYS_lseek        62
+#define SYS_read         63
+#define SYS_write        64
+#define SYS_fstat        80
+#define SYS_exit         93
+#define SYS_exit_group   94
+#define SYS_gettimeofday 169
+#define SYS_brk          214
+#define SYS_open         1024
+
+//------------------------------------------------------------------------------
+// newlib open flags (sys/_default_fcntl.h)
+//------------------------------------------------------------------------------
+#define NEWLIB_O_ACCMODE 0x0003
+#define NEWLIB_O_APPEND  0x0008
+#define NEWLIB_O_CREAT   0x0200
+#define NEWLIB_O_TRUNC   0x0400
+#define NEWLIB_O_EXCL    0x0800
+
+#define NEWLIB_AT_FDCWD  -100
+
+//------------------------------------------------------------------------------
+// Helpers shared with linux.cpp
+//------------------------------------------------------------------------------
+#include "ram.h"
+
+struct stat;
+
+void        put_uint (uint8_t *p, uint64_t data, int len);
+void        put_stat (uint8_t *p, struct stat &st); // asm-generic struct stat
+const char *guest_str(RAM &ram, uintx_t addr);
+
+#endif // SYSCALL_H_
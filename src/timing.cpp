@@ -0,0 +1,175 @@
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include "timing.h"
+
+static const char *hazard_name[HAZARDS] = {
+    "fill", "load-use", "mul", "div", "branch", "trap", "fetch",
+};
+
+Pipeline::Pipeline() {
+    stages   = PIPELINE_STAGES;
+    load_use = PIPELINE_LOAD_USE;
+    mul      = PIPELINE_MUL;
+    div      = PIPELINE_DIV;
+    branch   = PIPELINE_BRANCH;
+    fetch    = PIPELINE_FETCH;
+    t        = 0;
+    next_pc  = 0;
+    started  = false;
+    for (int i=0; i<32; i++) {
+        ready[i] = 0;
+        kind [i] = HAZARD_LOAD_USE;
+    }
+    div_free = 0;
+    icount   = 0;
+    for (int i=0; i<HAZARDS; i++) {
+        stall[i] = 0;
+    }
+    fp = NULL;
+}
+
+Pipeline::~Pipeline() {
+    if ((fp!=NULL) && (fp!=stdout) && (fp!=stderr)) {
+        fclose(fp);
+    }
+}
+
+bool Pipeline::configure(const char *spec) {
+    struct {
+        const char *key;
+        int        *value;
+    } keys[] = {
+        {"stages", &stages}, {"load_use", &load_use}, {"mul", &mul},
+        {"div", &div}, {"branch", &branch}, {"fetch", &fetch},
+    };
+    char *s  = strdup(spec);
+    bool  ok = true;
+    for (char *f=strtok(s, ","); ok && (f!=NULL); f=strtok(NULL, ",")) {
+        char *eq = strchr(f, '=');
+        ok = false;
+        if (eq==NULL) {
+            break;
+        }
+        *eq = '\0';
+        for (auto &k : keys) {
+            if (strcmp(f, k.key)==0) {
+                *k.value = atoi(eq+1);
+                ok       = (*k.value>=0);
+            }
+        }
+    }
+    free(s);
+    return ok && (stages>=1) && (mul>=1) && (div>=1);
+}
+
+// "-" is stderr, which keeps the report apart from the guest's stdout
+bool Pipeline::open(const char *filename) {
+    fp = (std::string(filename)=="-") ? stderr : fopen(filename, "w");
+    return fp!=NULL;
+}
+
+void Pipeline::record(const Commit &c) {
+    uint32_t ir     = c.ir; // RVC expanded
+    uint8_t  opcode = (ir >> 2) & 0x1f;
+    uint8_t  rd     = (ir >> 7) & 0x1f;
+    uint8_t  rs1    = (ir >> 15) & 0x1f;
+    uint8_t  rs2    = (ir >> 20) & 0x1f;
+    bool     muldiv = ((opcode==0b01100) || (opcode==0b01110)) && ((ir >> 25)==0b0000001);
+    bool     is_div = muldiv && ((ir >> 14) & 0x1); // div/divu/rem/remu
+
+    // an interrupt taken after the previous instruction
+    if (started && (c.pc!=next_pc)) {
+        t += branch;
+        stall[HAZARD_TRAP] += branch;
+    }
+    started = true;
+    next_pc = c.next_pc;
+
+    uint64_t issue = t;
+    if (!c.compressed && (c.pc & 0x2)) {
+        issue += fetch;
+        stall[HAZARD_FETCH] += fetch;
+    }
+
+    // sources: rs1 of all but lui/auipc/jal, rs2 of branch/store/op/amo
+    bool use_rs1 = (opcode!=0b01101) && (opcode!=0b00101) && (opcode!=0b11011) &&
+                   !((opcode==0b11100) && ((ir >> 14) & 0x1));
+    bool use_rs2 = (opcode==0b11000) || (opcode==0b01000) || (opcode==0b01100) ||
+                   (opcode==0b01110) || (opcode==0b01011);
+    uint64_t need = issue;
+    int      why  = HAZARD_LOAD_USE;
+    if (use_rs1 && (ready[rs1]>need)) {
+        need = ready[rs1];
+        why  = kind[rs1];
+    }
+    if (use_rs2 && (ready[rs2]>need)) {
+        need = ready[rs2];
+        why  = kind[rs2];
+    }
+    if (is_div && (div_free>need)) {
+        need = div_free;
+        why  = HAZARD_DIV;
+    }
+    stall[why] += need - issue;
+    issue       = need;
+
+    if (!c.trap) {
+        icount++;
+        // lui/auipc/jal/jalr/load/op-imm/op/amo/system write rd
+        bool writes_rd = (opcode!=0b11000) && (opcode!=0b01000) && (opcode!=0b00011);
+        if (writes_rd && (rd!=0)) {
+            if ((opcode==0b00000) || (opcode==0b01011)) {
+                ready[rd] = issue + 1 + load_use;
+                kind [rd] = HAZARD_LOAD_USE;
+            } else if (is_div) {
+                ready[rd] = issue + div;
+                kind [rd] = HAZARD_DIV;
+            } else if (muldiv) {
+                ready[rd] = issue + mul;
+                kind [rd] = HAZARD_MUL;
+            } else {
+                ready[rd] = issue + 1;
+            }
+        }
+        if (is_div) {
+            div_free = issue + div;
+        }
+    }
+
+    // not-taken prediction: any other next pc redirects the fetch
+    t = issue + 1;
+    if (c.trap || (c.next_pc!=c.pc+((c.compressed) ? 2 : 4))) {
+        bool jump = !c.trap && ((opcode==0b11000) || (opcode==0b11011) || (opcode==0b11001));
+        t += branch;
+        stall[(jump) ? HAZARD_BRANCH : HAZARD_TRAP] += branch;
+    }
+}
+
+uint64_t Pipeline::cycles() const {
+    return t + stages - 1;
+}
+
+void Pipeline::report() {
+    if (fp==NULL) {
+        return;
+    }
+    stall[HAZARD_FILL] = stages - 1;
+    uint64_t total = cycles();
+    double   n     = (icount!=0) ? (double)icount : 1.0;
+    fprintf(fp, "\npipeline: %d stages, load-use %d, mul %d, div %d, branch %d, fetch %d\n",
+            stages, load_use, mul, div, branch, fetch);
+    fprintf(fp, "  instructions  %14lu\n", icount);
+    fprintf(fp, "  cycles        %14lu  CPI %.3f  IPC %.3f\n", total, total / n, (total!=0) ? icount / (double)total : 0.0);
+    // one cycle per instruction issued (trapping ones too), then the stalls
+    uint64_t issue = t;
+    for (int i=0; i<HAZARDS; i++) {
+        if (i!=HAZARD_FILL) issue -= stall[i];
+    }
+    fprintf(fp, "\n  %-10s  %14s  %8s\n", "", "cycles", "CPI");
+    fprintf(fp, "  %-10s  %14lu  %8.3f  %6.2f%%\n", "issue", issue, issue / n, 100.0 * issue / total);
+    for (int i=0; i<HAZARDS; i++) {
+        fprintf(fp, "  %-10s  %14lu  %8.3f  %6.2f%%\n", hazard_name[i], stall[i], stall[i] / n, 100.0 * stall[i] / total);
+    }
+}
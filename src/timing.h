@@ -0,0 +1,81 @@
+#if !defined(TIMING_H_)
+#define TIMING_H_
+
+#include <cstdio>
+#include <cstdint>
+#include "rvemu.h"
+#include "trace.h"
+
+//------------------------------------------------------------------------------
+// In-order pipeline timing model (--timing)
+//------------------------------------------------------------------------------
+// cycle counts instructions; this estimates the cycles a single-issue in-order
+// pipeline would take for the same instructions, fed by the commit loop
+// (commit.h). An instruction issues one cycle after the previous one, later
+// when
+//
+//   - a source register is not ready: a load result is ready load_use cycles
+//     late, a mul/mulh* result mul cycles after issue and a div/rem result div
+//     cycles after issue (ALU results are forwarded);
+//   - the divider is still busy (it is not pipelined);
+//   - it is a 32-bit instruction that is not 4-byte aligned (after RVC code)
+//     and takes two aligned fetches: fetch cycles;
+//
+// and the instructions after a taken branch or jump, or after a trap, xret or
+// interrupt, issue branch cycles late (the pipeline predicts not-taken). An
+// interrupt is seen as an instruction that does not start where the previous
+// one went on to (Commit::next_pc).
+// Filling the pipeline costs stages-1 cycles once. Memory is assumed to hit.
+//
+// The pipeline is given as KEY=N,... of stages, load_use, mul, div, branch
+// and fetch, e.g. stages=3,branch=1,div=18.
+#define PIPELINE_STAGES   5
+#define PIPELINE_LOAD_USE 1
+#define PIPELINE_MUL      3
+#define PIPELINE_DIV      34
+#define PIPELINE_BRANCH   2
+#define PIPELINE_FETCH    1
+
+// what the cycles beyond one per instruction are spent on
+enum Hazard {
+    HAZARD_FILL    ,
+    HAZARD_LOAD_USE,
+    HAZARD_MUL     ,
+    HAZARD_DIV     , // operand or the busy divider
+    HAZARD_BRANCH  , // taken branches and jumps
+    HAZARD_TRAP    , // traps, xret and interrupts
+    HAZARD_FETCH   ,
+    HAZARDS
+};
+
+struct Pipeline {
+    // configuration
+    int stages  ;
+    int load_use;
+    int mul     ;
+    int div     ;
+    int branch  ;
+    int fetch   ;
+
+    uint64_t t       ; // issue cycle of the next instruction
+    uintx_t  next_pc ; // pc the previous instruction went on to
+    bool     started ;
+    uint64_t ready[32]; // cycle the register can be used
+    uint8_t  kind [32]; // HAZARD_* of its producer
+    uint64_t div_free; // cycle the divider takes a new division
+    uint64_t icount  ;
+    uint64_t stall[HAZARDS];
+    FILE    *fp      ;
+
+    Pipeline();
+    ~Pipeline();
+
+    bool configure(const char *spec); // false if malformed
+    bool open(const char *filename);  // - for stderr
+
+    void record(const Commit &c);
+    uint64_t cycles() const;
+    void report();
+};
+
+#endif // TIMING_H_
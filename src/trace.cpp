@@ -0,0 +1,341 @@
+#include <cstdio>
+#include <cstring>
+#include "trace.h"
+#include "rvc.h"
+
+//------------------------------------------------------------------------------
+// varints
+//------------------------------------------------------------------------------
+static inline uint8_t *put_varint(uint8_t *p, uint64_t v) {
+    while (v>=0x80) {
+        *p++ = (v & 0x7f) | 0x80;
+        v  >>= 7;
+    }
+    *p++ = v;
+    return p;
+}
+
+static inline uint8_t *put_zigzag(uint8_t *p, int64_t v) {
+    return put_varint(p, ((uint64_t)v << 1) ^ (uint64_t)(v >> 63));
+}
+
+static inline bool get_varint(const uint8_t *&p, const uint8_t *end, uint64_t &v) {
+    v = 0;
+    for (int shift=0; (p<end) && (shift<64); shift+=7) {
+        uint8_t b = *p++;
+        v |= (uint64_t)(b & 0x7f) << shift;
+        if (!(b & 0x80)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static inline bool get_zigzag(const uint8_t *&p, const uint8_t *end, int64_t &v) {
+    uint64_t u;
+    if (!get_varint(p, end, u)) {
+        return false;
+    }
+    v = (int64_t)(u >> 1) ^ -(int64_t)(u & 0x1);
+    return true;
+}
+
+// length of the instruction a record describes, for the expected pc
+static inline int record_length(uint8_t flags, uint32_t ir) {
+    return ((flags & TRACE_RVC) || ((ir & 0x3)!=0x3)) ? 2 : 4;
+}
+
+//------------------------------------------------------------------------------
+// TraceWriter
+//------------------------------------------------------------------------------
+TraceWriter::TraceWriter() {
+    fp      = NULL;
+    done    = false;
+    error   = false;
+    records = 0;
+    bytes   = 0;
+}
+
+TraceWriter::~TraceWriter() {
+    close();
+}
+
+bool TraceWriter::open(const char *filename, const uintx_t reg[32], uint64_t cycle, uintx_t pc, uint8_t priv) {
+    if ((fp = fopen(filename, "wb"))==NULL) {
+        return false;
+    }
+    TraceHeader h = {TRACE_MAGIC, TRACE_VERSION, XLEN, 0};
+    fwrite(&h, sizeof(h), 1, fp);
+    bytes = sizeof(h);
+
+    state.priv       = priv;
+    state.cycle      = cycle;
+    state.pc         = pc;
+    state.store_addr = 0;
+    for (int i=0; i<32; i++) {
+        state.reg[i] = reg[i];
+    }
+    for (int i=0; i<TRACE_CHUNKS; i++) {
+        chunk[i].resize(TRACE_CHUNK_SIZE + TRACE_RECORD_MAX);
+        full [i] = false;
+    }
+    cur    = 0;
+    done   = false;
+    writer = std::thread(&TraceWriter::drain, this);
+    start_chunk();
+    return true;
+}
+
+void TraceWriter::start_chunk() {
+    TraceChunkHeader &h = hdr[cur];
+    h.magic      = TRACE_CHUNK_MAGIC;
+    h.records    = 0;
+    h.priv       = state.priv;
+    h.cycle      = state.cycle;
+    h.pc         = state.pc;
+    h.store_addr = state.store_addr;
+    memcpy(h.reg, state.reg, sizeof(h.reg));
+    p   = chunk[cur].data();
+    end = p + TRACE_CHUNK_SIZE;
+}
+
+// Hands the chunk to the writer thread and waits for the next one to be free.
+void TraceWriter::end_chunk() {
+    hdr[cur].size = p - chunk[cur].data();
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        full[cur] = true;
+    }
+    cv.notify_all();
+    cur = (cur+1) % TRACE_CHUNKS;
+    {
+        std::unique_lock<std::mutex> guard(lock);
+        cv.wait(guard, [&]{ return !full[cur]; });
+    }
+    start_chunk();
+}
+
+void TraceWriter::drain() {
+    for (int w=0; ; w=(w+1) % TRACE_CHUNKS) {
+        {
+            std::unique_lock<std::mutex> guard(lock);
+            cv.wait(guard, [&]{ return full[w] || done; });
+            if (!full[w]) {
+                return;
+            }
+        }
+        if ((fwrite(&hdr[w], sizeof(hdr[w]), 1, fp)!=1) ||
+            (fwrite(chunk[w].data(), 1, hdr[w].size, fp)!=hdr[w].size)) {
+            error = true;
+        }
+        bytes += sizeof(hdr[w]) + hdr[w].size;
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            full[w] = false;
+        }
+        cv.notify_all();
+    }
+}
+
+void TraceWriter::write(const Commit &c) {
+    uint8_t *flags = p++;
+    uint8_t  f     = 0;
+    if (c.priv!=state.priv) {
+        f         |= TRACE_PRIV;
+        *p++       = c.priv;
+        state.priv = c.priv;
+    }
+    if (c.pc!=state.pc) {
+        f |= TRACE_PC;
+        p  = put_zigzag(p, (int64_t)(c.pc - state.pc));
+    }
+    if (c.cycle!=state.cycle+1) {
+        f |= TRACE_CYCLE;
+        p  = put_varint(p, c.cycle - state.cycle - 1);
+    }
+    if (c.compressed && (c.ir==rvc_expand(c.cir))) {
+        f |= TRACE_RVC;
+        memcpy(p, &c.cir, 2);
+        p += 2;
+    } else {
+        memcpy(p, &c.ir, 4);
+        p += 4;
+    }
+    f |= ((c.nreg<3) ? c.nreg : 3) << TRACE_NREG_SHIFT;
+    if (c.nreg>=3) {
+        p = put_varint(p, c.nreg);
+    }
+    for (int i=0; i<c.nreg; i++) {
+        *p++ = c.rd[i];
+        p    = put_zigzag(p, (int64_t)(intx_t)(c.value[i] - (uintx_t)state.reg[c.rd[i]]));
+        state.reg[c.rd[i]] = c.value[i];
+    }
+    if (c.trap) {
+        f |= TRACE_TRAP;
+    } else if (c.store_len!=0) {
+        f |= TRACE_STORE;
+        *p++ = c.store_len;
+        p    = put_zigzag(p, (int64_t)(intx_t)(c.store_addr - (uintx_t)state.store_addr));
+        p    = put_varint(p, c.store_data);
+        state.store_addr = c.store_addr;
+    }
+    *flags      = f;
+    state.cycle = c.cycle;
+    state.pc    = (uintx_t)(c.pc + record_length(f, c.ir));
+    hdr[cur].records++;
+    records++;
+    if (p>=end) {
+        end_chunk();
+    }
+}
+
+bool TraceWriter::close() {
+    if (fp==NULL) {
+        return true;
+    }
+    if (hdr[cur].records!=0) {
+        end_chunk();
+    }
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        done = true;
+    }
+    cv.notify_all();
+    writer.join();
+    bool ok = !error && (fclose(fp)==0);
+    fp = NULL;
+    return ok;
+}
+
+//------------------------------------------------------------------------------
+// TraceReader
+//------------------------------------------------------------------------------
+TraceReader::TraceReader() {
+    fp    = NULL;
+    p     = NULL;
+    end   = NULL;
+    left  = 0;
+    error = false;
+}
+
+TraceReader::~TraceReader() {
+    if (fp!=NULL) {
+        fclose(fp);
+    }
+}
+
+bool TraceReader::open(const char *filename) {
+    TraceHeader h;
+    if ((fp = fopen(filename, "rb"))==NULL) {
+        return false;
+    }
+    if ((fread(&h, sizeof(h), 1, fp)!=1) || (h.magic!=TRACE_MAGIC) || (h.version!=TRACE_VERSION)) {
+        return false;
+    }
+    xlen = h.xlen;
+    return true;
+}
+
+bool TraceReader::next(Commit &c) {
+    while (left==0) {
+        TraceChunkHeader h;
+        if (fread(&h, sizeof(h), 1, fp)!=1) {
+            return false; // end of the trace
+        }
+        if (h.magic!=TRACE_CHUNK_MAGIC) {
+            error = true;
+            return false;
+        }
+        chunk.resize(h.size);
+        if (fread(chunk.data(), 1, h.size, fp)!=h.size) {
+            error = true;
+            return false;
+        }
+        state.priv       = h.priv;
+        state.cycle      = h.cycle;
+        state.pc         = h.pc;
+        state.store_addr = h.store_addr;
+        memcpy(state.reg, h.reg, sizeof(state.reg));
+        p    = chunk.data();
+        end  = p + h.size;
+        left = h.records;
+    }
+
+    uint64_t mask = (xlen==32) ? 0xffffffffULL : ~0ULL;
+    uint64_t u;
+    int64_t  d;
+    bool     ok = (p<end);
+    uint8_t  f  = (ok) ? *p++ : 0;
+    if (f & TRACE_PRIV) {
+        ok = ok && (p<end);
+        state.priv = (ok) ? *p++ : 0;
+    }
+    c.priv = state.priv;
+    c.pc = state.pc;
+    if (f & TRACE_PC) {
+        ok  = ok && get_zigzag(p, end, d);
+        if (ok) {
+            c.pc = (state.pc + d) & mask;
+        }
+    }
+    c.cycle = state.cycle + 1;
+    if (f & TRACE_CYCLE) {
+        ok = ok && get_varint(p, end, u);
+        if (ok) {
+            c.cycle += u;
+        }
+    }
+    c.compressed = (f & TRACE_RVC);
+    if (c.compressed) {
+        ok = ok && (p+2<=end);
+        if (ok) {
+            memcpy(&c.cir, p, 2);
+            c.ir = rvc_expand(c.cir);
+            p   += 2;
+        }
+    } else {
+        ok = ok && (p+4<=end);
+        if (ok) {
+            memcpy(&c.ir, p, 4);
+            c.cir = c.ir;
+            p    += 4;
+        }
+    }
+    c.nreg = (f >> TRACE_NREG_SHIFT) & 0x3;
+    if (c.nreg==3) {
+        ok     = ok && get_varint(p, end, u) && (u<=32);
+        c.nreg = (ok) ? u : 0;
+    }
+    for (int i=0; ok && (i<c.nreg); i++) {
+        ok = (p<end);
+        if (ok) {
+            c.rd[i] = *p++ & 0x1f;
+            ok      = get_zigzag(p, end, d);
+        }
+        if (ok) {
+            state.reg[c.rd[i]] = (state.reg[c.rd[i]] + d) & mask;
+            c.value[i] = state.reg[c.rd[i]];
+        }
+    }
+    c.trap      = (f & TRACE_TRAP);
+    c.store_len = 0;
+    if (f & TRACE_STORE) {
+        ok = ok && (p<end);
+        if (ok) {
+            c.store_len = *p++;
+            ok = get_zigzag(p, end, d) && get_varint(p, end, c.store_data);
+        }
+        if (ok) {
+            state.store_addr = (state.store_addr + d) & mask;
+            c.store_addr     = state.store_addr;
+        }
+    }
+    if (!ok) {
+        error = true;
+        return false;
+    }
+    state.cycle = c.cycle;
+    state.pc    = (c.pc + record_length(f, c.ir)) & mask;
+    left--;
+    return true;
+}
@@ -0,0 +1,161 @@
+#if !defined(TRACE_H_)
+#define TRACE_H_
+
+#include <cstdio>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "rvemu.h"
+
+//------------------------------------------------------------------------------
+// Commit record
+//------------------------------------------------------------------------------
+// What one eval() did, as seen by a commit log: the instruction and the
+// registers and memory it changed. Filled by CommitLog (commit.h).
+struct Commit {
+    uint64_t cycle     ; // after the instruction, as TRACE_RF prints it
+    uintx_t  pc        ;
+    uint32_t ir        ; // as exec() left it (RVC expanded), as TRACE_RF prints it
+    uint16_t cir       ; // the compressed instruction, if compressed
+    bool     compressed;
+    bool     trap      ; // raised an exception and did not retire
+    uint8_t  priv      ; // privilege level it executed in
+    int      nreg      ;
+    uint8_t  rd   [32] ; // registers written, in order of number
+    uintx_t  value[32] ;
+    uint8_t  store_len ; // 0: no store
+    uintx_t  store_addr;
+    uint64_t store_data;
+    bool     load      ; // a load, lr or AMO; not in binary traces
+    uintx_t  load_addr ;
+    uintx_t  next_pc   ; // as the instruction left it (the handler after a trap, not
+                         // after an interrupt taken next); not in binary traces
+};
+
+// opcode[6:2] of the instructions that write rd (csr* only when funct3!=0),
+// for the readers of a Commit that report rd
+#define WRITES_RD ((1<<0b00000) | (1<<0b00100) | (1<<0b00101) | (1<<0b00110) | (1<<0b01011) | \
+                   (1<<0b01100) | (1<<0b01101) | (1<<0b01110) | (1<<0b11001) | (1<<0b11011))
+
+//------------------------------------------------------------------------------
+// Binary trace (--trace)
+//------------------------------------------------------------------------------
+// A file header followed by chunks. Every chunk starts with the state the
+// deltas of its first record are taken from, so a chunk can be decoded on
+// its own. A record is
+//
+//   flags        1 byte, TRACE_*
+//   priv         1 byte                                    if TRACE_PRIV
+//   pc           zigzag varint of pc - expected pc        if TRACE_PC
+//                (expected: pc + length of the previous instruction)
+//   cycle        varint of cycle - previous cycle - 1      if TRACE_CYCLE
+//   ir           2 bytes (TRACE_RVC: ir is its expansion) or 4 bytes
+//   nreg         varint                                    if TRACE_NREG is 3
+//   registers    nreg times: 1 byte number, zigzag varint of value - old value
+//   store        1 byte length, zigzag varint of addr - previous store
+//                address, varint of data                   if TRACE_STORE
+//
+// so that a typical instruction takes 4 to 8 bytes instead of the ~300 of a
+// TRACE_RF line.
+#define TRACE_MAGIC       0x52545652 // "RVTR"
+#define TRACE_CHUNK_MAGIC 0x43545652 // "RVTC"
+#define TRACE_VERSION     1
+
+#define TRACE_PC          0x01
+#define TRACE_CYCLE       0x02
+#define TRACE_RVC         0x04
+#define TRACE_STORE       0x08
+#define TRACE_TRAP        0x10
+#define TRACE_NREG_SHIFT  5    // 2 bits: number of registers, 3: a varint follows
+#define TRACE_PRIV        0x80
+
+#if !defined(TRACE_CHUNK_SIZE)
+#define TRACE_CHUNK_SIZE  (1<<20) // bytes
+#endif
+#if !defined(TRACE_CHUNKS)
+#define TRACE_CHUNKS      8       // in the ring between the emulator and the writer thread
+#endif
+#define TRACE_RECORD_MAX  (2 + 10 + 10 + 4 + 10 + 32*11 + 21) // bytes, worst case
+
+struct TraceHeader {
+    uint32_t magic  ;
+    uint32_t version;
+    uint32_t xlen   ;
+    uint32_t reserved;
+};
+
+// state before the first record of the chunk
+struct TraceChunkHeader {
+    uint32_t magic     ;
+    uint32_t size      ; // bytes of records that follow
+    uint32_t records   ;
+    uint32_t priv      ;
+    uint64_t cycle     ;
+    uint64_t pc        ; // expected pc
+    uint64_t store_addr;
+    uint64_t reg[32]   ;
+};
+
+struct TraceState {
+    uint32_t priv      ;
+    uint64_t cycle     ;
+    uint64_t pc        ;
+    uint64_t store_addr;
+    uint64_t reg[32]   ;
+};
+
+// Encodes records into a ring of chunks that a writer thread drains to the
+// file, so the emulator only waits on the disk when the ring is full.
+struct TraceWriter {
+    FILE      *fp;
+    TraceState state;
+
+    std::vector<uint8_t> chunk[TRACE_CHUNKS];
+    bool                 full [TRACE_CHUNKS];
+    TraceChunkHeader     hdr  [TRACE_CHUNKS];
+    int                  cur; // chunk being filled
+    uint8_t             *p  ; // next byte of it
+    uint8_t             *end;
+    std::mutex              lock;
+    std::condition_variable cv  ;
+    std::thread             writer;
+    bool                    done;
+    bool                    error;
+
+    uint64_t records;
+    uint64_t bytes  ;
+
+    TraceWriter();
+    ~TraceWriter();
+
+    bool open (const char *filename, const uintx_t reg[32], uint64_t cycle, uintx_t pc, uint8_t priv);
+    void write(const Commit &c);
+    bool close();
+    void start_chunk();
+    void end_chunk  ();
+    void drain();
+};
+
+// Decodes a trace file one record at a time.
+struct TraceReader {
+    FILE      *fp;
+    TraceState state;
+    uint32_t   xlen;
+
+    std::vector<uint8_t> chunk;
+    const uint8_t *p  ;
+    const uint8_t *end;
+    uint32_t   left; // records left in the chunk
+
+    TraceReader();
+    ~TraceReader();
+
+    bool open(const char *filename);
+    // Returns false at the end of the trace or on a malformed one (then
+    // error is set).
+    bool next(Commit &c);
+    bool error;
+};
+
+#endif // TRACE_H_
@@ -0,0 +1,75 @@
+#!/usr/bin/env python3
+# Compares two rvemu --bench-json results (make bench BENCH_BASELINE=...).
+#
+#   tools/bench-compare.py [--threshold PCT] baseline.json new.json
+#
+# A benchmark regresses when its median MIPS drops by more than the threshold
+# and by more than the noise of the two measurements (twice the combined
+# standard deviation), so that a noisy host does not fail a run. A change of
+# instret means the programs differ, and their MIPS are not compared.
+# Exits 1 if any benchmark regressed.
+
+import argparse
+import json
+import math
+import sys
+
+
+def load(filename):
+    with open(filename) as f:
+        results = json.load(f)
+    return {b['name']: b for b in results['benchmarks']}, results
+
+
+def main():
+    parser = argparse.ArgumentParser(description='compare rvemu --bench-json results')
+    parser.add_argument('--threshold', type=float, default=5.0,
+                        help='regression threshold in percent of median MIPS (default: 5)')
+    parser.add_argument('baseline')
+    parser.add_argument('new')
+    args = parser.parse_args()
+
+    base, base_all = load(args.baseline)
+    new, new_all = load(args.new)
+    if base_all.get('xlen') != new_all.get('xlen'):
+        print('warning: xlen %s vs %s' % (base_all.get('xlen'), new_all.get('xlen')))
+
+    width = max([len('benchmark')] + [len(name) for name in new])
+    print('%-*s  %9s  %9s  %8s  %8s  %s' % (width, 'benchmark', 'base MIPS', 'new MIPS', 'change', 'noise', ''))
+    regressed = 0
+    for name, b in new.items():
+        a = base.get(name)
+        if a is None:
+            print('%-*s  %9s  %9.1f  %8s  %8s  new' % (width, name, '-', b['mips']['median'], '', ''))
+            continue
+        if a['instret'] != b['instret']:
+            print('%-*s  %9.1f  %9.1f  %8s  %8s  instret %d -> %d, not compared' %
+                  (width, name, a['mips']['median'], b['mips']['median'], '', '', a['instret'], b['instret']))
+            continue
+        ma = a['mips']['median']
+        mb = b['mips']['median']
+        change = (mb - ma) / ma * 100 if ma > 0 else 0.0
+        noise = 2 * math.sqrt(a['mips']['variance'] + b['mips']['variance'])
+        noise = noise / ma * 100 if ma > 0 else 0.0
+        status = ''
+        if change < -args.threshold and -change > noise:
+            status = 'REGRESSION'
+            regressed += 1
+        elif change > args.threshold and change > noise:
+            status = 'faster'
+        print('%-*s  %9.1f  %9.1f  %+7.1f%%  %7.1f%%  %s' % (width, name, ma, mb, change, noise, status))
+    for name in base:
+        if name not in new:
+            print('%-*s  %9.1f  %9s  %8s  %8s  missing' % (width, name, base[name]['mips']['median'], '-', '', ''))
+
+    ta = base_all['total']['mips']
+    tb = new_all['total']['mips']
+    print('\n%-*s  %9.1f  %9.1f  %+7.1f%%' % (width, 'total', ta, tb, (tb - ta) / ta * 100 if ta > 0 else 0.0))
+    if regressed:
+        print('%d benchmark(s) regressed by more than %g%%' % (regressed, args.threshold))
+        return 1
+    return 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())
@@ -0,0 +1,411 @@
+// rvemu-microbench: times the parts of the emulator one at a time, so that a
+// change to eval() or RAM can be judged per category instead of only by the
+// end-to-end CoreMark number.
+//
+//   ./rvemu-microbench64 [-c CPU] [-r N] [-t MS] [name ...]
+//
+// Host-side benchmarks call one function in a loop (RAM::read_uintN and
+// write_uintN, Machine::target_read_uint32 on RAM and on the CLINT, the
+// dispatch to a device, rvc_expand over every encoding). Guest benchmarks
+// write a small loop into RAM and call Machine::eval() on it: straight-line
+// ALU code (fetch and decode of 32-bit instructions), the same with RVC
+// instructions, a branch-heavy loop, a load/store-heavy loop, AMO and lr/sc
+// sequences and loads from CLINT mtime.
+//
+// The thread is pinned to one CPU. Each benchmark is run until it takes about
+// a quarter of the time of a run (warm-up and calibration), then timed N
+// times; the median ns per operation (per guest instruction) is reported,
+// with the spread of the runs.
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <algorithm>
+#include <chrono>
+#include <vector>
+#include <getopt.h>
+#include <sched.h>
+#include "machine.h"
+#include "rvc.h"
+
+#define MICROBENCH_RUNS 7  // timed runs of each benchmark
+#define MICROBENCH_MS   50 // host milliseconds per run
+
+#define DATA_BASE 0x10000 // data of the guest loops
+#define DATA_MASK 0x7ff8  // and their addresses wrap within 32 KiB
+
+static Machine *m;
+
+//------------------------------------------------------------------------------
+// Guest code
+//------------------------------------------------------------------------------
+enum {
+    ZERO=0, T0=5, T1=6, T2=7, A0=10, A1=11, A2=12, A3=13, T3=28,
+};
+
+static uint32_t r_type(int funct7, int rs2, int rs1, int funct3, int rd, int opcode) {
+    return (funct7 << 25) | (rs2 << 20) | (rs1 << 15) | (funct3 << 12) | (rd << 7) | opcode;
+}
+
+static uint32_t i_type(int imm, int rs1, int funct3, int rd, int opcode) {
+    return ((imm & 0xfff) << 20) | (rs1 << 15) | (funct3 << 12) | (rd << 7) | opcode;
+}
+
+static uint32_t s_type(int imm, int rs2, int rs1, int funct3, int opcode) {
+    return ((imm >> 5 & 0x7f) << 25) | (rs2 << 20) | (rs1 << 15) | (funct3 << 12) | ((imm & 0x1f) << 7) | opcode;
+}
+
+static uint32_t b_type(int imm, int rs2, int rs1, int funct3) {
+    return ((imm >> 12 & 0x1) << 31) | ((imm >> 5 & 0x3f) << 25) | (rs2 << 20) | (rs1 << 15) |
+           (funct3 << 12) | ((imm >> 1 & 0xf) << 8) | ((imm >> 11 & 0x1) << 7) | 0x63;
+}
+
+static uint32_t jal(int imm, int rd) {
+    return ((imm >> 20 & 0x1) << 31) | ((imm >> 1 & 0x3ff) << 21) | ((imm >> 11 & 0x1) << 20) |
+           ((imm >> 12 & 0xff) << 12) | (rd << 7) | 0x6f;
+}
+
+static uint32_t add (int rd, int rs1, int rs2) { return r_type(0x00, rs2, rs1, 0, rd, 0x33); }
+static uint32_t sub (int rd, int rs1, int rs2) { return r_type(0x20, rs2, rs1, 0, rd, 0x33); }
+static uint32_t xor_(int rd, int rs1, int rs2) { return r_type(0x00, rs2, rs1, 4, rd, 0x33); }
+static uint32_t and_(int rd, int rs1, int rs2) { return r_type(0x00, rs2, rs1, 7, rd, 0x33); }
+static uint32_t addi(int rd, int rs1, int imm) { return i_type(imm, rs1, 0, rd, 0x13); }
+static uint32_t andi(int rd, int rs1, int imm) { return i_type(imm, rs1, 7, rd, 0x13); }
+static uint32_t slli(int rd, int rs1, int sh ) { return i_type(sh , rs1, 1, rd, 0x13); }
+static uint32_t load (int funct3, int rd , int rs1, int imm) { return i_type(imm, rs1, funct3, rd, 0x03); }
+static uint32_t store(int funct3, int rs2, int rs1, int imm) { return s_type(imm, rs2, rs1, funct3, 0x23); }
+static uint32_t amo  (int funct5, int funct3, int rd, int rs1, int rs2) {
+    return r_type(funct5 << 2, rs2, rs1, funct3, rd, 0x2f);
+}
+
+// RVC, registers x8-x15 or any for c.addi/c.add/c.mv/c.slli
+static uint16_t c_addi(int rd, int imm) { return ((imm >> 5 & 0x1) << 12) | (rd << 7) | ((imm & 0x1f) << 2) | 0x1; }
+static uint16_t c_slli(int rd, int sh ) { return ((sh  >> 5 & 0x1) << 12) | (rd << 7) | ((sh  & 0x1f) << 2) | 0x2; }
+static uint16_t c_add (int rd, int rs2) { return 0x9002 | (rd << 7) | (rs2 << 2); }
+static uint16_t c_mv  (int rd, int rs2) { return 0x8002 | (rd << 7) | (rs2 << 2); }
+static uint16_t c_xor (int rd, int rs2) { return 0x8c21 | ((rd-8) << 7) | ((rs2-8) << 2); }
+
+// Writes instructions from address 0; jump() closes the loop.
+struct Asm {
+    uintx_t pc;
+
+    Asm() : pc(0) {}
+    void emit (uint32_t ir) { m->ram.write_uint32(pc, ir); pc += 4; }
+    void emitc(uint16_t ir) { m->ram.write_uint16(pc, ir); pc += 2; }
+    void jump (uintx_t to ) { emit(jal(to-pc, ZERO)); }
+};
+
+static void guest_reset() {
+    m->reset(0);
+    m->reg[A0] = DATA_BASE;
+    m->reg[A1] = DATA_MASK;
+    m->reg[A2] = 0;
+    m->reg[T0] = 1;
+    m->reg[T1] = 3;
+}
+
+static void setup_alu() {
+    guest_reset();
+    Asm a;
+    for (int i=0; i<16; i++) {
+        a.emit(add (T0, T0, T1));
+        a.emit(xor_(T2, T2, T0));
+        a.emit(addi(T1, T1, 7));
+        a.emit(slli(T3, T0, 3));
+        a.emit(sub (T2, T2, T3));
+        a.emit(and_(T3, T2, T1));
+        a.emit(andi(A3, T3, 0x55));
+    }
+    a.jump(0);
+}
+
+static void setup_rvc() {
+    guest_reset();
+    m->reg[8] = 1;
+    m->reg[9] = 3;
+    Asm a;
+    for (int i=0; i<16; i++) {
+        a.emitc(c_addi(8 , 5));
+        a.emitc(c_add (9 , 8));
+        a.emitc(c_slli(T3, 2));
+        a.emitc(c_xor (9 , 8));
+        a.emitc(c_mv  (T3, 9));
+        a.emitc(c_addi(T3, -3));
+        a.emitc(c_add (8 , T3));
+    }
+    a.jump(0);
+}
+
+// 4 of the 9 to 11 instructions of an iteration are branches, the first three
+// taken one time in two or four.
+static void setup_branch() {
+    guest_reset();
+    Asm a;
+    a.emit(addi(T0, T0, 1));      //  0: loop
+    a.emit(andi(T1, T0, 1));      //  4
+    a.emit(b_type(8, ZERO, T1, 0)); //  8: beq t1, zero, 16
+    a.emit(addi(T2, T2, 1));      // 12
+    a.emit(andi(T1, T0, 2));      // 16
+    a.emit(b_type(8, ZERO, T1, 1)); // 20: bne t1, zero, 28
+    a.emit(addi(T2, T2, 3));      // 24
+    a.emit(andi(T1, T0, 3));      // 28
+    a.emit(b_type(8, ZERO, T1, 0)); // 32: beq t1, zero, 40
+    a.emit(sub (T2, T2, T0));     // 36
+    a.emit(b_type(-40, T0, ZERO, 1)); // 40: bne t0, zero, loop (taken)
+    a.jump(0);
+}
+
+// Loads and stores of every width on a buffer that wraps at 32 KiB.
+static void setup_ldst() {
+    guest_reset();
+    Asm a;
+    a.emit(add  (A3, A0, A2));        // a3 = DATA_BASE + offset
+#if XLEN == 64
+    a.emit(load (3, T0, A3, 0));      // ld
+    a.emit(store(3, T0, A3, 8));      // sd
+#endif
+    a.emit(load (2, T1, A3, 16));     // lw
+    a.emit(store(2, T1, A3, 20));     // sw
+    a.emit(load (1, T2, A3, 24));     // lh
+    a.emit(store(1, T2, A3, 26));     // sh
+    a.emit(load (4, T3, A3, 28));     // lbu
+    a.emit(store(0, T3, A3, 31));     // sb
+    a.emit(addi (A2, A2, 8));
+    a.emit(and_ (A2, A2, A1));
+    a.jump(0);
+}
+
+static void setup_amo() {
+    guest_reset();
+    Asm a;
+    a.emit(amo(0x00, 2, T0, A0, T1)); // amoadd.w
+    a.emit(amo(0x01, 2, T2, A0, T0)); // amoswap.w
+    a.emit(amo(0x08, 2, T3, A0, T1)); // amoor.w
+    a.emit(amo(0x14, 2, T3, A0, T0)); // amomax.w
+    a.emit(amo(0x02, 2, T2, A0, 0 )); // lr.w
+    a.emit(addi(T2, T2, 1));
+    a.emit(amo(0x03, 2, T3, A0, T2)); // sc.w
+#if XLEN == 64
+    a.emit(amo(0x00, 3, T0, A0, T1)); // amoadd.d
+#endif
+    a.jump(0);
+}
+
+static void setup_mmio() {
+    guest_reset();
+    m->reg[A2] = CLINT_BASE + CLINT_MTIME;
+    Asm a;
+    for (int i=0; i<8; i++) {
+        a.emit(load(2, T0, A2, 0));         // lw t0, 0(a2): mtime
+        a.emit(add (T1, T1, T0));
+    }
+    a.jump(0);
+}
+
+static uint64_t run_guest(uint64_t n) {
+    for (uint64_t i=0; i<n; i++) {
+        m->eval();
+    }
+    return m->reg[T0] + m->reg[T1] + m->reg[T2];
+}
+
+//------------------------------------------------------------------------------
+// Host functions
+//------------------------------------------------------------------------------
+// addresses in the data buffer, in an order the host prefetcher cannot guess
+static uintx_t data_addr(uint64_t i, int len) {
+    return DATA_BASE + ((i * 0x9e3779b1) & DATA_MASK & -len);
+}
+
+#define RAM_READ(size) \
+static uint64_t run_ram_read ## size(uint64_t n) { \
+    uint64_t sum = 0; \
+    for (uint64_t i=0; i<n; i++) { \
+        sum += m->ram.read_uint ## size(data_addr(i, size/8)); \
+    } \
+    return sum; \
+}
+RAM_READ(8)
+RAM_READ(16)
+RAM_READ(32)
+RAM_READ(64)
+
+#define RAM_WRITE(size) \
+static uint64_t run_ram_write ## size(uint64_t n) { \
+    for (uint64_t i=0; i<n; i++) { \
+        m->ram.write_uint ## size(data_addr(i, size/8), i); \
+    } \
+    return m->ram.read_uint8(DATA_BASE); \
+}
+RAM_WRITE(8)
+RAM_WRITE(16)
+RAM_WRITE(32)
+RAM_WRITE(64)
+
+static uint64_t run_target_read(uint64_t n) {
+    uint64_t sum = 0;
+    for (uint64_t i=0; i<n; i++) {
+        sum += m->target_read_uint32(data_addr(i, 4));
+    }
+    return sum;
+}
+
+static uint64_t run_target_mmio(uint64_t n) {
+    uint64_t sum = 0;
+    for (uint64_t i=0; i<n; i++) {
+        sum += m->target_read_uint32(CLINT_BASE + CLINT_MTIME);
+    }
+    return sum;
+}
+
+static uint64_t run_mmio_read(uint64_t n) {
+    uint64_t sum = 0;
+    for (uint64_t i=0; i<n; i++) {
+        sum += m->mmio_read(CLINT_BASE + CLINT_MTIMECMP, 8);
+    }
+    return sum;
+}
+
+// every 16-bit encoding, in order
+static uint64_t run_rvc_expand(uint64_t n) {
+    uint64_t sum = 0;
+    for (uint64_t i=0; i<n; i++) {
+        sum += rvc_expand((uint16_t)i);
+    }
+    return sum;
+}
+
+static void setup_host() {
+    guest_reset();
+}
+
+//------------------------------------------------------------------------------
+// Benchmarks
+//------------------------------------------------------------------------------
+struct Bench {
+    const char *name ;
+    const char *what ;
+    bool        guest; // n is in guest instructions
+    void      (*setup)();
+    uint64_t  (*run  )(uint64_t n);
+};
+
+static const Bench benches[] = {
+    {"alu"       , "eval: fetch and decode, 32-bit ALU"    , true , setup_alu   , run_guest      },
+    {"rvc"       , "eval: fetch and decode, RVC ALU"       , true , setup_rvc   , run_guest      },
+    {"branch"    , "eval: 4 branches in 9-11 instructions" , true , setup_branch, run_guest      },
+    {"ldst"      , "eval: loads and stores of each width"  , true , setup_ldst  , run_guest      },
+    {"amo"       , "eval: amo*.w, lr.w/sc.w"               , true , setup_amo   , run_guest      },
+    {"mmio"      , "eval: lw of CLINT mtime"               , true , setup_mmio  , run_guest      },
+    {"rvc_expand", "rvc_expand(), every encoding"          , false, setup_host  , run_rvc_expand },
+    {"read8"     , "RAM::read_uint8"                       , false, setup_host  , run_ram_read8  },
+    {"read16"    , "RAM::read_uint16"                      , false, setup_host  , run_ram_read16 },
+    {"read32"    , "RAM::read_uint32"                      , false, setup_host  , run_ram_read32 },
+    {"read64"    , "RAM::read_uint64"                      , false, setup_host  , run_ram_read64 },
+    {"write8"    , "RAM::write_uint8"                      , false, setup_host  , run_ram_write8 },
+    {"write16"   , "RAM::write_uint16"                     , false, setup_host  , run_ram_write16},
+    {"write32"   , "RAM::write_uint32"                     , false, setup_host  , run_ram_write32},
+    {"write64"   , "RAM::write_uint64"                     , false, setup_host  , run_ram_write64},
+    {"target_ram", "Machine::target_read_uint32, RAM"      , false, setup_host  , run_target_read},
+    {"target_io" , "Machine::target_read_uint32, CLINT"    , false, setup_host  , run_target_mmio},
+    {"mmio_read" , "Machine::mmio_read, CLINT mtimecmp"    , false, setup_host  , run_mmio_read  },
+};
+
+static volatile uint64_t sink; // keeps the results of the runs alive
+
+static double time_run(const Bench &b, uint64_t n) {
+    auto start = std::chrono::steady_clock::now();
+    sink = b.run(n);
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+static void usage() {
+    fprintf(stderr, "Usage: rvemu-microbench%d [options] [name ...]\n", XLEN);
+    fprintf(stderr, "  -c, --cpu CPU   pin to host CPU (default: the one it starts on)\n");
+    fprintf(stderr, "  -r, --runs N    timed runs of each benchmark (default %d)\n", MICROBENCH_RUNS);
+    fprintf(stderr, "  -t, --time MS   host milliseconds per run (default %d)\n", MICROBENCH_MS);
+    fprintf(stderr, "Benchmarks:\n");
+    for (const Bench &b : benches) {
+        fprintf(stderr, "  %-12s%s\n", b.name, b.what);
+    }
+    exit(2);
+}
+
+int main(int argc, char **argv) {
+    static struct option long_options[] = {
+        {"cpu" , required_argument, NULL, 'c'},
+        {"runs", required_argument, NULL, 'r'},
+        {"time", required_argument, NULL, 't'},
+        {0, 0, 0, 0},
+    };
+    int cpu  = sched_getcpu();
+    int runs = MICROBENCH_RUNS;
+    int ms   = MICROBENCH_MS;
+    int opt;
+    while ((opt = getopt_long(argc, argv, "c:r:t:", long_options, NULL))!=-1) {
+        switch (opt) {
+        case 'c': cpu  = atoi(optarg); break;
+        case 'r': runs = atoi(optarg); break;
+        case 't': ms   = atoi(optarg); break;
+        default : usage();             break;
+        }
+    }
+    if ((runs<1) || (ms<1)) {
+        usage();
+    }
+    for (int i=optind; i<argc; i++) {
+        bool known = false;
+        for (const Bench &b : benches) {
+            known |= (strcmp(argv[i], b.name)==0);
+        }
+        if (!known) {
+            fprintf(stderr, "Error: unknown benchmark (%s).\n", argv[i]);
+            exit(2);
+        }
+    }
+
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    if (sched_setaffinity(0, sizeof(set), &set)!=0) {
+        fprintf(stderr, "Warning: cannot pin to CPU %d; timings may be noisy.\n", cpu);
+    }
+
+    m = new Machine("/dev/null");
+    printf("rvemu-microbench%d: CPU %d, median of %d runs of %d ms\n\n", XLEN, cpu, runs, ms);
+    printf("%-12s  %9s  %8s  %6s  %s\n", "benchmark", "ns/op", "Mop/s", "spread", "");
+    double target = ms / 1000.0;
+    for (const Bench &b : benches) {
+        bool selected = (optind==argc);
+        for (int i=optind; i<argc; i++) {
+            selected |= (strcmp(argv[i], b.name)==0);
+        }
+        if (!selected) {
+            continue;
+        }
+
+        // warm up, and find the n of a run
+        b.setup();
+        uint64_t n = 1024;
+        double   t;
+        while ((t = time_run(b, n))<target/4) {
+            n *= 2;
+        }
+        n = std::max<uint64_t>(n * (target / t), 1);
+
+        std::vector<double> ns;
+        for (int k=0; k<runs; k++) {
+            ns.push_back(time_run(b, n) * 1e9 / n);
+        }
+        std::sort(ns.begin(), ns.end());
+        double median = ns[ns.size()/2];
+        printf("%-12s  %9.2f  %8.1f  %5.1f%%  %s\n", b.name, median, 1e3 / median,
+               (ns.back() - ns.front()) / median * 100, b.what);
+        fflush(stdout);
+        if (b.guest && (m->ntrap!=0)) {
+            fprintf(stderr, "Error: %s: the guest loop trapped (mcause 0x%lx).\n", b.name, (uint64_t)m->mcause);
+            exit(2);
+        }
+    }
+    delete m;
+    return 0;
+}
@@ -0,0 +1,53 @@
+// rvemu-trace: converts a binary trace (rvemu --trace) to the text layout of
+// TRACE_RF_FILE (without the DEBUG columns).
+//
+//   ./rvemu-trace64 trace.bin [trace_rf.txt]
+#include <cstdio>
+#include <cstdlib>
+#include "trace.h"
+
+int main(int argc, char **argv) {
+    if ((argc<2) || (argc>3)) {
+        fprintf(stderr, "Usage: %s <trace> [output]\n", argv[0]);
+        return 1;
+    }
+
+    TraceReader tr;
+    if (!tr.open(argv[1])) {
+        fprintf(stderr, "Error: %s is not an rvemu trace.\n", argv[1]);
+        return 1;
+    }
+    if (tr.xlen!=XLEN) {
+        fprintf(stderr, "Error: %s is an RV%u trace; use rvemu-trace%u.\n", argv[1], tr.xlen, tr.xlen);
+        return 1;
+    }
+    FILE *fp = stdout;
+    if ((argc==3) && ((fp = fopen(argv[2], "w"))==NULL)) {
+        fprintf(stderr, "Error: %s cannot be opened.\n", argv[2]);
+        return 1;
+    }
+
+    Commit c;
+    while (tr.next(c)) {
+#if      XLEN == 32
+        fprintf(fp, "%08lu %08x %08x\n", c.cycle, c.pc, c.ir);
+#else // XLEN == 64
+        fprintf(fp, "%08lu %016lx %08x\n", c.cycle, c.pc, c.ir);
+#endif
+        for (int i=0; i<4; i++) {
+            for (int j=0; j<8; j++) {
+#if      XLEN == 32
+                fprintf(fp, "%08x", (uint32_t)tr.state.reg[i*8+j]);
+#else // XLEN == 64
+                fprintf(fp, "%016lx", tr.state.reg[i*8+j]);
+#endif
+                fprintf(fp, ((j!=7) ? " " : "\n"));
+            }
+        }
+    }
+    if (tr.error) {
+        fprintf(stderr, "Error: %s is truncated or corrupt.\n", argv[1]);
+        return 1;
+    }
+    return (fclose(fp)==0) ? 0 : 1;
+}
@@ -0,0 +1,477 @@
+// rvemu-tracediff: compares two commit traces record by record and reports
+// where they diverge. Each trace is either the text of TRACE_RF_FILE (DEBUG
+// columns are ignored) or a binary trace (rvemu --trace); the two may be of
+// different kinds.
+//
+//   ./rvemu-tracediff64 [-n N] [-C N] [-i FIELD,...] rtl_trace.txt trace.bin
+//
+// Text traces are memory-mapped and compared as raw bytes (the register
+// lines of a record in one memcmp, against the same lines kept up to date
+// from the written registers of a binary trace); a record is only parsed
+// where they differ, so the cost is close to that of reading the files.
+//
+// Exit status: 0 if the traces are the same, 1 if they differ, 2 on error.
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+#include <fcntl.h>
+#include <getopt.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "disasm.h"
+#include "trace.h"
+
+// fields of a record, as bits of the --ignore mask (x0-x31 are bits 0-31)
+#define FIELD_PC     (1ULL << 32)
+#define FIELD_IR     (1ULL << 33)
+#define FIELD_CYCLE  (1ULL << 34)
+#define FIELD_STORE  (1ULL << 35) // binary traces only
+#define FIELD_REGS   0xffffffffULL
+
+#define TRACEDIFF_CONTEXT 3  // records shown before a divergence
+#define TRACEDIFF_MAX     1  // divergences reported
+
+struct Record {
+    const char *text  ; // start of the record in a text trace, NULL if binary
+    const char *regs  ; // its register lines (of a binary one: valid for the latest record)
+    bool        parsed; // the fields below are valid
+    uint64_t    cycle ;
+    uint64_t    pc    ;
+    uint32_t    ir    ;
+    uint64_t    reg[32];
+    uint8_t     store_len ;
+    uint64_t    store_addr;
+    uint64_t    store_data;
+};
+
+//------------------------------------------------------------------------------
+// Input
+//------------------------------------------------------------------------------
+struct Input {
+    const char *name;
+    bool        binary;
+    uint64_t    nrecords; // records read so far
+
+    // text
+    const char *base;
+    const char *p   ;
+    const char *end ;
+    size_t      size;
+    int         width; // hex digits of pc and registers
+    size_t      regs_size;
+
+    // binary
+    TraceReader       tr;
+    std::vector<char> regs_text; // its registers as the lines of a text trace
+
+    bool open(const char *filename);
+    // Returns false at the end of the trace; exits on a malformed one.
+    bool next(Record &r);
+    bool parse_header(Record &r);
+    void parse(Record &r);
+    uint64_t line(const Record &r); // of a text record, for messages
+};
+
+static void error(const char *fmt, const char *name, uint64_t n) {
+    fprintf(stderr, "Error: ");
+    fprintf(stderr, fmt, name, n);
+    fprintf(stderr, "\n");
+    exit(2);
+}
+
+bool Input::open(const char *filename) {
+    name     = filename;
+    nrecords = 0;
+    base     = NULL;
+    size     = 0;
+    width    = XLEN/4;
+
+    regs_size = 32*(width+1);
+
+    int fd = ::open(filename, O_RDONLY);
+    struct stat st;
+    if ((fd<0) || (fstat(fd, &st)!=0)) {
+        return false;
+    }
+    size = st.st_size;
+    if (size!=0) {
+        void *m = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (m==MAP_FAILED) {
+            ::close(fd);
+            return false;
+        }
+        base = (const char *)m;
+        madvise(m, size, MADV_SEQUENTIAL);
+    }
+    ::close(fd);
+
+    uint32_t magic = TRACE_MAGIC;
+    binary = (size>=4) && (memcmp(base, &magic, 4)==0);
+    if (binary) {
+        munmap((void *)base, size);
+        base = NULL;
+        if (!tr.open(filename)) {
+            error("%s is not an rvemu trace.", name, 0);
+        }
+        if (tr.xlen!=XLEN) {
+            fprintf(stderr, "Error: %s is an RV%u trace; use rvemu-tracediff%u.\n", name, tr.xlen, tr.xlen);
+            exit(2);
+        }
+        regs_text.resize(regs_size);
+        return true;
+    }
+
+    p   = base;
+    end = base + size;
+    // the pc of the first record tells the XLEN of the trace
+    const char *sp = (p!=end) ? (const char *)memchr(p, ' ', end-p) : NULL;
+    if (sp!=NULL) {
+        const char *pc_end = (const char *)memchr(sp+1, ' ', end-sp-1);
+        int w = (pc_end!=NULL) ? pc_end-sp-1 : 0;
+        if ((w!=width) && ((w==8) || (w==16))) {
+            fprintf(stderr, "Error: %s is an RV%d trace; use rvemu-tracediff%d.\n", name, w*4, w*4);
+            exit(2);
+        }
+    }
+    return true;
+}
+
+static inline uint64_t parse_hex(const char *s, int n, bool &ok) {
+    uint64_t v = 0;
+    for (int i=0; i<n; i++) {
+        char c = s[i];
+        int  d = ((c>='0') && (c<='9')) ? c-'0' :
+                 ((c>='a') && (c<='f')) ? c-'a'+10 :
+                 ((c>='A') && (c<='F')) ? c-'A'+10 : -1;
+        ok = ok && (d>=0);
+        v  = (v << 4) | (d & 0xf);
+    }
+    return v;
+}
+
+static inline void put_hex(char *s, uint64_t v, int n) {
+    for (int i=n-1; i>=0; i--) {
+        s[i] = "0123456789abcdef"[v & 0xf];
+        v  >>= 4;
+    }
+}
+
+bool Input::next(Record &r) {
+    if (binary) {
+        Commit c;
+        if (!tr.next(c)) {
+            if (tr.error) {
+                error("%s is truncated or corrupt after record %lu.", name, nrecords);
+            }
+            return false;
+        }
+        r.text       = NULL;
+        r.parsed     = true;
+        r.cycle      = c.cycle;
+        r.pc         = c.pc;
+        r.ir         = c.ir;
+        r.store_len  = c.store_len;
+        r.store_addr = c.store_addr;
+        r.store_data = c.store_data;
+        memcpy(r.reg, tr.state.reg, sizeof(r.reg));
+        // only the written registers change in the text
+        for (int k=0; k<((nrecords==0) ? 32 : c.nreg); k++) {
+            int i = (nrecords==0) ? k : c.rd[k];
+            put_hex(&regs_text[i*(width+1)], r.reg[i], width);
+            regs_text[i*(width+1)+width] = ((i % 8)!=7) ? ' ' : '\n';
+        }
+        r.regs = regs_text.data();
+        nrecords++;
+        return true;
+    }
+
+    if (p==end) {
+        return false;
+    }
+    const char *eol = (const char *)memchr(p, '\n', end-p);
+    if ((eol==NULL) || ((size_t)(end-eol-1)<regs_size)) {
+        error("%s: record %lu is truncated.", name, nrecords);
+    }
+    r.text   = p;
+    r.regs   = eol+1;
+    r.parsed = false;
+    for (int i=1; i<=4; i++) {
+        if (r.regs[i*8*(width+1)-1]!='\n') {
+            error("%s: record %lu has malformed register lines.", name, nrecords);
+        }
+    }
+    p = r.regs + regs_size;
+    nrecords++;
+    return true;
+}
+
+// header "cycle pc ir [DEBUG columns]" of a text record
+bool Input::parse_header(Record &r) {
+    bool        ok = true;
+    const char *s  = r.text;
+    const char *sp = (const char *)memchr(s, ' ', r.regs-s);
+    ok = ok && (sp!=NULL) && (sp+1+width+1+8<=r.regs);
+    if (ok) {
+        r.cycle = strtoull(s, NULL, 10);
+        r.pc    = parse_hex(sp+1, width, ok);
+        r.ir    = parse_hex(sp+1+width+1, 8, ok);
+    }
+    return ok;
+}
+
+// and its register lines
+void Input::parse(Record &r) {
+    if (r.parsed) {
+        return;
+    }
+    bool ok = parse_header(r);
+    for (int i=0; ok && (i<32); i++) {
+        r.reg[i] = parse_hex(r.regs + i*(width+1), width, ok);
+    }
+    if (!ok) {
+        error("%s: record at line %lu is malformed.", name, line(r));
+    }
+    r.store_len = 0;
+    r.parsed    = true;
+}
+
+uint64_t Input::line(const Record &r) {
+    uint64_t n = 1;
+    for (const char *s=base; (s=(const char *)memchr(s, '\n', r.text-s))!=NULL; s++) {
+        n++;
+    }
+    return n;
+}
+
+//------------------------------------------------------------------------------
+// Compare
+//------------------------------------------------------------------------------
+// header field k (0: cycle, 1: pc, 2: ir) of a text record
+static inline bool text_field(const char *s, const char *end, int k, const char *&f, size_t &len) {
+    for (int i=0; i<k; i++) {
+        s = (const char *)memchr(s, ' ', end-s);
+        if (s==NULL) {
+            return false;
+        }
+        s++;
+    }
+    const char *e = (const char *)memchr(s, ' ', end-s);
+    f   = s;
+    len = ((e!=NULL) ? e : end-1) - s; // end-1: the newline
+    return true;
+}
+
+// Fast path for two text records: raw bytes, field by field.
+static bool same_text(const Record &a, const Record &b, const Input &ia, uint64_t ignore) {
+    static const uint64_t header_field[3] = {FIELD_CYCLE, FIELD_PC, FIELD_IR};
+    for (int k=0; k<3; k++) {
+        if (ignore & header_field[k]) {
+            continue;
+        }
+        const char *fa, *fb;
+        size_t      la,  lb;
+        if (!text_field(a.text, a.regs, k, fa, la) || !text_field(b.text, b.regs, k, fb, lb) ||
+            (la!=lb) || (memcmp(fa, fb, la)!=0)) {
+            return false;
+        }
+    }
+    return ((ignore & FIELD_REGS)==0) && (memcmp(a.regs, b.regs, ia.regs_size)==0);
+}
+
+// Fast path for a text record t and a binary one: the header parsed, the
+// register lines as raw bytes.
+static bool same_mixed(Record &t, const Record &b, Input &it, uint64_t ignore) {
+    return it.parse_header(t) &&
+           ((ignore & FIELD_CYCLE) || (t.cycle==b.cycle)) &&
+           ((ignore & FIELD_PC   ) || (t.pc   ==b.pc   )) &&
+           ((ignore & FIELD_IR   ) || (t.ir   ==b.ir   )) &&
+           ((ignore & FIELD_REGS)==0) && (memcmp(t.regs, b.regs, it.regs_size)==0);
+}
+
+// mask of the fields that differ
+static uint64_t compare(Record &a, Record &b, Input &ia, Input &ib, uint64_t ignore) {
+    if (!a.parsed && !b.parsed && same_text(a, b, ia, ignore)) {
+        return 0;
+    }
+    if ((!a.parsed && b.parsed && same_mixed(a, b, ia, ignore)) ||
+        (a.parsed && !b.parsed && same_mixed(b, a, ib, ignore))) {
+        return 0;
+    }
+    ia.parse(a);
+    ib.parse(b);
+    uint64_t diff = 0;
+    for (int i=1; i<32; i++) {
+        diff |= (uint64_t)(a.reg[i]!=b.reg[i]) << i;
+    }
+    diff |= (a.pc   !=b.pc   ) ? FIELD_PC    : 0;
+    diff |= (a.ir   !=b.ir   ) ? FIELD_IR    : 0;
+    diff |= (a.cycle!=b.cycle) ? FIELD_CYCLE : 0;
+    if ((a.text==NULL) && (b.text==NULL) &&
+        ((a.store_len!=b.store_len) ||
+         ((a.store_len!=0) && ((a.store_addr!=b.store_addr) || (a.store_data!=b.store_data))))) {
+        diff |= FIELD_STORE;
+    }
+    return diff & ~ignore;
+}
+
+//------------------------------------------------------------------------------
+// Report
+//------------------------------------------------------------------------------
+static void print_record(const char *mark, Record &r, Input &in) {
+    char buf[64];
+    in.parse(r);
+    printf("  %-3s %08lu %0*lx %08x  %s\n", mark, r.cycle, in.width, r.pc, r.ir,
+           disasm(r.pc, r.ir, buf, sizeof(buf)));
+}
+
+static void print_diff(uint64_t diff, Record &a, Record &b, Input &in) {
+    if (diff & FIELD_CYCLE) {
+        printf("      cycle: %lu != %lu\n", a.cycle, b.cycle);
+    }
+    if (diff & FIELD_PC) {
+        printf("      pc   : %0*lx != %0*lx\n", in.width, a.pc, in.width, b.pc);
+    }
+    if (diff & FIELD_IR) {
+        printf("      ir   : %08x != %08x\n", a.ir, b.ir);
+    }
+    for (int i=1; i<32; i++) {
+        if (diff & (1ULL << i)) {
+            printf("      %-4s (x%d): %0*lx != %0*lx\n", reg_name[i], i, in.width, a.reg[i], in.width, b.reg[i]);
+        }
+    }
+    if (diff & FIELD_STORE) {
+        printf("      store: %u bytes %0*lx <- %lx != %u bytes %0*lx <- %lx\n",
+               a.store_len, in.width, a.store_addr, a.store_data,
+               b.store_len, in.width, b.store_addr, b.store_data);
+    }
+}
+
+static void print_context(Record *ring, int nring, uint64_t n, int context, Input &in) {
+    uint64_t first = (n>(uint64_t)context) ? n-context : 0;
+    for (uint64_t k=first; k<n; k++) {
+        print_record("", ring[k % nring], in);
+    }
+}
+
+//------------------------------------------------------------------------------
+// main
+//------------------------------------------------------------------------------
+static void usage() {
+    fprintf(stderr, "Usage: rvemu-tracediff%d [options] <trace> <trace>\n", XLEN);
+    fprintf(stderr, "  -n, --max N        report the first N divergences (default %d)\n", TRACEDIFF_MAX);
+    fprintf(stderr, "  -C, --context N    show N records before each (default %d)\n", TRACEDIFF_CONTEXT);
+    fprintf(stderr, "  -i, --ignore LIST  fields not compared: cycle, pc, ir, store, regs, x0-x31\n");
+    fprintf(stderr, "                     or ABI register names, separated by commas\n");
+    fprintf(stderr, "A trace is the text of TRACE_RF_FILE or a binary one (rvemu --trace).\n");
+    exit(2);
+}
+
+static uint64_t ignore_mask(const char *list) {
+    uint64_t mask = 0;
+    char    *s    = strdup(list);
+    for (char *f=strtok(s, ","); f!=NULL; f=strtok(NULL, ",")) {
+        uint64_t m = 0;
+        if      (strcmp(f, "cycle")==0) m = FIELD_CYCLE;
+        else if (strcmp(f, "pc"   )==0) m = FIELD_PC;
+        else if (strcmp(f, "ir"   )==0) m = FIELD_IR;
+        else if (strcmp(f, "store")==0) m = FIELD_STORE;
+        else if (strcmp(f, "regs" )==0) m = FIELD_REGS;
+        for (int i=0; (m==0) && (i<32); i++) {
+            char x[4];
+            snprintf(x, sizeof(x), "x%d", i);
+            if ((strcmp(f, x)==0) || (strcmp(f, reg_name[i])==0) || ((i==8) && (strcmp(f, "fp")==0))) {
+                m = 1ULL << i;
+            }
+        }
+        if (m==0) {
+            fprintf(stderr, "Error: unknown field (%s).\n", f);
+            exit(2);
+        }
+        mask |= m;
+    }
+    free(s);
+    return mask;
+}
+
+int main(int argc, char **argv) {
+    static struct option long_options[] = {
+        {"max"    , required_argument, NULL, 'n'},
+        {"context", required_argument, NULL, 'C'},
+        {"ignore" , required_argument, NULL, 'i'},
+        {0, 0, 0, 0},
+    };
+    int      max     = TRACEDIFF_MAX;
+    int      context = TRACEDIFF_CONTEXT;
+    uint64_t ignore  = 0;
+    int      opt;
+    while ((opt = getopt_long(argc, argv, "n:C:i:", long_options, NULL))!=-1) {
+        switch (opt) {
+        case 'n': max     = atoi(optarg);        break;
+        case 'C': context = atoi(optarg);        break;
+        case 'i': ignore |= ignore_mask(optarg); break;
+        default : usage();                       break;
+        }
+    }
+    if ((argc-optind!=2) || (max<1) || (context<0)) {
+        usage();
+    }
+
+    Input in[2];
+    for (int i=0; i<2; i++) {
+        if (!in[i].open(argv[optind+i])) {
+            fprintf(stderr, "Error: %s cannot be opened.\n", argv[optind+i]);
+            exit(2);
+        }
+    }
+    // the last context records of each side, and the current one
+    int     nring = context+1;
+    Record *ring[2] = {new Record[nring], new Record[nring]};
+
+    uint64_t n     = 0; // records compared
+    int      found = 0;
+    for (;;) {
+        Record &a    = ring[0][n % nring];
+        Record &b    = ring[1][n % nring];
+        bool    has_a = in[0].next(a);
+        bool    has_b = in[1].next(b);
+        if (!has_a || !has_b) {
+            if (has_a || has_b) {
+                printf("divergence %d at record %lu: %s ends, %s goes on\n", found+1, n+1,
+                       in[(has_a) ? 1 : 0].name, in[(has_a) ? 0 : 1].name);
+                print_context(ring[(has_a) ? 0 : 1], nring, n, context, in[(has_a) ? 0 : 1]);
+                print_record(">>", (has_a) ? a : b, in[(has_a) ? 0 : 1]);
+                found++;
+            }
+            break;
+        }
+        uint64_t diff = compare(a, b, in[0], in[1], ignore);
+        if (diff!=0) {
+            printf("divergence %d at record %lu", found+1, n+1);
+            if (a.text!=NULL) {
+                printf(" (%s:%lu)", in[0].name, in[0].line(a));
+            }
+            if (b.text!=NULL) {
+                printf(" (%s:%lu)", in[1].name, in[1].line(b));
+            }
+            printf("\n");
+            for (int i=0; i<2; i++) {
+                printf(" %s\n", in[i].name);
+                print_context(ring[i], nring, n, context, in[i]);
+                print_record(">>", (i==0) ? a : b, in[i]);
+            }
+            print_diff(diff, a, b, in[0]);
+            if (++found>=max) {
+                n++;
+                break;
+            }
+        }
+        n++;
+    }
+
+    if (found==0) {
+        printf("%lu records, no divergence\n", n);
+    }
+    return (found==0) ? 0 : 1;
+}